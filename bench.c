@@ -0,0 +1,441 @@
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "treasure.h"
+#include "scoreboard.h"
+#include "monitor_protocol.h"
+#include "hunt_gen.h"
+
+// Benchmark harness: generates a hunt of each requested size in the
+// working directory, times the operations the tools perform on it through
+// the same store calls, then deletes it. Each row reports throughput, p50
+// and p99 latency and the read/write-family syscalls per operation, taken
+// from /proc/<pid>/io (syscr + syscw) of this process and, for the
+// round-trip row, the monitor.
+#define DEFAULT_SIZES "1000,100000,10000000"
+
+typedef struct {
+    size_t ops;
+    size_t list_ops;
+    uint32_t users;
+    const char *monitor;
+    int keep;
+} BenchOptions;
+
+// One row of the report
+typedef struct {
+    const char *name;
+    uint64_t records;
+    double *samples;        // nanoseconds
+    size_t count;
+    size_t capacity;
+    pid_t peer;             // also count this process's syscalls, or 0
+    long long syscalls;
+} BenchRow;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// syscr + syscw of a process, or -1 when /proc does not have them
+static long long io_syscalls(pid_t pid) {
+    char path[64], line[128];
+    snprintf(path, sizeof(path), pid ? "/proc/%d/io" : "/proc/self/io", (int)pid);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+    long long total = 0, value;
+    int found = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "syscr: %lld", &value) == 1 || sscanf(line, "syscw: %lld", &value) == 1) {
+            total += value;
+            found++;
+        }
+    }
+    fclose(f);
+    return found == 2 ? total : -1;
+}
+
+static long long row_syscalls(const BenchRow *r) {
+    long long self = io_syscalls(0);
+    if (self < 0 || !r->peer)
+        return self;
+    long long peer = io_syscalls(r->peer);
+    return peer < 0 ? -1 : self + peer;
+}
+
+static void row_begin(BenchRow *r, const char *name, uint64_t records, size_t ops, pid_t peer) {
+    memset(r, 0, sizeof(*r));
+    r->name = name;
+    r->records = records;
+    r->capacity = ops ? ops : 1;
+    r->samples = malloc(r->capacity * sizeof(double));
+    r->peer = peer;
+    r->syscalls = row_syscalls(r);
+}
+
+static void row_sample(BenchRow *r, double start) {
+    double elapsed = now_ns() - start;
+    if (r->samples && r->count < r->capacity)
+        r->samples[r->count++] = elapsed;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void row_end(BenchRow *r) {
+    long long after = row_syscalls(r);
+    if (r->count == 0) {
+        printf("%-10llu %-22s %8s\n", (unsigned long long)r->records, r->name, "failed");
+        free(r->samples);
+        return;
+    }
+    double total = 0;
+    for (size_t i = 0; i < r->count; i++)
+        total += r->samples[i];
+    qsort(r->samples, r->count, sizeof(double), compare_doubles);
+    double p50 = r->samples[(r->count - 1) / 2];
+    double p99 = r->samples[(size_t)((double)(r->count - 1) * 0.99)];
+
+    char syscalls[32] = "-";
+    if (r->syscalls >= 0 && after >= 0)
+        snprintf(syscalls, sizeof(syscalls), "%.1f", (double)(after - r->syscalls) / (double)r->count);
+    printf("%-10llu %-22s %8zu %12.0f %10.1f %10.1f %11s\n", (unsigned long long)r->records, r->name,
+           r->count, (double)r->count / (total / 1e9), p50 / 1e3, p99 / 1e3, syscalls);
+    fflush(stdout);
+    free(r->samples);
+}
+
+// IDs spread over 1..records, so lookups do not all hit one page
+static int32_t spread_id(uint64_t records, size_t i, size_t ops) {
+    return (int32_t)(1 + (uint64_t)((double)i * (double)records / (double)ops) % records);
+}
+
+// treasure_manager --add, without the prompts
+static int op_add(const char *hunt_id, const Treasure *record, const char *username) {
+    Treasure t = *record;
+    TreasureFileHeader hdr;
+    int fd = store_open(hunt_id, 1, 1, &hdr);
+    if (fd < 0)
+        return fd;
+    UserDict users;
+    int rc = user_dict_open(&users, hunt_id, 1);
+    if (rc == STORE_OK) {
+        rc = user_dict_intern(&users, username, &t.user_id);
+        if (rc == STORE_OK)
+            rc = user_dict_sync(&users);
+        user_dict_close(&users);
+    }
+    if (rc == STORE_OK)
+        rc = store_add(fd, hunt_id, &hdr, &t, 1);
+    close(fd);
+    return rc;
+}
+
+static int op_view(const char *hunt_id, int32_t id) {
+    TreasureFileHeader hdr;
+    int fd = store_open(hunt_id, 0, 0, &hdr);
+    if (fd < 0)
+        return fd;
+    Treasure t;
+    int rc = store_find(fd, hunt_id, &hdr, id, &t, NULL);
+    close(fd);
+    return rc;
+}
+
+static int op_list(const char *hunt_id, uint64_t *seen) {
+    TreasureFileHeader hdr;
+    int fd = store_open(hunt_id, 0, 0, &hdr);
+    if (fd < 0)
+        return fd;
+    StoreScan scan;
+    int rc = store_scan_open(&scan, fd, &hdr);
+    if (rc == STORE_OK) {
+        while (store_scan_next(&scan, NULL))
+            (*seen)++;
+        rc = store_scan_error(&scan);
+        store_scan_close(&scan);
+    }
+    close(fd);
+    return rc;
+}
+
+static int op_remove(const char *hunt_id, int32_t id) {
+    TreasureFileHeader hdr;
+    int fd = store_open(hunt_id, 1, 0, &hdr);
+    if (fd < 0)
+        return fd;
+    int rc = store_remove(fd, hunt_id, &hdr, id, NULL);
+    close(fd);
+    return rc;
+}
+
+static int op_score(const char *hunt_id) {
+    Scoreboard sb;
+    scoreboard_init(&sb);
+    int rc = scoreboard_add_hunt(&sb, hunt_id);
+    scoreboard_free(&sb);
+    return rc;
+}
+
+// A monitor started the way treasure_hub starts it
+typedef struct {
+    pid_t pid;
+    int cmd_fd;
+    int out_fd;
+    uint32_t next_request;
+    char buf[FRAME_MAX_DATA + 1];
+} MonitorConn;
+
+static int monitor_start(MonitorConn *m, const char *path) {
+    int out[2], cmd[2];
+    if (pipe(out) < 0)
+        return -1;
+    if (pipe(cmd) < 0) {
+        close(out[0]);
+        close(out[1]);
+        return -1;
+    }
+    m->pid = fork();
+    if (m->pid == 0) {
+        dup2(out[1], STDOUT_FILENO);
+        dup2(cmd[0], STDIN_FILENO);
+        close(out[0]);
+        close(out[1]);
+        close(cmd[0]);
+        close(cmd[1]);
+        execl(path, "monitor", NULL);
+        _exit(127);
+    }
+    close(out[1]);
+    close(cmd[0]);
+    m->out_fd = out[0];
+    m->cmd_fd = cmd[1];
+    m->next_request = 1;
+    if (m->pid < 0) {
+        close(m->out_fd);
+        close(m->cmd_fd);
+        return -1;
+    }
+    // The startup banner
+    FrameHeader hdr;
+    if (frame_read(m->out_fd, &hdr, m->buf, sizeof(m->buf)) <= 0) {
+        close(m->out_fd);
+        close(m->cmd_fd);
+        waitpid(m->pid, NULL, 0);
+        return -1;
+    }
+    return 0;
+}
+
+// Sends one command and reads its response up to the FRAME_END
+static int monitor_call(MonitorConn *m, const char *cmd) {
+    uint32_t id = m->next_request++;
+    if (frame_write(m->cmd_fd, id, FRAME_COMMAND, cmd, (uint32_t)strlen(cmd)) < 0)
+        return -1;
+    FrameHeader hdr;
+    int rc;
+    while ((rc = frame_read(m->out_fd, &hdr, m->buf, sizeof(m->buf))) > 0)
+        if (hdr.request_id == id && hdr.type == FRAME_END)
+            return 0;
+    return -1;
+}
+
+// EOF on its command pipe makes the monitor exit without the stop delay
+static void monitor_stop(MonitorConn *m) {
+    close(m->cmd_fd);
+    FrameHeader hdr;
+    while (frame_read(m->out_fd, &hdr, m->buf, sizeof(m->buf)) > 0)
+        ;
+    close(m->out_fd);
+    waitpid(m->pid, NULL, 0);
+}
+
+static int remove_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    return remove(path);
+}
+
+static void remove_hunt_dir(const char *hunt_id) {
+    nftw(hunt_id, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static int bench_size(uint64_t records, const BenchOptions *o, MonitorConn *monitor) {
+    char hunt_id[64];
+    snprintf(hunt_id, sizeof(hunt_id), "bench_%llu", (unsigned long long)records);
+    struct stat st;
+    if (stat(hunt_id, &st) == 0) {
+        fprintf(stderr, "'%s' already exists; remove it first\n", hunt_id);
+        return 1;
+    }
+
+    BenchRow row;
+    HuntGenOptions gen;
+    hunt_gen_defaults(&gen);
+    gen.treasures = records;
+    gen.users = o->users;
+    uint64_t added;
+    row_begin(&row, "generate", records, 1, 0);
+    double start = now_ns();
+    int rc = hunt_generate(hunt_id, &gen, &added);
+    if (rc < 0) {
+        fprintf(stderr, "Failed to generate hunt '%s': %s\n", hunt_id, store_strerror(rc));
+        row_end(&row);
+        remove_hunt_dir(hunt_id);
+        return 1;
+    }
+    row_sample(&row, start);
+    row_end(&row);
+
+    size_t ops = o->ops < records ? o->ops : (size_t)records;
+    row_begin(&row, "view", records, ops, 0);
+    for (size_t i = 0; i < ops; i++) {
+        start = now_ns();
+        if (op_view(hunt_id, spread_id(records, i, ops)) == STORE_OK)
+            row_sample(&row, start);
+    }
+    row_end(&row);
+
+    uint64_t seen = 0;
+    row_begin(&row, "list", records, o->list_ops, 0);
+    for (size_t i = 0; i < o->list_ops; i++) {
+        start = now_ns();
+        if (op_list(hunt_id, &seen) == STORE_OK)
+            row_sample(&row, start);
+    }
+    row_end(&row);
+
+    char path[512];
+    hunt_path(path, sizeof(path), hunt_id, SCORE_CACHE_FILE);
+    row_begin(&row, "calculate_score (cold)", records, o->list_ops, 0);
+    for (size_t i = 0; i < o->list_ops; i++) {
+        unlink(path);
+        start = now_ns();
+        if (op_score(hunt_id) == STORE_OK)
+            row_sample(&row, start);
+    }
+    row_end(&row);
+    row_begin(&row, "calculate_score", records, ops, 0);
+    for (size_t i = 0; i < ops; i++) {
+        start = now_ns();
+        if (op_score(hunt_id) == STORE_OK)
+            row_sample(&row, start);
+    }
+    row_end(&row);
+
+    if (monitor->pid > 0) {
+        char cmd[128];
+        snprintf(cmd, sizeof(cmd), "view_treasure %s 1", hunt_id);
+        monitor_call(monitor, cmd);     // loads the hunt into its cache
+        row_begin(&row, "hub->monitor view", records, ops, monitor->pid);
+        for (size_t i = 0; i < ops; i++) {
+            snprintf(cmd, sizeof(cmd), "view_treasure %s %d", hunt_id, spread_id(records, i, ops));
+            start = now_ns();
+            if (monitor_call(monitor, cmd) == 0)
+                row_sample(&row, start);
+        }
+        row_end(&row);
+    }
+
+    // The mutating operations last, on IDs past and inside the hunt
+    uint64_t state = gen.seed + records;
+    Treasure t;
+    char username[USERNAME_MAX];
+    row_begin(&row, "add", records, ops, 0);
+    for (size_t i = 0; i < ops; i++) {
+        hunt_gen_record(&gen, &state, gen.first_id + (int32_t)(records + i), &t);
+        snprintf(username, sizeof(username), "user%zu", i % (o->users ? o->users : 1));
+        start = now_ns();
+        if (op_add(hunt_id, &t, username) == STORE_OK)
+            row_sample(&row, start);
+    }
+    row_end(&row);
+
+    row_begin(&row, "remove", records, ops, 0);
+    for (size_t i = 0; i < ops; i++) {
+        start = now_ns();
+        if (op_remove(hunt_id, spread_id(records, i, ops)) == STORE_OK)
+            row_sample(&row, start);
+    }
+    row_end(&row);
+
+    if (!o->keep)
+        remove_hunt_dir(hunt_id);
+    return 0;
+}
+
+static int usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--sizes N,N,...] [--ops N] [--list-ops N] [--users M]\n"
+                    "       %*s [--monitor PATH | --no-monitor] [--keep]\n"
+                    "Default sizes: " DEFAULT_SIZES "\n", prog, (int)strlen(prog), "");
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions o = { .ops = 1000, .list_ops = 10, .users = 1000, .monitor = "./monitor", .keep = 0 };
+    const char *sizes = DEFAULT_SIZES;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) {
+            sizes = argv[++i];
+        } else if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc) {
+            o.ops = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--list-ops") == 0 && i + 1 < argc) {
+            o.list_ops = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--users") == 0 && i + 1 < argc) {
+            o.users = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--monitor") == 0 && i + 1 < argc) {
+            o.monitor = argv[++i];
+        } else if (strcmp(argv[i], "--no-monitor") == 0) {
+            o.monitor = NULL;
+        } else if (strcmp(argv[i], "--keep") == 0) {
+            o.keep = 1;
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    if (o.ops == 0 || o.list_ops == 0 || o.users == 0)
+        return usage(argv[0]);
+
+    MonitorConn *monitor = calloc(1, sizeof(MonitorConn));
+    if (!monitor) {
+        perror("calloc");
+        return 1;
+    }
+    if (o.monitor && monitor_start(monitor, o.monitor) < 0) {
+        fprintf(stderr, "Cannot start %s, skipping the round-trip benchmark\n", o.monitor);
+        monitor->pid = 0;
+    }
+
+    printf("%-10s %-22s %8s %12s %10s %10s %11s\n", "records", "operation", "ops", "ops/s", "p50 us", "p99 us",
+           "syscalls/op");
+    int failures = 0;
+    char *list = strdup(sizes), *save = NULL;
+    for (char *tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        uint64_t records = strtoull(tok, NULL, 10);
+        if (records == 0 || records > INT32_MAX / 2) {
+            fprintf(stderr, "Invalid size '%s'\n", tok);
+            failures++;
+            continue;
+        }
+        failures += bench_size(records, &o, monitor);
+    }
+    free(list);
+
+    if (monitor->pid > 0)
+        monitor_stop(monitor);
+    free(monitor);
+    return failures ? 1 : 0;
+}
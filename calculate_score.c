@@ -6,90 +6,202 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <time.h>
+#include <stdarg.h>
 
-#define TREASURE_FILE "treasures.dat"
-#define USERNAME_MAX 32
+#include "treasure.h"
+#include "scoreboard.h"
+#include "thread_pool.h"
+#include "value_stats.h"
 
+// One hunt scored by --all
 typedef struct {
-    int id;
-    char username[32];
-    double latitude;
-    double longitude;
-    char clue[128];
-    int value;
-} Treasure;
-
-
-typedef struct UserScore {
-    char username[USERNAME_MAX];
-    int score;
-    struct UserScore *next;
-} UserScore;
-
-void add_score(UserScore **head, const char *username, int value) {
-    UserScore *curr = *head;
-    while (curr) {
-        if (strcmp(curr->username, username) == 0) {
-            curr->score += value;
-            return;
-        }
-        curr = curr->next;
-    }
+    const char *hunt_id;
+    Scoreboard scores;
+    int rc;
+    int saved_errno;
+} HuntJob;
 
-    UserScore *new_node = malloc(sizeof(UserScore));
-    if (!new_node) {
-        perror("malloc");
-        exit(1);
-    }
-    strncpy(new_node->username, username, USERNAME_MAX);
-    new_node->score = value;
-    new_node->next = *head;
-    *head = new_node;
+// Per-worker running total, merged into the global leaderboard at the end
+typedef struct {
+    Scoreboard *totals;
+    HuntJob *jobs;
+} AllContext;
+
+static AllContext all_ctx;
+
+static void out(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
 }
 
-void free_scores(UserScore *head) {
-    while (head) {
-        UserScore *tmp = head;
-        head = head->next;
-        free(tmp);
+static void score_hunt_task(void *arg, int worker) {
+    HuntJob *job = arg;
+    scoreboard_init(&job->scores);
+    job->rc = scoreboard_add_hunt(&job->scores, job->hunt_id);
+    job->saved_errno = errno;
+    if (job->rc == STORE_OK && scoreboard_merge(&all_ctx.totals[worker], &job->scores) < 0) {
+        job->rc = STORE_ERR_IO;
+        job->saved_errno = ENOMEM;
     }
 }
 
-int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <hunt_id>\n", argv[0]);
+static int score_all(int threads, long top) {
+    char **hunts;
+    int count = store_list_hunts(&hunts);
+    if (count < 0) {
+        fprintf(stderr, "Failed to list hunts: %s\n", strerror(errno));
         return 1;
     }
+    if (count == 0) {
+        printf("No hunts found.\n");
+        store_free_hunts(hunts, count);
+        return 0;
+    }
+    if (threads > count)
+        threads = count;
 
-    char path[512];
-    snprintf(path, sizeof(path), "%s/%s", argv[1], TREASURE_FILE);
-
-    FILE *f = fopen(path, "rb");
-    if (!f) {
-        fprintf(stderr, "Failed to open treasures file '%s': %s\n", path, strerror(errno));
+    ThreadPool pool;
+    all_ctx.jobs = calloc((size_t)count, sizeof(HuntJob));
+    all_ctx.totals = calloc((size_t)threads, sizeof(Scoreboard));
+    if (!all_ctx.jobs || !all_ctx.totals || pool_init(&pool, threads) < 0) {
+        perror("Failed to start worker threads");
         return 1;
     }
 
-    UserScore *scores = NULL;
-    Treasure t;
+    for (int i = 0; i < count; i++) {
+        all_ctx.jobs[i].hunt_id = hunts[i];
+        pool_submit(&pool, score_hunt_task, &all_ctx.jobs[i]);
+    }
+    pool_wait(&pool);
+    pool_destroy(&pool);
 
-    while (fread(&t, sizeof(Treasure), 1, f) == 1) {
-        add_score(&scores, t.username, t.value);
+    int failures = 0;
+    for (int i = 0; i < count; i++) {
+        HuntJob *job = &all_ctx.jobs[i];
+        if (job->rc < 0) {
+            errno = job->saved_errno;
+            fprintf(stderr, "Failed to read treasures for hunt '%s': %s\n", job->hunt_id, store_strerror(job->rc));
+            failures++;
+        } else if (top > 0) {
+            printf("Top %zu for hunt '%s':\n", (size_t)top < job->scores.count ? (size_t)top : job->scores.count,
+                   job->hunt_id);
+            scoreboard_print_top(&job->scores, (size_t)top, out);
+        } else {
+            printf("Scores for hunt '%s':\n", job->hunt_id);
+            scoreboard_print_users(&job->scores, out);
+        }
+        scoreboard_free(&job->scores);
     }
-    fclose(f);
 
-    if (!scores) {
-        printf("No treasures found in hunt '%s'.\n", argv[1]);
-        return 0;
+    Scoreboard global;
+    scoreboard_init(&global);
+    for (int i = 0; i < threads; i++) {
+        scoreboard_merge(&global, &all_ctx.totals[i]);
+        scoreboard_free(&all_ctx.totals[i]);
     }
+    printf("Global leaderboard (%d hunts, %zu users):\n", count - failures, global.count);
+    scoreboard_print_top(&global, top > 0 ? (size_t)top : global.count, out);
+
+    scoreboard_free(&global);
+    free(all_ctx.jobs);
+    free(all_ctx.totals);
+    store_free_hunts(hunts, count);
+    return failures ? 1 : 0;
+}
 
-    printf("Scores for hunt '%s':\n", argv[1]);
-    UserScore *curr = scores;
-    while (curr) {
-        printf("User: %s, Score: %d\n", curr->username, curr->score);
-        curr = curr->next;
+// --stats: value aggregates and box counts through the SIMD kernels
+static int print_stats(const char *hunt_id, int32_t threshold, const GeoQuery *box) {
+    struct timespec start, end;
+    ValueStats s;
+    uint64_t bytes;
+    int columnar;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int rc = store_hunt_stats(hunt_id, threshold, box, &s, &bytes, &columnar);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (rc < 0) {
+        fprintf(stderr, "Failed to read treasures for hunt '%s': %s\n", hunt_id, store_strerror(rc));
+        return 1;
+    }
+
+    double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("Stats for hunt '%s':\n", hunt_id);
+    printf("Treasures: %llu\n", (unsigned long long)s.count);
+    printf("Total value: %lld\n", (long long)s.sum);
+    if (s.count > 0)
+        printf("Min value: %d, Max value: %d, Mean value: %.2f\n", s.min, s.max, (double)s.sum / (double)s.count);
+    printf("Values above %d: %llu\n", threshold, (unsigned long long)s.above);
+    if (box)
+        printf("Inside the box: %llu\n", (unsigned long long)s.in_box);
+    printf("Scanned %.1f MB in %.3f ms (%.0f MB/s, %s kernels, %s)\n", (double)bytes / 1e6, seconds * 1e3,
+           seconds > 0 ? (double)bytes / 1e6 / seconds : 0.0, kernel_name(),
+           columnar ? "columnar snapshot" : "treasures.dat");
+    return 0;
+}
+
+static int usage(const char *prog) {
+    fprintf(stderr, "Usage: %s <hunt_id> [--top N]\n"
+                    "       %s <hunt_id> --stats [--above N] [--bbox lat_min lon_min lat_max lon_max]\n"
+                    "       %s --all [--threads N] [--top N]\n", prog, prog, prog);
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    long top = 0;
+    int threads = pool_default_threads();
+    const char *hunt_id = NULL;
+    int all = 0;
+    int stats = 0;
+    int32_t threshold = 0;
+    GeoQuery box;
+    int has_box = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--stats") == 0) {
+            stats = 1;
+        } else if (strcmp(argv[i], "--above") == 0 && i + 1 < argc) {
+            threshold = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--bbox") == 0 && i + 4 < argc) {
+            geo_query_bbox(&box, atof(argv[i + 1]), atof(argv[i + 2]), atof(argv[i + 3]), atof(argv[i + 4]));
+            has_box = 1;
+            i += 4;
+        } else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc) {
+            top = strtol(argv[++i], NULL, 10);
+            if (top <= 0)
+                return usage(argv[0]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+            if (threads <= 0)
+                return usage(argv[0]);
+        } else if (strcmp(argv[i], "--all") == 0) {
+            all = 1;
+        } else if (argv[i][0] != '-' && !hunt_id) {
+            hunt_id = argv[i];
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    if (all == (hunt_id != NULL) || (stats && all))
+        return usage(argv[0]);
+
+    if (stats)
+        return print_stats(hunt_id, threshold, has_box ? &box : NULL);
+
+    if (all)
+        return score_all(threads, top);
+
+    Scoreboard scores;
+    scoreboard_init(&scores);
+    int rc = scoreboard_add_hunt(&scores, hunt_id);
+    if (rc < 0) {
+        fprintf(stderr, "Failed to read treasures for hunt '%s': %s\n", hunt_id, store_strerror(rc));
+        scoreboard_free(&scores);
+        return 1;
     }
 
-    free_scores(scores);
+    scoreboard_print(&scores, hunt_id, (size_t)top, out);
+    scoreboard_free(&scores);
     return 0;
 }
@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "treasure.h"
+#include "hunt_gen.h"
+
+static int usage(const char *prog) {
+    fprintf(stderr, "Usage: %s <hunt_id> <treasures> [--users M] [--center lat lon] [--spread degrees]\n"
+                    "       %*s [--first-id N] [--seed S]\n", prog, (int)strlen(prog), "");
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3)
+        return usage(argv[0]);
+    HuntGenOptions o;
+    hunt_gen_defaults(&o);
+    const char *hunt_id = argv[1];
+    o.treasures = strtoull(argv[2], NULL, 10);
+
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--users") == 0 && i + 1 < argc) {
+            o.users = (uint32_t)strtoul(argv[++i], NULL, 10);
+            if (o.users == 0)
+                return usage(argv[0]);
+        } else if (strcmp(argv[i], "--center") == 0 && i + 2 < argc) {
+            o.center_lat = atof(argv[i + 1]);
+            o.center_lon = atof(argv[i + 2]);
+            i += 2;
+        } else if (strcmp(argv[i], "--spread") == 0 && i + 1 < argc) {
+            o.spread = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--first-id") == 0 && i + 1 < argc) {
+            o.first_id = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            o.seed = strtoull(argv[++i], NULL, 10);
+        } else {
+            return usage(argv[0]);
+        }
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t added;
+    int rc = hunt_generate(hunt_id, &o, &added);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (rc < 0) {
+        fprintf(stderr, "Failed to generate hunt '%s': %s\n", hunt_id, store_strerror(rc));
+        return 1;
+    }
+    double secs = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("Generated %llu treasures for %u users in hunt '%s' in %.3f s\n",
+           (unsigned long long)added, o.users, hunt_id, secs);
+    return 0;
+}
@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "hunt_cache.h"
+
+static size_t id_hash(int32_t id, size_t mask) {
+    return ((uint32_t)id * 2654435761u) & mask;
+}
+
+const Treasure *cached_hunt_find(const CachedHunt *h, int32_t id) {
+    size_t mask = h->index_capacity - 1;
+    for (size_t pos = id_hash(id, mask); h->index[pos]; pos = (pos + 1) & mask) {
+        const Treasure *t = &h->records[h->index[pos] - 1];
+        if (t->id == id)
+            return t;
+    }
+    return NULL;
+}
+
+static void free_hunt(CachedHunt *h) {
+    if (h->fd >= 0)
+        close(h->fd);
+    free(h->records);
+    free(h->index);
+    user_dict_close(&h->users);
+    free(h->name);
+    free(h);
+}
+
+// Reads every live record of a hunt and indexes them by ID. fd and hdr come
+// from store_open and are taken over by the entry; users.dat is read after
+// that header, so it names every record.
+static CachedHunt *load_hunt(const char *hunt_id, int fd, const TreasureFileHeader *hdr,
+                             const struct stat *st) {
+    CachedHunt *h = calloc(1, sizeof(CachedHunt));
+    if (!h)
+        return NULL;
+    h->fd = fd;
+    h->hdr = *hdr;
+    h->ino = st->st_ino;
+    h->size = st->st_size;
+    h->mtime = st->st_mtim;
+    h->name = strdup(hunt_id);
+    h->users.fd = -1;
+
+    uint64_t live = store_live_count(hdr);
+    h->index_capacity = 16;
+    while (h->index_capacity < live * 2)
+        h->index_capacity *= 2;
+    h->records = malloc((live ? live : 1) * sizeof(Treasure));
+    h->index = calloc(h->index_capacity, sizeof(uint32_t));
+    StoreScan scan;
+    if (!h->name || !h->records || !h->index || user_dict_open(&h->users, hunt_id, 0) != STORE_OK ||
+        store_scan_open(&scan, fd, hdr) != STORE_OK) {
+        h->fd = -1;
+        free_hunt(h);
+        return NULL;
+    }
+
+    size_t mask = h->index_capacity - 1;
+    const Treasure *t;
+    while (h->count < live && (t = store_scan_next(&scan, NULL)) != NULL) {
+        size_t pos = id_hash(t->id, mask);
+        while (h->index[pos])
+            pos = (pos + 1) & mask;
+        h->records[h->count] = *t;
+        h->index[pos] = (uint32_t)++h->count;
+    }
+    int rc = store_scan_error(&scan);
+    store_scan_close(&scan);
+    if (rc != STORE_OK) {
+        h->fd = -1;
+        free_hunt(h);
+        return NULL;
+    }
+    h->bytes = sizeof(CachedHunt) + live * sizeof(Treasure) + h->index_capacity * sizeof(uint32_t) +
+               h->users.capacity * USERNAME_MAX + h->users.slot_capacity * sizeof(uint32_t);
+    return h;
+}
+
+// True if the entry still describes treasures.dat as it is now
+static int still_current(const CachedHunt *h) {
+    char path[512];
+    struct stat st;
+    TreasureFileHeader hdr;
+    hunt_path(path, sizeof(path), h->name, TREASURE_FILE);
+    if (stat(path, &st) < 0 || st.st_ino != h->ino || st.st_size != h->size ||
+        st.st_mtim.tv_sec != h->mtime.tv_sec || st.st_mtim.tv_nsec != h->mtime.tv_nsec)
+        return 0;
+    // Writes in the same timestamp tick leave mtime alone; the header
+    // generation still tells them apart
+    return store_read_header(h->fd, &hdr) == STORE_OK && hdr.generation == h->hdr.generation;
+}
+
+static void unlink_entry(HuntCache *c, CachedHunt *h) {
+    if (h->prev)
+        h->prev->next = h->next;
+    else
+        c->head = h->next;
+    if (h->next)
+        h->next->prev = h->prev;
+    else
+        c->tail = h->prev;
+    h->prev = h->next = NULL;
+}
+
+static void push_front(HuntCache *c, CachedHunt *h) {
+    h->prev = NULL;
+    h->next = c->head;
+    if (c->head)
+        c->head->prev = h;
+    c->head = h;
+    if (!c->tail)
+        c->tail = h;
+}
+
+// Removes an entry from the cache; it is freed once no query uses it
+static void evict(HuntCache *c, CachedHunt *h) {
+    unlink_entry(c, h);
+    c->bytes -= h->bytes;
+    h->evicted = 1;
+    if (h->refs == 0)
+        free_hunt(h);
+}
+
+void hunt_cache_init(HuntCache *c, size_t budget) {
+    memset(c, 0, sizeof(*c));
+    pthread_mutex_init(&c->lock, NULL);
+    c->budget = budget;
+}
+
+void hunt_cache_free(HuntCache *c) {
+    while (c->head)
+        evict(c, c->head);
+    pthread_mutex_destroy(&c->lock);
+}
+
+int hunt_cache_get(HuntCache *c, const char *hunt_id, CachedHunt **out) {
+    pthread_mutex_lock(&c->lock);
+    CachedHunt *h = c->head;
+    while (h && strcmp(h->name, hunt_id) != 0)
+        h = h->next;
+    if (h)
+        h->refs++;
+    pthread_mutex_unlock(&c->lock);
+
+    // Checked without the lock, so a stat and a header read never hold up
+    // queries on other hunts; the reference keeps the entry alive meanwhile
+    if (h) {
+        int current = still_current(h);
+        pthread_mutex_lock(&c->lock);
+        if (!h->evicted && current) {
+            unlink_entry(c, h);
+            push_front(c, h);
+        } else if (!h->evicted) {
+            evict(c, h);
+        }
+        pthread_mutex_unlock(&c->lock);
+        if (current) {
+            store_counters.cache_hits++;
+            *out = h;
+            return 1;
+        }
+        hunt_cache_put(c, h);
+    }
+    store_counters.cache_misses++;
+
+    TreasureFileHeader hdr;
+    int fd = store_open(hunt_id, 0, 0, &hdr);
+    if (fd < 0)
+        return fd;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return STORE_ERR_IO;
+    }
+    if (store_live_count(&hdr) * sizeof(Treasure) > c->budget) {
+        close(fd);
+        return 0;
+    }
+
+    // Loaded without the lock so other hunts can be served meanwhile
+    h = load_hunt(hunt_id, fd, &hdr, &st);
+    if (!h) {
+        // errno says why: out of memory, or a failed read of users.dat or
+        // the records
+        close(fd);
+        return STORE_ERR_IO;
+    }
+
+    h->refs = 1;
+    if (h->bytes > c->budget) {
+        // Its index pushed it over: serve this query, then drop it
+        h->evicted = 1;
+        *out = h;
+        return 1;
+    }
+
+    pthread_mutex_lock(&c->lock);
+    for (CachedHunt *old = c->head; old; old = old->next) {
+        if (strcmp(old->name, hunt_id) == 0) {
+            evict(c, old);
+            break;
+        }
+    }
+    while (c->tail && c->bytes + h->bytes > c->budget)
+        evict(c, c->tail);
+    push_front(c, h);
+    c->bytes += h->bytes;
+    pthread_mutex_unlock(&c->lock);
+    *out = h;
+    return 1;
+}
+
+void hunt_cache_put(HuntCache *c, CachedHunt *h) {
+    pthread_mutex_lock(&c->lock);
+    if (--h->refs == 0 && h->evicted)
+        free_hunt(h);
+    pthread_mutex_unlock(&c->lock);
+}
@@ -0,0 +1,60 @@
+#ifndef HUNT_CACHE_H
+#define HUNT_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "treasure.h"
+
+// LRU cache of recently queried hunts for the monitor: the live records of
+// each hunt in slot order plus an in-memory ID index over them. An entry is
+// checked against treasures.dat on every use (inode, size and mtime from a
+// stat, then the header generation) and reloaded if anything changed; the
+// check runs outside the cache lock, under a reference to the entry. The
+// total size of the entries is kept under a byte budget.
+typedef struct CachedHunt {
+    char *name;
+    int fd;                     // kept open to re-read the header cheaply
+    TreasureFileHeader hdr;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    Treasure *records;          // live records only
+    size_t count;
+    uint32_t *index;            // ID hash table of record positions + 1
+    size_t index_capacity;      // power of two
+    UserDict users;             // names of the records' user IDs
+    size_t bytes;
+    int refs;
+    int evicted;
+    struct CachedHunt *prev;
+    struct CachedHunt *next;
+} CachedHunt;
+
+typedef struct {
+    pthread_mutex_t lock;
+    CachedHunt *head;           // most recently used
+    CachedHunt *tail;
+    size_t bytes;
+    size_t budget;
+} HuntCache;
+
+// Default budget, overridden with MONITOR_CACHE_MB in the environment
+#define HUNT_CACHE_DEFAULT_MB 64
+
+void hunt_cache_init(HuntCache *c, size_t budget);
+void hunt_cache_free(HuntCache *c);
+
+// Returns 1 with a referenced entry in *out, 0 when the hunt is larger than
+// the whole budget (read it from disk instead), or a STORE_ERR_* code.
+int hunt_cache_get(HuntCache *c, const char *hunt_id, CachedHunt **out);
+// Drops the reference taken by hunt_cache_get
+void hunt_cache_put(HuntCache *c, CachedHunt *h);
+
+// Record with the given ID, or NULL
+const Treasure *cached_hunt_find(const CachedHunt *h, int32_t id);
+
+#endif
@@ -0,0 +1,298 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "treasure.h"
+#include "hunt_catalog.h"
+
+#define ROOT_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+#define HUNT_EVENTS (IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | \
+                     IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_ONLYDIR)
+
+// Index of name in the sorted list, or where it would be inserted
+static size_t find_slot(const HuntCatalog *c, const char *name, int *found) {
+    size_t lo = 0, hi = c->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(c->hunts[mid]->name, name);
+        if (cmp == 0) {
+            *found = 1;
+            return mid;
+        }
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *found = 0;
+    return lo;
+}
+
+static int map_wd(HuntCatalog *c, int wd, HuntInfo *h) {
+    if (wd < 0)
+        return 0;
+    if ((size_t)wd >= c->wd_capacity) {
+        size_t capacity = c->wd_capacity ? c->wd_capacity : 64;
+        while (capacity <= (size_t)wd)
+            capacity *= 2;
+        HuntInfo **grown = realloc(c->by_wd, capacity * sizeof(HuntInfo *));
+        if (!grown)
+            return -1;
+        memset(grown + c->wd_capacity, 0, (capacity - c->wd_capacity) * sizeof(HuntInfo *));
+        c->by_wd = grown;
+        c->wd_capacity = capacity;
+    }
+    c->by_wd[wd] = h;
+    return 0;
+}
+
+static HuntInfo *add_hunt(HuntCatalog *c, const char *name) {
+    int found;
+    size_t pos = find_slot(c, name, &found);
+    if (found)
+        return c->hunts[pos];
+
+    if (c->count == c->capacity) {
+        size_t capacity = c->capacity ? c->capacity * 2 : 64;
+        HuntInfo **grown = realloc(c->hunts, capacity * sizeof(HuntInfo *));
+        if (!grown)
+            return NULL;
+        c->hunts = grown;
+        c->capacity = capacity;
+    }
+    HuntInfo *h = calloc(1, sizeof(HuntInfo));
+    if (!h || !(h->name = strdup(name))) {
+        free(h);
+        return NULL;
+    }
+    h->dirty = 1;
+    h->status = STORE_ERR_NOT_FOUND;
+    h->wd = -1;
+    // Watch before the first read, so nothing written after it is missed
+    if (c->inotify_fd >= 0) {
+        h->wd = inotify_add_watch(c->inotify_fd, name, HUNT_EVENTS);
+        if (map_wd(c, h->wd, h) < 0) {
+            inotify_rm_watch(c->inotify_fd, h->wd);
+            h->wd = -1;
+        }
+    }
+    memmove(c->hunts + pos + 1, c->hunts + pos, (c->count - pos) * sizeof(HuntInfo *));
+    c->hunts[pos] = h;
+    c->count++;
+    return h;
+}
+
+static void free_hunt(HuntCatalog *c, HuntInfo *h) {
+    if (h->wd >= 0) {
+        if (c->inotify_fd >= 0)
+            inotify_rm_watch(c->inotify_fd, h->wd);
+        if ((size_t)h->wd < c->wd_capacity && c->by_wd[h->wd] == h)
+            c->by_wd[h->wd] = NULL;
+    }
+    free(h->name);
+    free(h);
+}
+
+static void remove_hunt(HuntCatalog *c, const char *name) {
+    int found;
+    size_t pos = find_slot(c, name, &found);
+    if (!found)
+        return;
+    free_hunt(c, c->hunts[pos]);
+    c->count--;
+    memmove(c->hunts + pos, c->hunts + pos + 1, (c->count - pos) * sizeof(HuntInfo *));
+}
+
+// Re-reads one hunt's header, unless its data file is unchanged
+static void refresh_hunt(HuntInfo *h) {
+    char path[512];
+    struct stat st;
+    hunt_path(path, sizeof(path), h->name, TREASURE_FILE);
+    h->dirty = 0;
+    // A directory without a data file is not a hunt; any other failure is
+    // listed, so an unreadable hunt does not look deleted
+    if (stat(path, &st) < 0) {
+        h->status = errno == ENOENT || errno == ENOTDIR ? STORE_ERR_NOT_FOUND : STORE_ERR_IO;
+        h->error = errno;
+        return;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        h->status = STORE_ERR_NOT_FOUND;
+        return;
+    }
+    if (h->status == STORE_OK && st.st_ino == h->ino && st.st_size == h->size &&
+        st.st_mtim.tv_sec == h->mtime.tv_sec && st.st_mtim.tv_nsec == h->mtime.tv_nsec)
+        return;
+
+    TreasureFileHeader hdr;
+    int fd = store_open(h->name, 0, 0, &hdr);
+    h->status = fd >= 0 ? STORE_OK : fd;
+    h->error = fd == STORE_ERR_IO ? errno : 0;
+    if (fd >= 0) {
+        h->live_count = store_live_count(&hdr);
+        // Stat the file actually read, in case it was replaced meanwhile
+        fstat(fd, &st);
+        close(fd);
+    }
+    h->size = st.st_size;
+    h->mtime = st.st_mtim;
+    h->ino = st.st_ino;
+}
+
+static void refresh_task(void *arg, int worker) {
+    refresh_hunt(arg);
+}
+
+static int needs_refresh(const HuntInfo *h) {
+    return h->dirty || h->wd < 0;
+}
+
+// Re-reads every hunt that needs it; with thousands of hunts (at startup,
+// or without inotify) their headers are read in parallel on the pool
+static void refresh_all(HuntCatalog *c) {
+    size_t stale = 0;
+    for (size_t i = 0; i < c->count; i++)
+        stale += needs_refresh(c->hunts[i]);
+    TaskGroup group;
+    task_group_init(&group);
+    for (size_t i = 0; i < c->count; i++) {
+        HuntInfo *h = c->hunts[i];
+        if (!needs_refresh(h))
+            continue;
+        if (!c->pool || stale < 2 || pool_submit_group(c->pool, &group, refresh_task, h) < 0)
+            refresh_hunt(h);
+    }
+    task_group_wait(&group);
+    task_group_destroy(&group);
+}
+
+static int is_hunt_dir(const struct dirent *entry) {
+    if (entry->d_name[0] == '.')
+        return 0;
+    if (entry->d_type == DT_DIR)
+        return 1;
+    struct stat st;
+    return entry->d_type == DT_UNKNOWN && stat(entry->d_name, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Full scan of the working directory: adds new hunts, drops vanished ones
+// and marks everything dirty
+static void rescan(HuntCatalog *c) {
+    DIR *d = opendir(".");
+    if (!d)
+        return;
+    for (size_t i = 0; i < c->count; i++)
+        c->hunts[i]->dirty = 2;     // 2: not seen yet
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (!is_hunt_dir(entry))
+            continue;
+        HuntInfo *h = add_hunt(c, entry->d_name);
+        if (h)
+            h->dirty = 1;
+    }
+    closedir(d);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < c->count; i++) {
+        if (c->hunts[i]->dirty == 2)
+            free_hunt(c, c->hunts[i]);
+        else
+            c->hunts[kept++] = c->hunts[i];
+    }
+    c->count = kept;
+    c->rescan = 0;
+}
+
+// Applies the queued inotify events without blocking
+static void drain_events(HuntCatalog *c) {
+    char buf[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t n = read(c->inotify_fd, buf, sizeof(buf));
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            return;
+        }
+        for (char *p = buf; p < buf + n;) {
+            const struct inotify_event *ev = (const void *)p;
+            p += sizeof(*ev) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                c->rescan = 1;
+                continue;
+            }
+            if (ev->wd == c->root_wd) {
+                if (!(ev->mask & IN_ISDIR) || ev->len == 0 || ev->name[0] == '.')
+                    continue;
+                if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+                    add_hunt(c, ev->name);
+                else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+                    remove_hunt(c, ev->name);
+                continue;
+            }
+            if (ev->wd < 0 || (size_t)ev->wd >= c->wd_capacity || !c->by_wd[ev->wd])
+                continue;
+            if (ev->mask & IN_IGNORED) {
+                // The hunt directory went away; the root event removes it
+                c->by_wd[ev->wd]->wd = -1;
+                c->by_wd[ev->wd] = NULL;
+                continue;
+            }
+            if (ev->len > 0 && strcmp(ev->name, TREASURE_FILE) == 0)
+                c->by_wd[ev->wd]->dirty = 1;
+        }
+    }
+}
+
+int catalog_init(HuntCatalog *c, ThreadPool *pool) {
+    memset(c, 0, sizeof(*c));
+    c->pool = pool;
+    pthread_mutex_init(&c->lock, NULL);
+    c->root_wd = -1;
+    c->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (c->inotify_fd >= 0) {
+        c->root_wd = inotify_add_watch(c->inotify_fd, ".", ROOT_EVENTS);
+        if (c->root_wd < 0) {
+            close(c->inotify_fd);
+            c->inotify_fd = -1;
+        }
+    }
+    rescan(c);
+    refresh_all(c);
+    return c->inotify_fd >= 0 ? 0 : -1;
+}
+
+void catalog_free(HuntCatalog *c) {
+    for (size_t i = 0; i < c->count; i++)
+        free_hunt(c, c->hunts[i]);
+    free(c->hunts);
+    free(c->by_wd);
+    if (c->inotify_fd >= 0)
+        close(c->inotify_fd);
+    pthread_mutex_destroy(&c->lock);
+    memset(c, 0, sizeof(*c));
+    c->inotify_fd = -1;
+}
+
+void catalog_foreach(HuntCatalog *c, void (*fn)(const HuntInfo *h, void *arg), void *arg) {
+    pthread_mutex_lock(&c->lock);
+    if (c->inotify_fd >= 0)
+        drain_events(c);
+    if (c->inotify_fd < 0 || c->rescan)
+        rescan(c);
+    refresh_all(c);
+    for (size_t i = 0; i < c->count; i++) {
+        HuntInfo *h = c->hunts[i];
+        if (h->status != STORE_ERR_NOT_FOUND)
+            fn(h, arg);
+    }
+    pthread_mutex_unlock(&c->lock);
+}
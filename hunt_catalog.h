@@ -0,0 +1,51 @@
+#ifndef HUNT_CATALOG_H
+#define HUNT_CATALOG_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "thread_pool.h"
+
+// In-memory list of the hunts under the working directory. It is built
+// once by scanning the directory and then kept current from inotify events
+// on the directory and on every hunt directory: an event only marks the
+// hunt dirty, and the next lookup re-reads just the dirty hunts (several at
+// once on the pool, if one was given). Without inotify every lookup falls
+// back to a full rescan.
+typedef struct {
+    char *name;
+    int wd;                 // inotify watch on the hunt directory, or -1
+    int dirty;
+    int status;             // STORE_OK, or why treasures.dat cannot be opened
+                            // (STORE_ERR_NOT_FOUND: the directory has none)
+    int error;              // errno behind a STORE_ERR_IO status
+    uint64_t live_count;
+    off_t size;
+    struct timespec mtime;
+    ino_t ino;
+} HuntInfo;
+
+typedef struct {
+    pthread_mutex_t lock;
+    int inotify_fd;         // -1 when inotify is not available
+    int root_wd;
+    HuntInfo **hunts;       // sorted by name
+    size_t count;
+    size_t capacity;
+    HuntInfo **by_wd;       // watch descriptor -> hunt
+    size_t wd_capacity;
+    int rescan;             // events were lost: rebuild from the directory
+    ThreadPool *pool;       // for refreshing hunts in parallel, or NULL
+} HuntCatalog;
+
+// pool may be NULL; the catalog's callers must not be tasks of that pool
+int catalog_init(HuntCatalog *c, ThreadPool *pool);
+void catalog_free(HuntCatalog *c);
+
+// Brings the catalog up to date, then calls fn on every hunt that holds a
+// treasures.dat, readable or not, in name order, with the catalog locked
+void catalog_foreach(HuntCatalog *c, void (*fn)(const HuntInfo *h, void *arg), void *arg);
+
+#endif
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "hunt_gen.h"
+
+void hunt_gen_defaults(HuntGenOptions *o) {
+    memset(o, 0, sizeof(*o));
+    o->treasures = 1000;
+    o->users = 100;
+    o->center_lat = 48.85;
+    o->center_lon = 2.35;
+    o->spread = 10.0;
+    o->first_id = 1;
+    o->seed = 1;
+}
+
+uint64_t hunt_gen_next(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 2685821657736338717ULL;
+}
+
+// Uniform in [-1, 1)
+static double unit(uint64_t *state) {
+    return (double)(hunt_gen_next(state) >> 11) / (double)(1ULL << 52) - 1.0;
+}
+
+void hunt_gen_record(const HuntGenOptions *o, uint64_t *state, int32_t id, Treasure *t) {
+    memset(t, 0, sizeof(*t));
+    t->id = id;
+    double lat = o->center_lat + unit(state) * o->spread;
+    double lon = o->center_lon + unit(state) * o->spread;
+    t->latitude = lat > 90.0 ? 90.0 : lat < -90.0 ? -90.0 : lat;
+    while (lon >= 180.0)
+        lon -= 360.0;
+    while (lon < -180.0)
+        lon += 360.0;
+    t->longitude = lon;
+    t->value = (int32_t)(hunt_gen_next(state) % 1000);
+    snprintf(t->clue, sizeof(t->clue), "Generated clue %d", id);
+}
+
+static int sync_users(void *users) {
+    return user_dict_sync(users);
+}
+
+int hunt_generate(const char *hunt_id, const HuntGenOptions *o, uint64_t *added) {
+    *added = 0;
+    TreasureFileHeader hdr;
+    int fd = store_open(hunt_id, 1, 1, &hdr);
+    if (fd < 0)
+        return fd;
+
+    UserDict users;
+    int rc = user_dict_open(&users, hunt_id, 1);
+    if (rc < 0) {
+        close(fd);
+        return rc;
+    }
+    uint32_t nusers = o->users ? o->users : 1;
+    uint32_t *ids = malloc(nusers * sizeof(uint32_t));
+    if (!ids) {
+        user_dict_close(&users);
+        close(fd);
+        errno = ENOMEM;
+        return STORE_ERR_IO;
+    }
+    char name[USERNAME_MAX];
+    for (uint32_t u = 0; u < nusers && rc == STORE_OK; u++) {
+        snprintf(name, sizeof(name), "user%u", u);
+        rc = user_dict_intern(&users, name, &ids[u]);
+    }
+
+    StoreImport im;
+    if (rc == STORE_OK)
+        rc = store_import_begin(&im, fd, hunt_id);
+    if (rc == STORE_OK) {
+        im.before_commit = sync_users;
+        im.before_commit_arg = &users;
+        uint64_t state = o->seed ? o->seed : 1;
+        Treasure t;
+        for (uint64_t i = 0; i < o->treasures; i++) {
+            hunt_gen_record(o, &state, o->first_id + (int32_t)i, &t);
+            t.user_id = ids[i % nusers];
+            rc = store_import_add(&im, &t);
+            if (rc < 0 && rc != STORE_ERR_EXISTS)
+                break;
+        }
+        int end = store_import_end(&im);
+        if (rc == STORE_OK || rc == STORE_ERR_EXISTS)
+            rc = end;
+        *added = im.added;
+    }
+
+    free(ids);
+    user_dict_close(&users);
+    close(fd);
+    return rc;
+}
@@ -0,0 +1,36 @@
+#ifndef HUNT_GEN_H
+#define HUNT_GEN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "treasure.h"
+
+// Synthetic hunts for benchmarks: treasures with IDs first_id, first_id+1,
+// ... owned by users "user0".."user<M-1>" in turn, scattered uniformly
+// within spread degrees of a center point (latitudes clamped to the
+// poles, longitudes wrapped), with values in [0, 1000). The same seed
+// always gives the same hunt.
+typedef struct {
+    uint64_t treasures;
+    uint32_t users;
+    double center_lat;
+    double center_lon;
+    double spread;          // degrees either side of the center
+    int32_t first_id;
+    uint64_t seed;
+} HuntGenOptions;
+
+void hunt_gen_defaults(HuntGenOptions *o);
+
+// Appends the treasures to the hunt (created if needed) through the bulk
+// import path; *added is the number written. Returns STORE_OK or a
+// STORE_ERR_* code.
+int hunt_generate(const char *hunt_id, const HuntGenOptions *o, uint64_t *added);
+
+// One generated record, without its user ID (for single adds)
+void hunt_gen_record(const HuntGenOptions *o, uint64_t *state, int32_t id, Treasure *t);
+// xorshift64* step; state must not be 0
+uint64_t hunt_gen_next(uint64_t *state);
+
+#endif
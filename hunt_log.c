@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "hunt_log.h"
+
+static HuntLog *logs = NULL;
+static int registered = 0;
+static int sync_mode = -1;
+static off_t max_bytes = 0;
+
+static void read_settings(void) {
+    if (sync_mode >= 0)
+        return;
+    const char *sync = getenv("TREASURE_LOG_SYNC");
+    sync_mode = sync && strcmp(sync, "batch") == 0 ? HUNT_LOG_SYNC_BATCH : HUNT_LOG_SYNC_NONE;
+    const char *kb = getenv("TREASURE_LOG_MAX_KB");
+    max_bytes = kb && atol(kb) > 0 ? (off_t)atol(kb) * 1024 : HUNT_LOG_MAX_BYTES;
+}
+
+HuntLog *hunt_log_get(const char *hunt_id) {
+    for (HuntLog *log = logs; log; log = log->next)
+        if (strcmp(log->hunt_id, hunt_id) == 0)
+            return log;
+
+    read_settings();
+    if (!registered) {
+        atexit(hunt_log_flush_all);
+        registered = 1;
+    }
+    HuntLog *log = calloc(1, sizeof(HuntLog));
+    if (!log)
+        return NULL;
+    log->hunt_id = strdup(hunt_id);
+    if (!log->hunt_id) {
+        free(log);
+        return NULL;
+    }
+    log->fd = -1;
+    log->next = logs;
+    logs = log;
+    return log;
+}
+
+// Copies at most room bytes of s with tabs and newlines blanked out
+static size_t put_field(char *p, size_t room, const char *s) {
+    if (!s || !*s)
+        s = "-";
+    size_t n = 0;
+    for (; s[n] && n < room; n++)
+        p[n] = s[n] == '\t' || s[n] == '\n' || s[n] == '\r' ? ' ' : s[n];
+    return n;
+}
+
+void hunt_log_add(HuntLog *log, const char *op, int64_t id, const char *user, const char *detail) {
+    if (!log)
+        return;
+    char line[512];
+    struct timespec ts;
+    struct tm tm;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    gmtime_r(&ts.tv_sec, &tm);
+    size_t len = strftime(line, sizeof(line), "%Y-%m-%dT%H:%M:%S", &tm);
+    len += (size_t)snprintf(line + len, sizeof(line) - len, ".%03ldZ\t", ts.tv_nsec / 1000000);
+    len += put_field(line + len, 32, op);
+    if (id == HUNT_LOG_NO_ID)
+        len += (size_t)snprintf(line + len, sizeof(line) - len, "\t-\t");
+    else
+        len += (size_t)snprintf(line + len, sizeof(line) - len, "\t%lld\t", (long long)id);
+    len += put_field(line + len, USERNAME_MAX, user);
+    line[len++] = '\t';
+    len += put_field(line + len, sizeof(line) - len - 1, detail);
+    line[len++] = '\n';
+
+    if (log->len + len > sizeof(log->buf))
+        hunt_log_flush(log);
+    if (log->len + len <= sizeof(log->buf)) {
+        memcpy(log->buf + log->len, line, len);
+        log->len += len;
+    }
+}
+
+static int open_log(HuntLog *log) {
+    char path[512];
+    hunt_path(path, sizeof(path), log->hunt_id, LOG_FILE);
+    log->fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    return log->fd < 0 ? STORE_ERR_IO : STORE_OK;
+}
+
+// logged_hunt -> logged_hunt.1, .1 -> .2, ..., dropping the oldest
+static void rotate(const char *hunt_id) {
+    char from[512], to[512], name[64];
+    for (int i = HUNT_LOG_KEEP - 1; i >= 1; i--) {
+        snprintf(name, sizeof(name), "%s.%d", LOG_FILE, i);
+        hunt_path(from, sizeof(from), hunt_id, name);
+        snprintf(name, sizeof(name), "%s.%d", LOG_FILE, i + 1);
+        hunt_path(to, sizeof(to), hunt_id, name);
+        rename(from, to);
+    }
+    hunt_path(from, sizeof(from), hunt_id, LOG_FILE);
+    snprintf(name, sizeof(name), "%s.1", LOG_FILE);
+    hunt_path(to, sizeof(to), hunt_id, name);
+    rename(from, to);
+}
+
+// Locks the log file that is current under its path, reopening it if
+// another writer rotated it meanwhile; returns the size it has
+static int lock_current(HuntLog *log, off_t *size) {
+    char path[512];
+    hunt_path(path, sizeof(path), log->hunt_id, LOG_FILE);
+    for (;;) {
+        if (log->fd < 0 && open_log(log) < 0)
+            return STORE_ERR_IO;
+        while (flock(log->fd, LOCK_EX) < 0) {
+            if (errno != EINTR)
+                return STORE_ERR_IO;
+        }
+        struct stat held, current;
+        if (fstat(log->fd, &held) < 0) {
+            flock(log->fd, LOCK_UN);
+            return STORE_ERR_IO;
+        }
+        if (stat(path, &current) == 0 && held.st_ino == current.st_ino && held.st_dev == current.st_dev) {
+            *size = held.st_size;
+            return STORE_OK;
+        }
+        flock(log->fd, LOCK_UN);
+        close(log->fd);
+        log->fd = -1;
+    }
+}
+
+int hunt_log_flush(HuntLog *log) {
+    if (!log || log->len == 0)
+        return STORE_OK;
+    off_t size;
+    int rc;
+    // Rotated while holding the old file's lock; the next round locks
+    // whichever file is current by then, since another writer may already
+    // have created and filled it
+    while ((rc = lock_current(log, &size)) == STORE_OK && size > 0 && size + (off_t)log->len > max_bytes) {
+        rotate(log->hunt_id);
+        flock(log->fd, LOCK_UN);
+        close(log->fd);
+        log->fd = -1;
+    }
+    if (rc == STORE_OK && write(log->fd, log->buf, log->len) != (ssize_t)log->len)
+        rc = STORE_ERR_IO;
+    if (rc == STORE_OK && sync_mode == HUNT_LOG_SYNC_BATCH && fsync(log->fd) < 0)
+        rc = STORE_ERR_IO;
+    if (log->fd >= 0)
+        flock(log->fd, LOCK_UN);
+    log->len = 0;
+    return rc;
+}
+
+void hunt_log_flush_all(void) {
+    for (HuntLog *log = logs; log; log = log->next)
+        hunt_log_flush(log);
+}
+
+void hunt_log_discard(const char *hunt_id) {
+    for (HuntLog *log = logs; log; log = log->next) {
+        if (strcmp(log->hunt_id, hunt_id) != 0)
+            continue;
+        log->len = 0;
+        if (log->fd >= 0)
+            close(log->fd);
+        log->fd = -1;
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef HUNT_LOG_H
+#define HUNT_LOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "treasure.h"
+
+// Batched writer for <hunt>/logged_hunt. Entries are formatted into a
+// per-hunt buffer as tab-separated lines
+//   <UTC time>\t<op>\t<treasure ID or ->\t<user or ->\t<detail or ->
+// and reach the file with a single O_APPEND write per batch: when the
+// buffer fills, on hunt_log_flush, or at exit. Once the file passes the
+// size cap it is rotated to logged_hunt.1 (older ones shift up to
+// HUNT_LOG_KEEP) under an exclusive lock, so concurrent writers never
+// interleave inside a batch or write to a rotated file.
+//
+// TREASURE_LOG_SYNC=batch in the environment fsyncs after every batch
+// (default: none, the page cache decides); TREASURE_LOG_MAX_KB overrides
+// the rotation cap. Not thread-safe.
+#define HUNT_LOG_BUFFER (16 * 1024)
+#define HUNT_LOG_MAX_BYTES (1024 * 1024)
+#define HUNT_LOG_KEEP 3
+#define HUNT_LOG_NO_ID INT64_MIN
+
+typedef enum {
+    HUNT_LOG_SYNC_NONE,
+    HUNT_LOG_SYNC_BATCH,
+} HuntLogSync;
+
+typedef struct HuntLog {
+    char *hunt_id;
+    int fd;                     // opened on the first flush
+    char buf[HUNT_LOG_BUFFER];
+    size_t len;
+    struct HuntLog *next;
+} HuntLog;
+
+// The log of a hunt, created on first use and flushed at exit
+HuntLog *hunt_log_get(const char *hunt_id);
+// Queues one entry; id may be HUNT_LOG_NO_ID and user/detail NULL
+void hunt_log_add(HuntLog *log, const char *op, int64_t id, const char *user, const char *detail);
+int hunt_log_flush(HuntLog *log);
+void hunt_log_flush_all(void);
+// Drops the pending entries of a hunt that is being deleted
+void hunt_log_discard(const char *hunt_id);
+
+#endif
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "metrics.h"
+
+static const char *kind_names[METRIC_KINDS] = {
+    "list_hunts", "list_treasures", "view_treasure", "calculate_score", "stats", "near", "bbox",
+    "find_treasure", "user_treasures", "other",
+};
+
+static const uint64_t bucket_ns[METRIC_BUCKETS] = {
+    10000, 25000, 50000, 100000, 250000, 500000,
+    1000000, 2500000, 5000000, 10000000, 25000000, 50000000,
+    100000000, 250000000, 500000000, 1000000000, 2500000000ULL, 5000000000ULL, 10000000000ULL,
+};
+
+MetricKind metric_kind(const char *command) {
+    size_t len = strcspn(command, " ");
+    for (int k = 0; k < METRIC_OTHER; k++)
+        if (strlen(kind_names[k]) == len && strncmp(command, kind_names[k], len) == 0)
+            return (MetricKind)k;
+    return METRIC_OTHER;
+}
+
+const char *metric_kind_name(MetricKind kind) {
+    return kind < METRIC_KINDS ? kind_names[kind] : "?";
+}
+
+uint64_t metrics_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void add(uint64_t *field, uint64_t n) {
+    __atomic_fetch_add(field, n, __ATOMIC_RELAXED);
+}
+
+static uint64_t load(const uint64_t *field) {
+    return __atomic_load_n(field, __ATOMIC_RELAXED);
+}
+
+void metrics_record(MetricsTable *t, MetricKind kind, uint64_t elapsed_ns, const StoreCounters *io) {
+    CommandMetrics *m = &t->commands[kind < METRIC_KINDS ? kind : METRIC_OTHER];
+    int b = 0;
+    while (b < METRIC_BUCKETS && elapsed_ns > bucket_ns[b])
+        b++;
+    add(&m->buckets[b], 1);
+    add(&m->sum_ns, elapsed_ns);
+    add(&m->count, 1);
+    if (io) {
+        add(&m->bytes_read, io->bytes_read);
+        add(&m->records_scanned, io->records_scanned);
+        add(&m->cache_hits, io->cache_hits);
+        add(&m->cache_misses, io->cache_misses);
+    }
+}
+
+// Upper bound of the bucket holding the q-quantile, in milliseconds; the
+// open last bucket reports the largest finite bound
+static double quantile_ms(const CommandMetrics *m, uint64_t count, double q) {
+    uint64_t rank = (uint64_t)((double)count * q), seen = 0;
+    for (int b = 0; b < METRIC_BUCKETS; b++) {
+        seen += load(&m->buckets[b]);
+        if (seen > rank)
+            return (double)bucket_ns[b] / 1e6;
+    }
+    return (double)bucket_ns[METRIC_BUCKETS - 1] / 1e6;
+}
+
+void metrics_print(const MetricsTable *t, const char *title, int with_io, MetricsPrintFn out) {
+    out("%s:\n", title);
+    out("%-16s %8s %10s %10s %10s", "command", "count", "mean ms", "p50 ms", "p99 ms");
+    if (with_io)
+        out(" %12s %12s %8s %8s", "bytes read", "records", "hits", "misses");
+    out("\n");
+    int any = 0;
+    for (int k = 0; k < METRIC_KINDS; k++) {
+        const CommandMetrics *m = &t->commands[k];
+        uint64_t count = load(&m->count);
+        if (count == 0)
+            continue;
+        any = 1;
+        out("%-16s %8llu %10.3f %10.3f %10.3f", kind_names[k], (unsigned long long)count,
+            (double)load(&m->sum_ns) / (double)count / 1e6, quantile_ms(m, count, 0.5), quantile_ms(m, count, 0.99));
+        if (with_io)
+            out(" %12llu %12llu %8llu %8llu", (unsigned long long)load(&m->bytes_read),
+                (unsigned long long)load(&m->records_scanned), (unsigned long long)load(&m->cache_hits),
+                (unsigned long long)load(&m->cache_misses));
+        out("\n");
+    }
+    if (!any)
+        out("(no commands yet)\n");
+}
+
+static void counter(const MetricsTable *t, const char *prefix, const char *name, const char *help,
+                    size_t offset, MetricsPrintFn out) {
+    out("# HELP %s_%s_total %s\n# TYPE %s_%s_total counter\n", prefix, name, help, prefix, name);
+    for (int k = 0; k < METRIC_KINDS; k++) {
+        const uint64_t *field = (const uint64_t *)((const char *)&t->commands[k] + offset);
+        out("%s_%s_total{command=\"%s\"} %llu\n", prefix, name, kind_names[k], (unsigned long long)load(field));
+    }
+}
+
+void metrics_prometheus(const MetricsTable *t, const char *prefix, const char *name, int with_io,
+                        MetricsPrintFn out) {
+    out("# HELP %s_%s_seconds Time per command.\n# TYPE %s_%s_seconds histogram\n", prefix, name, prefix, name);
+    for (int k = 0; k < METRIC_KINDS; k++) {
+        const CommandMetrics *m = &t->commands[k];
+        uint64_t cumulative = 0;
+        for (int b = 0; b < METRIC_BUCKETS; b++) {
+            cumulative += load(&m->buckets[b]);
+            out("%s_%s_seconds_bucket{command=\"%s\",le=\"%g\"} %llu\n", prefix, name, kind_names[k],
+                (double)bucket_ns[b] / 1e9, (unsigned long long)cumulative);
+        }
+        cumulative += load(&m->buckets[METRIC_BUCKETS]);
+        out("%s_%s_seconds_bucket{command=\"%s\",le=\"+Inf\"} %llu\n", prefix, name, kind_names[k],
+            (unsigned long long)cumulative);
+        out("%s_%s_seconds_sum{command=\"%s\"} %.9f\n", prefix, name, kind_names[k],
+            (double)load(&m->sum_ns) / 1e9);
+        out("%s_%s_seconds_count{command=\"%s\"} %llu\n", prefix, name, kind_names[k],
+            (unsigned long long)load(&m->count));
+    }
+    if (!with_io)
+        return;
+    counter(t, prefix, "bytes_read", "Bytes read by the store layer.", offsetof(CommandMetrics, bytes_read), out);
+    counter(t, prefix, "records_scanned", "Records visited by scans.", offsetof(CommandMetrics, records_scanned), out);
+    counter(t, prefix, "cache_hits", "Hunt and score cache hits.", offsetof(CommandMetrics, cache_hits), out);
+    counter(t, prefix, "cache_misses", "Hunt and score cache misses.", offsetof(CommandMetrics, cache_misses), out);
+}
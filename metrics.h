@@ -0,0 +1,65 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "treasure.h"
+
+// Per-command counters and latency histograms. The monitor records how
+// long each command took and what the store layer did for it
+// (StoreCounters); the hub records the round trip of each request. Every
+// field is updated with atomic adds, so worker threads share one table.
+typedef enum {
+    METRIC_LIST_HUNTS,
+    METRIC_LIST_TREASURES,
+    METRIC_VIEW_TREASURE,
+    METRIC_CALCULATE_SCORE,
+    METRIC_STATS,
+    METRIC_NEAR,
+    METRIC_BBOX,
+    METRIC_FIND_TREASURE,
+    METRIC_USER_TREASURES,
+    METRIC_OTHER,
+    METRIC_KINDS
+} MetricKind;
+
+// Upper bounds of the latency buckets, 10 us to 10 s in 1-2.5-5 steps; a
+// last bucket takes everything slower
+#define METRIC_BUCKETS 19
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t buckets[METRIC_BUCKETS + 1];   // not cumulative
+    uint64_t bytes_read;
+    uint64_t records_scanned;
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+} CommandMetrics;
+
+typedef struct {
+    CommandMetrics commands[METRIC_KINDS];
+} MetricsTable;
+
+// printf-like output: printf wrappers, the monitor's reply
+typedef void (*MetricsPrintFn)(const char *fmt, ...);
+
+// Kind of a command line, from its first word
+MetricKind metric_kind(const char *command);
+const char *metric_kind_name(MetricKind kind);
+
+uint64_t metrics_now_ns(void);
+// Adds one command; io (may be NULL) is what the store layer did for it
+void metrics_record(MetricsTable *t, MetricKind kind, uint64_t elapsed_ns, const StoreCounters *io);
+
+// Table with count, mean, p50/p99 (bucket upper bounds) and, with_io, the
+// store counters of every command that ran
+void metrics_print(const MetricsTable *t, const char *title, int with_io, MetricsPrintFn out);
+// Prometheus text format: <prefix>_<name>_seconds histograms labelled by
+// command and, with_io, <prefix>_{bytes_read,records_scanned,cache_hits,
+// cache_misses}_total counters
+void metrics_prometheus(const MetricsTable *t, const char *prefix, const char *name, int with_io,
+                        MetricsPrintFn out);
+
+#endif
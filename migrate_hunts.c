@@ -0,0 +1,415 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "treasure.h"
+
+// One-shot converter from the pre-header treasures.dat layouts to the
+// current format. Each tool used to write its own struct, so the input
+// layout is either given with --from or guessed from the file contents.
+// Hunts in format v1 (usernames stored in every record) are converted too.
+
+// Written by treasure_manager.c
+typedef struct {
+    int treasure_id;
+    char username[USERNAME_MAX];
+    float latitude;
+    float longitude;
+    char clue[CLUE_MAX];
+    int value;
+} LegacyManagerTreasure;
+
+// Written by treasure.c
+typedef struct {
+    char id[16];
+    char username[USERNAME_MAX];
+    float latitude;
+    float longitude;
+    char clue[CLUE_MAX];
+    int value;
+} LegacyStringIdTreasure;
+
+// Read by monitor.c and calculate_score.c
+typedef struct {
+    int id;
+    char username[USERNAME_MAX];
+    double latitude;
+    double longitude;
+    char clue[CLUE_MAX];
+    int value;
+} LegacyDoubleTreasure;
+
+// Format v1 record: like Treasure, but with the username inline
+typedef struct {
+    int32_t id;
+    uint32_t flags;
+    char username[USERNAME_MAX];
+    double latitude;
+    double longitude;
+    char clue[CLUE_MAX];
+    int32_t value;
+    uint32_t reserved;
+} TreasureV1;
+
+_Static_assert(sizeof(TreasureV1) == 192, "format v1 records are 192 bytes");
+
+typedef enum { LAYOUT_MANAGER, LAYOUT_STRING_ID, LAYOUT_DOUBLE, LAYOUT_COUNT } Layout;
+
+static const char *layout_names[LAYOUT_COUNT] = { "manager", "string-id", "double" };
+static const size_t layout_sizes[LAYOUT_COUNT] = {
+    sizeof(LegacyManagerTreasure), sizeof(LegacyStringIdTreasure), sizeof(LegacyDoubleTreasure)
+};
+
+static int plausible_string(const char *s, size_t max) {
+    size_t len = strnlen(s, max);
+    if (len == max)
+        return 0;
+    for (size_t i = 0; i < len; i++)
+        if (!isprint((unsigned char)s[i]))
+            return 0;
+    return 1;
+}
+
+static int plausible_coords(double lat, double lon) {
+    return lat >= -90.0 && lat <= 90.0 && lon >= -180.0 && lon <= 180.0;
+}
+
+// Converts one legacy record, leaving its username in <username> for
+// interning; returns 0 if it does not look like <layout>. next_id numbers
+// treasure.c records whose string ID is not numeric; it is NULL while
+// detecting the layout.
+static int convert_record(Layout layout, const void *raw, Treasure *t, char *username, int *next_id) {
+    memset(t, 0, sizeof(*t));
+    switch (layout) {
+    case LAYOUT_MANAGER: {
+        const LegacyManagerTreasure *r = raw;
+        t->id = r->treasure_id;
+        memcpy(username, r->username, USERNAME_MAX);
+        t->latitude = r->latitude;
+        t->longitude = r->longitude;
+        memcpy(t->clue, r->clue, CLUE_MAX);
+        t->value = r->value;
+        break;
+    }
+    case LAYOUT_STRING_ID: {
+        const LegacyStringIdTreasure *r = raw;
+        if (!plausible_string(r->id, sizeof(r->id)))
+            return 0;
+        char *end;
+        long id = strtol(r->id, &end, 10);
+        if ((*r->id == '\0' || *end != '\0') && next_id) {
+            fprintf(stderr, "  non-numeric ID '%s' renumbered to %d\n", r->id, *next_id);
+            id = (*next_id)++;
+        }
+        t->id = (int32_t)id;
+        memcpy(username, r->username, USERNAME_MAX);
+        t->latitude = r->latitude;
+        t->longitude = r->longitude;
+        memcpy(t->clue, r->clue, CLUE_MAX);
+        t->value = r->value;
+        break;
+    }
+    case LAYOUT_DOUBLE: {
+        const LegacyDoubleTreasure *r = raw;
+        t->id = r->id;
+        memcpy(username, r->username, USERNAME_MAX);
+        t->latitude = r->latitude;
+        t->longitude = r->longitude;
+        memcpy(t->clue, r->clue, CLUE_MAX);
+        t->value = r->value;
+        break;
+    }
+    default:
+        return 0;
+    }
+    return plausible_string(username, USERNAME_MAX) &&
+           plausible_string(t->clue, CLUE_MAX) &&
+           plausible_coords(t->latitude, t->longitude);
+}
+
+// Picks the only layout whose record size divides the file and whose
+// records all decode to sane strings and coordinates.
+static int detect_layout(const char *buf, size_t size) {
+    int found = -1;
+    for (int l = 0; l < LAYOUT_COUNT; l++) {
+        if (size % layout_sizes[l] != 0)
+            continue;
+        int ok = 1;
+        Treasure t;
+        char username[USERNAME_MAX];
+        for (size_t off = 0; ok && off < size; off += layout_sizes[l])
+            ok = convert_record((Layout)l, buf + off, &t, username, NULL);
+        if (!ok)
+            continue;
+        if (found >= 0)
+            return -2;
+        found = l;
+    }
+    return found;
+}
+
+static char *read_file(const char *path, size_t *size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return NULL;
+    }
+    char *buf = malloc(st.st_size > 0 ? (size_t)st.st_size : 1);
+    size_t done = 0;
+    while (buf && done < (size_t)st.st_size) {
+        ssize_t n = read(fd, buf + done, (size_t)st.st_size - done);
+        if (n <= 0) {
+            free(buf);
+            buf = NULL;
+            break;
+        }
+        done += (size_t)n;
+    }
+    close(fd);
+    *size = done;
+    return buf;
+}
+
+// Writes the converted records: their usernames are interned into a fresh
+// users.dat first, then the records go to a temporary file that replaces
+// treasures.dat once synced, the old file staying behind as <bak_path>.
+// new_hdr carries the generation, epoch and dead count to start from.
+static int write_hunt(const char *hunt_id, Treasure *records, char (*names)[USERNAME_MAX], size_t count,
+                      TreasureFileHeader *new_hdr, const char *bak_path) {
+    char path[512], tmp_path[512], users_path[512];
+    hunt_path(path, sizeof(path), hunt_id, TREASURE_FILE);
+    hunt_path(tmp_path, sizeof(tmp_path), hunt_id, TREASURE_FILE ".migrating");
+    hunt_path(users_path, sizeof(users_path), hunt_id, USERS_FILE);
+
+    // Left over from an interrupted run, if any
+    unlink(users_path);
+    UserDict users;
+    int rc = user_dict_open(&users, hunt_id, 1);
+    for (size_t i = 0; rc == STORE_OK && i < count; i++)
+        rc = user_dict_intern(&users, names[i], &records[i].user_id);
+    if (rc == STORE_OK)
+        rc = user_dict_sync(&users);
+    user_dict_close(&users);
+    if (rc != STORE_OK) {
+        fprintf(stderr, "%s: cannot write %s: %s\n", hunt_id, users_path, store_strerror(rc));
+        return -1;
+    }
+
+    int out = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        fprintf(stderr, "%s: cannot create %s: %s\n", hunt_id, tmp_path, strerror(errno));
+        return -1;
+    }
+    rc = store_write_header(out, new_hdr);
+    if (rc == STORE_OK)
+        rc = store_append(out, new_hdr, records, count);
+    if (rc == STORE_OK && fsync(out) < 0)
+        rc = STORE_ERR_IO;
+    close(out);
+
+    if (rc != STORE_OK || link(path, bak_path) < 0 || rename(tmp_path, path) < 0) {
+        fprintf(stderr, "%s: migration failed: %s\n", hunt_id, strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+    store_sync_dir(hunt_id);
+    return 0;
+}
+
+// Format v1 to the current one. Slots, tombstones and the generation are
+// kept; the epoch is bumped so that the index, grid, score cache and
+// columnar snapshot built over the old file are all rebuilt.
+static int migrate_v1(const char *hunt_id) {
+    char path[512], bak_path[512];
+    hunt_path(path, sizeof(path), hunt_id, TREASURE_FILE);
+    hunt_path(bak_path, sizeof(bak_path), hunt_id, TREASURE_FILE ".v1.bak");
+
+    size_t size;
+    char *buf = read_file(path, &size);
+    if (!buf) {
+        fprintf(stderr, "%s: cannot read %s: %s\n", hunt_id, path, strerror(errno));
+        return -1;
+    }
+    TreasureFileHeader old;
+    if (size < sizeof(old)) {
+        fprintf(stderr, "%s: truncated header\n", hunt_id);
+        free(buf);
+        return -1;
+    }
+    memcpy(&old, buf, sizeof(old));
+    if (old.version != 1 || old.header_size != sizeof(old) || old.record_size != sizeof(TreasureV1) ||
+        old.record_count > (size - sizeof(old)) / sizeof(TreasureV1) || old.dead_count > old.record_count) {
+        fprintf(stderr, "%s: unsupported format v%u\n", hunt_id, old.version);
+        free(buf);
+        return -1;
+    }
+
+    size_t count = old.record_count;
+    Treasure *records = calloc(count ? count : 1, sizeof(Treasure));
+    char (*names)[USERNAME_MAX] = calloc(count ? count : 1, USERNAME_MAX);
+    if (!records || !names) {
+        perror("calloc");
+        free(records);
+        free(names);
+        free(buf);
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        const TreasureV1 *r = (const void *)(buf + sizeof(old) + i * sizeof(TreasureV1));
+        records[i].id = r->id;
+        records[i].flags = r->flags;
+        records[i].latitude = r->latitude;
+        records[i].longitude = r->longitude;
+        memcpy(records[i].clue, r->clue, CLUE_MAX);
+        records[i].value = r->value;
+        memcpy(names[i], r->username, USERNAME_MAX - 1);
+    }
+    free(buf);
+
+    TreasureFileHeader new_hdr;
+    store_init_header(&new_hdr);
+    new_hdr.generation = old.generation;
+    new_hdr.dead_count = old.dead_count;
+    new_hdr.epoch = old.epoch + 1;
+    int rc = write_hunt(hunt_id, records, names, count, &new_hdr, bak_path);
+    free(records);
+    free(names);
+    if (rc == 0)
+        printf("%s: migrated %zu records from format v1 (backup in %s)\n", hunt_id, count, bak_path);
+    return rc;
+}
+
+static int migrate_hunt(const char *hunt_id, int forced_layout) {
+    TreasureFileHeader hdr;
+    int fd = store_open(hunt_id, 0, 0, &hdr);
+    if (fd >= 0) {
+        printf("%s: already in format v%u, skipped\n", hunt_id, hdr.version);
+        close(fd);
+        return 0;
+    }
+    if (fd == STORE_ERR_VERSION)
+        return migrate_v1(hunt_id);
+    if (fd != STORE_ERR_FORMAT) {
+        fprintf(stderr, "%s: %s\n", hunt_id, store_strerror(fd));
+        return -1;
+    }
+
+    char path[512], bak_path[512];
+    hunt_path(path, sizeof(path), hunt_id, TREASURE_FILE);
+    hunt_path(bak_path, sizeof(bak_path), hunt_id, TREASURE_FILE ".bak");
+
+    size_t size;
+    char *buf = read_file(path, &size);
+    if (!buf) {
+        fprintf(stderr, "%s: cannot read %s: %s\n", hunt_id, path, strerror(errno));
+        return -1;
+    }
+
+    int layout = forced_layout >= 0 ? forced_layout : size == 0 ? LAYOUT_MANAGER : detect_layout(buf, size);
+    if (layout == -2) {
+        fprintf(stderr, "%s: layout is ambiguous, rerun with --from <layout>\n", hunt_id);
+        free(buf);
+        return -1;
+    }
+    if (layout < 0 || size % layout_sizes[layout] != 0) {
+        fprintf(stderr, "%s: file does not match any known legacy layout\n", hunt_id);
+        free(buf);
+        return -1;
+    }
+
+    size_t count = size / layout_sizes[layout];
+    Treasure *records = calloc(count ? count : 1, sizeof(Treasure));
+    char (*names)[USERNAME_MAX] = calloc(count ? count : 1, USERNAME_MAX);
+    if (!records || !names) {
+        perror("calloc");
+        free(records);
+        free(names);
+        free(buf);
+        return -1;
+    }
+
+    int next_id = 0;
+    for (size_t i = 0; i < count; i++) {
+        const LegacyManagerTreasure *m = (const void *)(buf + i * layout_sizes[layout]);
+        if (layout != LAYOUT_STRING_ID && m->treasure_id >= next_id)
+            next_id = m->treasure_id + 1;
+    }
+    if (layout == LAYOUT_STRING_ID) {
+        // Renumbered IDs start after the largest numeric one
+        for (size_t i = 0; i < count; i++) {
+            const LegacyStringIdTreasure *r = (const void *)(buf + i * layout_sizes[layout]);
+            long id = strtol(r->id, NULL, 10);
+            if (id >= next_id)
+                next_id = (int)id + 1;
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        convert_record((Layout)layout, buf + i * layout_sizes[layout], &records[i], names[i], &next_id);
+        names[i][USERNAME_MAX - 1] = '\0';
+    }
+    free(buf);
+
+    TreasureFileHeader new_hdr;
+    store_init_header(&new_hdr);
+    int rc = write_hunt(hunt_id, records, names, count, &new_hdr, bak_path);
+    free(records);
+    free(names);
+    if (rc == 0)
+        printf("%s: migrated %zu records from the %s layout (backup in %s)\n",
+               hunt_id, count, layout_names[layout], bak_path);
+    return rc;
+}
+
+int main(int argc, char *argv[]) {
+    int forced_layout = -1;
+    int first = 1;
+
+    if (argc >= 3 && strcmp(argv[1], "--from") == 0) {
+        for (int l = 0; l < LAYOUT_COUNT; l++)
+            if (strcmp(argv[2], layout_names[l]) == 0)
+                forced_layout = l;
+        if (forced_layout < 0) {
+            fprintf(stderr, "Unknown layout '%s' (manager, string-id or double)\n", argv[2]);
+            return 1;
+        }
+        first = 3;
+    } else if (argc >= 2 && argv[1][0] == '-') {
+        fprintf(stderr, "Usage: %s [--from manager|string-id|double] [hunt_id...]\n", argv[0]);
+        return 1;
+    }
+
+    int failures = 0;
+    if (first < argc) {
+        for (int i = first; i < argc; i++)
+            failures += migrate_hunt(argv[i], forced_layout) < 0;
+        return failures ? 1 : 0;
+    }
+
+    // No hunt given: migrate every directory holding a treasures.dat
+    DIR *d = opendir(".");
+    if (!d) {
+        perror("opendir");
+        return 1;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_type != DT_DIR || entry->d_name[0] == '.')
+            continue;
+        char path[512];
+        hunt_path(path, sizeof(path), entry->d_name, TREASURE_FILE);
+        if (access(path, F_OK) == 0)
+            failures += migrate_hunt(entry->d_name, forced_layout) < 0;
+    }
+    closedir(d);
+    return failures ? 1 : 0;
+}
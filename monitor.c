@@ -1,7 +1,6 @@
 #define _DEFAULT_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
-#include <dirent.h>
 #include <unistd.h>
 #include <signal.h>
 #include <string.h>
@@ -10,146 +9,566 @@
 #include <sys/types.h>
 #include <errno.h>
 #include <time.h>
+#include <stdarg.h>
+
+#include "treasure.h"
+#include "monitor_protocol.h"
+#include "thread_pool.h"
+#include "hunt_catalog.h"
+#include "hunt_cache.h"
+#include "value_stats.h"
+#include "scoreboard.h"
+#include "metrics.h"
+
+// Commands run concurrently on this many worker threads, so a long
+// list_treasures does not hold up a quick view_treasure
+#define MONITOR_WORKERS 4
+
+// Per-hunt tasks of cross-hunt queries and catalog refreshes run on a
+// second pool (one thread per CPU), which command workers wait on
+static ThreadPool query_pool;
+
+// Request the calling thread is answering; 0 for unsolicited notices
+static __thread uint32_t current_request = 0;
+
+// Frames from different workers must not interleave on the pipe
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Output of the current response is formatted into a per-thread buffer and
+// sent as one data frame (a single writev) when the buffer fills up or the
+// response ends, rather than one write per line.
+static __thread char out_buf[FRAME_MAX_DATA];
+static __thread size_t out_len = 0;
+
+// Sends whatever is buffered for the current response
+void reply_flush() {
+    if (out_len == 0)
+        return;
+    pthread_mutex_lock(&output_lock);
+    frame_write(STDOUT_FILENO, current_request, FRAME_DATA, out_buf, (uint32_t)out_len);
+    pthread_mutex_unlock(&output_lock);
+    out_len = 0;
+}
 
-#define CMD_FILE ".monitor_command"
-#define TREASURE_FILE "treasures.dat"
-
-#ifndef DT_DIR
-#define DT_DIR 4
-#endif
-
-typedef struct {
-    int id;
-    char username[32];
-    double latitude;
-    double longitude;
-    char clue[128];
-    int value;
-} Treasure;
-
-volatile sig_atomic_t command_ready = 0;
+// Appends formatted output to the current response
+void reply(const char *fmt, ...) {
+    for (;;) {
+        size_t room = sizeof(out_buf) - out_len;
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(out_buf + out_len, room, fmt, ap);
+        va_end(ap);
+        if (n < 0)
+            return;
+        if ((size_t)n < room) {
+            out_len += (size_t)n;
+            return;
+        }
+        if (out_len == 0) {
+            // Bigger than a whole frame: keep what fit
+            out_len = sizeof(out_buf) - 1;
+            return;
+        }
+        reply_flush();
+    }
+}
 
-void sigusr1_handler(int sig) {
-    command_ready = 1;
+// Closes the current response so the hub stops waiting for it
+void reply_end() {
+    reply_flush();
+    pthread_mutex_lock(&output_lock);
+    frame_write(STDOUT_FILENO, current_request, FRAME_END, NULL, 0);
+    pthread_mutex_unlock(&output_lock);
 }
 
 void delay_exit() {
-    dprintf(STDOUT_FILENO, "Monitor exiting in 3 seconds...\n");
+    reply("Monitor exiting in 3 seconds...\n");
+    reply_end();
     sleep(3);
 }
 
-void print_treasure(const Treasure *t) {
-    dprintf(STDOUT_FILENO, "Treasure ID: %d\n", t->id);
-    dprintf(STDOUT_FILENO, "User: %s\n", t->username);
-    dprintf(STDOUT_FILENO, "Coordinates: %.6f, %.6f\n", t->latitude, t->longitude);
-    dprintf(STDOUT_FILENO, "Clue: %s\n", t->clue);
-    dprintf(STDOUT_FILENO, "Value: %d\n", t->value);
-    dprintf(STDOUT_FILENO, "---------------------\n");
+void print_treasure(const Treasure *t, const char *user) {
+    reply("Treasure ID: %d\n"
+          "User: %s\n"
+          "Coordinates: %.6f, %.6f\n"
+          "Clue: %s\n"
+          "Value: %d\n"
+          "---------------------\n",
+          t->id, user, t->latitude, t->longitude, t->clue, t->value);
+}
+
+// One tab-separated line per treasure, for list_treasures --tsv
+void print_treasure_tsv(const Treasure *t, const char *user) {
+    reply("%d\t%s\t%.6f\t%.6f\t%d\t%s\n",
+          t->id, user, t->latitude, t->longitude, t->value, t->clue);
+}
+
+// Hunts under the working directory, kept current with inotify
+static HuntCatalog catalog;
+
+void print_hunt(const HuntInfo *h, void *arg) {
+    int *hunt_count = arg;
+    if (h->status == STORE_OK)
+        reply("Hunt: %s - Treasures: %llu\n", h->name, (unsigned long long)h->live_count);
+    else if (h->status == STORE_ERR_IO)
+        reply("Hunt: %s - unreadable: %s\n", h->name, strerror(h->error));
+    else
+        reply("Hunt: %s - %s\n", h->name, store_strerror(h->status));
+    (*hunt_count)++;
 }
 
 void list_hunts() {
-    DIR *d = opendir(".");
-    if (!d) {
-        dprintf(STDOUT_FILENO, "Failed to open current directory: %s\n", strerror(errno));
-        return;
-    }
-    struct dirent *entry;
     int hunt_count = 0;
 
-    dprintf(STDOUT_FILENO, "Listing hunts:\n");
-    while ((entry = readdir(d)) != NULL) {
-        if (entry->d_type == DT_DIR) {
-            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
-                continue;
+    reply("Listing hunts:\n");
+    catalog_foreach(&catalog, print_hunt, &hunt_count);
+    if (hunt_count == 0) {
+        reply("No hunts found.\n");
+    }
+}
 
-            char treasure_path[512];
-            snprintf(treasure_path, sizeof(treasure_path), "%s/%s", entry->d_name, TREASURE_FILE);
+// Recently queried hunts, kept in memory between commands
+static HuntCache hunt_cache;
 
-            struct stat st;
-            if (stat(treasure_path, &st) == 0) {
-                off_t size = st.st_size;
-                int count = size / sizeof(Treasure);
+// What each command cost, shown by "stats" without a hunt
+static MetricsTable metrics;
 
-                dprintf(STDOUT_FILENO, "Hunt: %s - Treasures: %d\n", entry->d_name, count);
-                hunt_count++;
-            }
-        }
-    }
-    if (hunt_count == 0) {
-        dprintf(STDOUT_FILENO, "No hunts found.\n");
+void list_header(const char *hunt_id, int tsv, off_t size, time_t mtime, uint64_t count) {
+    if (tsv) {
+        reply("id\tuser\tlatitude\tlongitude\tvalue\tclue\n");
+        return;
     }
-    closedir(d);
+    reply("Hunt: %s\n", hunt_id);
+    reply("Total treasure file size: %ld bytes\n", (long)size);
+    char mtime_str[32];
+    reply("Last modification time: %s", ctime_r(&mtime, mtime_str));
+    reply("Treasures (%llu):\n", (unsigned long long)count);
 }
 
-void list_treasures(const char *hunt_id) {
-    char path[512];
-    snprintf(path, sizeof(path), "%s/%s", hunt_id, TREASURE_FILE);
-
-    int fd = open(path, O_RDONLY);
+// Reads the hunt straight from disk, for hunts too large to cache
+void list_treasures_uncached(const char *hunt_id, int tsv) {
+    TreasureFileHeader hdr;
+    int fd = store_open(hunt_id, 0, 0, &hdr);
     if (fd < 0) {
-        dprintf(STDOUT_FILENO, "Failed to open treasures for hunt '%s': %s\n", hunt_id, strerror(errno));
+        reply("Failed to open treasures for hunt '%s': %s\n", hunt_id, store_strerror(fd));
         return;
     }
 
     struct stat st;
     if (fstat(fd, &st) < 0) {
-        dprintf(STDOUT_FILENO, "fstat failed: %s\n", strerror(errno));
+        reply("fstat failed: %s\n", strerror(errno));
         close(fd);
         return;
     }
+    UserDict users;
+    int rc = user_dict_open(&users, hunt_id, 0);
+    if (rc != STORE_OK) {
+        reply("Failed to read the users of hunt '%s': %s\n", hunt_id, store_strerror(rc));
+        close(fd);
+        return;
+    }
+    list_header(hunt_id, tsv, st.st_size, st.st_mtime, store_live_count(&hdr));
 
-    dprintf(STDOUT_FILENO, "Hunt: %s\n", hunt_id);
-    dprintf(STDOUT_FILENO, "Total treasure file size: %ld bytes\n", st.st_size);
-    dprintf(STDOUT_FILENO, "Last modification time: %s", ctime(&st.st_mtime));
-    dprintf(STDOUT_FILENO, "Treasures:\n");
-
-    Treasure t;
-    ssize_t r;
-    while ((r = read(fd, &t, sizeof(t))) == sizeof(t)) {
-        print_treasure(&t);
+    StoreScan scan;
+    if ((rc = store_scan_open(&scan, fd, &hdr)) != STORE_OK) {
+        reply("Failed to read treasures: %s\n", store_strerror(rc));
+        user_dict_close(&users);
+        close(fd);
+        return;
+    }
+    const Treasure *t;
+    while ((t = store_scan_next(&scan, NULL)) != NULL) {
+        if (tsv)
+            print_treasure_tsv(t, user_dict_name(&users, t->user_id));
+        else
+            print_treasure(t, user_dict_name(&users, t->user_id));
     }
+    if (store_scan_error(&scan) != STORE_OK)
+        reply("Failed to read treasures: %s\n", strerror(errno));
+    store_scan_close(&scan);
 
+    user_dict_close(&users);
     close(fd);
 }
 
+void list_treasures(const char *hunt_id, int tsv) {
+    CachedHunt *h;
+    int rc = hunt_cache_get(&hunt_cache, hunt_id, &h);
+    if (rc == 0) {
+        list_treasures_uncached(hunt_id, tsv);
+        return;
+    }
+    if (rc < 0) {
+        reply("Failed to open treasures for hunt '%s': %s\n", hunt_id, store_strerror(rc));
+        return;
+    }
+
+    list_header(hunt_id, tsv, h->size, h->mtime.tv_sec, h->count);
+    for (size_t i = 0; i < h->count; i++) {
+        const Treasure *t = &h->records[i];
+        if (tsv)
+            print_treasure_tsv(t, user_dict_name(&h->users, t->user_id));
+        else
+            print_treasure(t, user_dict_name(&h->users, t->user_id));
+    }
+    hunt_cache_put(&hunt_cache, h);
+}
+
 void view_treasure(const char *hunt_id, int treasure_id) {
-    char path[512];
-    snprintf(path, sizeof(path), "%s/%s", hunt_id, TREASURE_FILE);
+    Treasure t;
+    char user[USERNAME_MAX];
+    CachedHunt *h;
+    int rc = hunt_cache_get(&hunt_cache, hunt_id, &h);
+    if (rc > 0) {
+        const Treasure *found = cached_hunt_find(h, treasure_id);
+        if (found) {
+            t = *found;
+            snprintf(user, sizeof(user), "%s", user_dict_name(&h->users, t.user_id));
+        }
+        rc = found ? STORE_OK : STORE_ERR_NOT_FOUND;
+        hunt_cache_put(&hunt_cache, h);
+    } else if (rc == 0) {
+        // Too large to cache: one index lookup on disk
+        TreasureFileHeader hdr;
+        int fd = store_open(hunt_id, 0, 0, &hdr);
+        rc = fd;
+        if (fd >= 0) {
+            UserDict users;
+            rc = store_find(fd, hunt_id, &hdr, treasure_id, &t, NULL);
+            if (rc == STORE_OK && (rc = user_dict_open(&users, hunt_id, 0)) == STORE_OK) {
+                snprintf(user, sizeof(user), "%s", user_dict_name(&users, t.user_id));
+                user_dict_close(&users);
+            }
+            close(fd);
+        }
+    } else {
+        reply("Failed to open treasures for hunt '%s': %s\n", hunt_id, store_strerror(rc));
+        return;
+    }
 
-    int fd = open(path, O_RDONLY);
+    if (rc == STORE_OK) {
+        reply("Treasure details:\n");
+        print_treasure(&t, user);
+    } else if (rc == STORE_ERR_NOT_FOUND) {
+        reply("Treasure with ID %d not found in hunt '%s'.\n", treasure_id, hunt_id);
+    } else {
+        reply("Failed to read treasure from hunt '%s': %s\n", hunt_id, store_strerror(rc));
+    }
+}
+
+// near / bbox: the treasures of a hunt around a point or inside a box
+void geo_search(const char *hunt_id, const GeoQuery *q) {
+    TreasureFileHeader hdr;
+    int fd = store_open(hunt_id, 0, 0, &hdr);
     if (fd < 0) {
-        dprintf(STDOUT_FILENO, "Failed to open treasures for hunt '%s': %s\n", hunt_id, strerror(errno));
+        reply("Failed to open treasures for hunt '%s': %s\n", hunt_id, store_strerror(fd));
         return;
     }
 
-    Treasure t;
-    ssize_t r;
-    int found = 0;
-    while ((r = read(fd, &t, sizeof(t))) == sizeof(t)) {
-        if (t.id == treasure_id) {
-            dprintf(STDOUT_FILENO, "Treasure details:\n");
-            print_treasure(&t);
-            found = 1;
-            break;
+    GeoMatch *matches;
+    size_t count;
+    int rc = store_geo_query(fd, hunt_id, &hdr, q, &matches, &count);
+    close(fd);
+    if (rc != STORE_OK) {
+        reply("Failed to search hunt '%s': %s\n", hunt_id, store_strerror(rc));
+        return;
+    }
+    // Loaded after the query so that it names every match
+    UserDict users;
+    if ((rc = user_dict_open(&users, hunt_id, 0)) != STORE_OK) {
+        reply("Failed to read the users of hunt '%s': %s\n", hunt_id, store_strerror(rc));
+        free(matches);
+        return;
+    }
+
+    reply("Treasures found: %zu\n", count);
+    for (size_t i = 0; i < count; i++) {
+        if (q->near)
+            reply("Distance: %.2f km\n", matches[i].distance_km);
+        print_treasure(&matches[i].t, user_dict_name(&users, matches[i].t.user_id));
+    }
+    user_dict_close(&users);
+    free(matches);
+}
+
+// stats <hunt_id> [--above N] [--bbox lat_min lon_min lat_max lon_max]
+void hunt_stats(const char *args) {
+    char hunt_id[128], option[16];
+    int used = 0;
+    int32_t threshold = 0;
+    GeoQuery box;
+    int has_box = 0;
+
+    if (sscanf(args, "%127s%n", hunt_id, &used) != 1) {
+        reply("Invalid stats command format. Use: stats <hunt_id> [--above N] [--bbox lat_min lon_min lat_max lon_max]\n");
+        return;
+    }
+    args += used;
+    while (sscanf(args, "%15s%n", option, &used) == 1) {
+        args += used;
+        double a, b, c, d;
+        int n = 0;
+        if (strcmp(option, "--above") == 0 && sscanf(args, "%d%n", &threshold, &n) == 1) {
+            args += n;
+        } else if (strcmp(option, "--bbox") == 0 && sscanf(args, "%lf %lf %lf %lf%n", &a, &b, &c, &d, &n) == 4) {
+            geo_query_bbox(&box, a, b, c, d);
+            has_box = 1;
+            args += n;
+        } else {
+            reply("Invalid stats option '%s'. Use: stats <hunt_id> [--above N] [--bbox lat_min lon_min lat_max lon_max]\n", option);
+            return;
         }
     }
 
-    if (!found) {
-        dprintf(STDOUT_FILENO, "Treasure with ID %d not found in hunt '%s'.\n", treasure_id, hunt_id);
+    ValueStats s;
+    uint64_t bytes;
+    int columnar;
+    int rc = store_hunt_stats(hunt_id, threshold, has_box ? &box : NULL, &s, &bytes, &columnar);
+    if (rc < 0) {
+        reply("Failed to read treasures for hunt '%s': %s\n", hunt_id, store_strerror(rc));
+        return;
     }
+    reply("Stats for hunt '%s' (%s kernels, %s):\n", hunt_id, kernel_name(),
+          columnar ? "columnar snapshot" : "treasures.dat");
+    reply("Treasures: %llu\n", (unsigned long long)s.count);
+    reply("Total value: %lld\n", (long long)s.sum);
+    if (s.count > 0)
+        reply("Min value: %d, Max value: %d, Mean value: %.2f\n", s.min, s.max, (double)s.sum / (double)s.count);
+    reply("Values above %d: %llu\n", threshold, (unsigned long long)s.above);
+    if (has_box)
+        reply("Inside the box: %llu\n", (unsigned long long)s.in_box);
+}
+
+// calculate_score <hunt_id> [--top N]: the same report as the
+// calculate_score program, computed here instead of in a child process.
+// Cached hunts are summed from memory; larger ones go through the score
+// cache on disk.
+void calculate_score(const char *args) {
+    char hunt_id[128], option[16] = "";
+    long top = 0;
+    int n = sscanf(args, "%127s %15s %ld", hunt_id, option, &top);
+    if (n != 1 && (n != 3 || strcmp(option, "--top") != 0 || top <= 0)) {
+        reply("Invalid calculate_score command format. Use: calculate_score <hunt_id> [--top N]\n");
+        return;
+    }
+
+    Scoreboard scores;
+    scoreboard_init(&scores);
+    CachedHunt *h;
+    int rc = hunt_cache_get(&hunt_cache, hunt_id, &h);
+    if (rc > 0) {
+        rc = scoreboard_add_records(&scores, h->records, h->count, &h->users);
+        hunt_cache_put(&hunt_cache, h);
+    } else if (rc == 0) {
+        rc = scoreboard_add_hunt(&scores, hunt_id);
+    }
+    if (rc < 0)
+        reply("Failed to read treasures for hunt '%s': %s\n", hunt_id, store_strerror(rc));
+    else
+        scoreboard_print(&scores, hunt_id, (size_t)top, reply);
+    scoreboard_free(&scores);
+}
 
+// find_treasure / user_treasures: one task per hunt on the query pool.
+// Each hunt's matches are sent as soon as its task is done, as one block,
+// and a summary ends the response once every hunt has been searched.
+typedef struct {
+    uint32_t request_id;
+    int by_user;
+    int32_t treasure_id;
+    char username[USERNAME_MAX];
+    pthread_mutex_t lock;           // keeps each hunt's block together
+    uint64_t matches;
+    uint64_t hunts_matched;
+    uint64_t failures;
+    StoreCounters io;               // the tasks' work, for the metrics
+} CrossQuery;
+
+typedef struct {
+    CrossQuery *q;
+    char *hunt_id;
+} CrossTask;
+
+// Matching records of one hunt, with the names of their users (users is
+// left for the caller to close, whatever the outcome)
+static int search_hunt(const CrossQuery *q, const char *hunt_id, Treasure **found, size_t *count,
+                       UserDict *users) {
+    memset(users, 0, sizeof(*users));
+    users->fd = -1;
+    TreasureFileHeader hdr;
+    int fd = store_open(hunt_id, 0, 0, &hdr);
+    if (fd < 0)
+        return fd;
+    // Loaded after the header so that it names every record in it
+    int rc = user_dict_open(users, hunt_id, 0);
+    if (rc != STORE_OK) {
+        close(fd);
+        return rc;
+    }
+
+    if (!q->by_user) {
+        Treasure t;
+        rc = store_find(fd, hunt_id, &hdr, q->treasure_id, &t, NULL);
+        if (rc == STORE_OK && (*found = malloc(sizeof(Treasure))) != NULL) {
+            **found = t;
+            *count = 1;
+        } else if (rc == STORE_OK) {
+            rc = STORE_ERR_IO;
+        } else if (rc == STORE_ERR_NOT_FOUND) {
+            rc = STORE_OK;
+        }
+        close(fd);
+        return rc;
+    }
+
+    // A hunt the user never played is skipped without reading its records
+    uint32_t user_id;
+    if (!user_dict_find(users, q->username, &user_id)) {
+        close(fd);
+        return STORE_OK;
+    }
+    StoreScan scan;
+    if ((rc = store_scan_open(&scan, fd, &hdr)) != STORE_OK) {
+        close(fd);
+        return rc;
+    }
+    size_t capacity = 0;
+    const Treasure *t;
+    while ((t = store_scan_next(&scan, NULL)) != NULL) {
+        if (t->user_id != user_id)
+            continue;
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            Treasure *grown = realloc(*found, capacity * sizeof(Treasure));
+            if (!grown) {
+                rc = STORE_ERR_IO;
+                break;
+            }
+            *found = grown;
+        }
+        (*found)[(*count)++] = *t;
+    }
+    if (rc == STORE_OK)
+        rc = store_scan_error(&scan);
+    store_scan_close(&scan);
     close(fd);
+    return rc;
+}
+
+void cross_hunt_task(void *arg, int worker) {
+    CrossTask *task = arg;
+    CrossQuery *q = task->q;
+    StoreCounters before = store_counters;
+    Treasure *found = NULL;
+    size_t count = 0;
+    UserDict users;
+    int rc = search_hunt(q, task->hunt_id, &found, &count, &users);
+
+    pthread_mutex_lock(&q->lock);
+    current_request = q->request_id;
+    if (rc != STORE_OK) {
+        reply("Hunt: %s - %s\n", task->hunt_id, store_strerror(rc));
+        q->failures++;
+    } else if (count > 0) {
+        reply("Hunt: %s - %zu treasure%s\n", task->hunt_id, count, count == 1 ? "" : "s");
+        for (size_t i = 0; i < count; i++)
+            print_treasure(&found[i], user_dict_name(&users, found[i].user_id));
+        q->matches += count;
+        q->hunts_matched++;
+    }
+    reply_flush();
+    current_request = 0;
+    q->io.bytes_read += store_counters.bytes_read - before.bytes_read;
+    q->io.records_scanned += store_counters.records_scanned - before.records_scanned;
+    q->io.cache_hits += store_counters.cache_hits - before.cache_hits;
+    q->io.cache_misses += store_counters.cache_misses - before.cache_misses;
+    pthread_mutex_unlock(&q->lock);
+
+    user_dict_close(&users);
+    free(found);
+    free(task->hunt_id);
+    free(task);
+}
+
+typedef struct {
+    char **names;
+    size_t count;
+    size_t capacity;
+} HuntNames;
+
+void collect_hunt(const HuntInfo *h, void *arg) {
+    HuntNames *n = arg;
+    if (n->count == n->capacity) {
+        size_t capacity = n->capacity ? n->capacity * 2 : 64;
+        char **grown = realloc(n->names, capacity * sizeof(char *));
+        if (!grown)
+            return;
+        n->names = grown;
+        n->capacity = capacity;
+    }
+    if ((n->names[n->count] = strdup(h->name)) != NULL)
+        n->count++;
+}
+
+void cross_hunt_query(CrossQuery *q) {
+    HuntNames hunts = { NULL, 0, 0 };
+    catalog_foreach(&catalog, collect_hunt, &hunts);
+    if (hunts.count == 0) {
+        reply("No hunts found.\n");
+        free(hunts.names);
+        return;
+    }
+
+    q->request_id = current_request;
+    pthread_mutex_init(&q->lock, NULL);
+    // Earlier output of this response must not follow the tasks' blocks
+    reply_flush();
+    TaskGroup group;
+    task_group_init(&group);
+    for (size_t i = 0; i < hunts.count; i++) {
+        CrossTask *task = malloc(sizeof(CrossTask));
+        if (!task) {
+            pthread_mutex_lock(&q->lock);
+            q->failures++;
+            pthread_mutex_unlock(&q->lock);
+            free(hunts.names[i]);
+            continue;
+        }
+        task->q = q;
+        task->hunt_id = hunts.names[i];
+        if (pool_submit_group(&query_pool, &group, cross_hunt_task, task) < 0) {
+            // Searched here instead, which also sets current_request back
+            cross_hunt_task(task, 0);
+            current_request = q->request_id;
+        }
+    }
+    task_group_wait(&group);
+    task_group_destroy(&group);
+    pthread_mutex_destroy(&q->lock);
+    free(hunts.names);
+
+    store_counters.bytes_read += q->io.bytes_read;
+    store_counters.records_scanned += q->io.records_scanned;
+    store_counters.cache_hits += q->io.cache_hits;
+    store_counters.cache_misses += q->io.cache_misses;
+    reply("Searched %zu hunts: %llu treasure%s in %llu hunt%s", hunts.count, (unsigned long long)q->matches,
+          q->matches == 1 ? "" : "s", (unsigned long long)q->hunts_matched, q->hunts_matched == 1 ? "" : "s");
+    if (q->failures > 0)
+        reply(", %llu could not be read", (unsigned long long)q->failures);
+    reply(".\n");
 }
 
 void process_command(const char *cmd) {
-    if (strcmp(cmd, "stop_monitor") == 0) {
-        delay_exit();
-        exit(0);
-    } else if (strcmp(cmd, "list_hunts") == 0) {
+    if (strcmp(cmd, "list_hunts") == 0) {
         list_hunts();
     } else if (strncmp(cmd, "list_treasures ", 15) == 0) {
-        const char *hunt_id = cmd + 15;
-        list_treasures(hunt_id);
+        char hunt_id[128], option[16] = "";
+        int n = sscanf(cmd + 15, "%127s %15s", hunt_id, option);
+        if (n == 1 || (n == 2 && strcmp(option, "--tsv") == 0)) {
+            list_treasures(hunt_id, n == 2);
+        } else {
+            reply("Invalid list_treasures command format. Use: list_treasures <hunt_id> [--tsv]\n");
+        }
     } else if (strncmp(cmd, "view_treasure ", 14) == 0) {
         const char *params = cmd + 14;
         char hunt_id[128];
@@ -158,46 +577,145 @@ void process_command(const char *cmd) {
         if (sscanf(params, "%127s %d", hunt_id, &treasure_id) == 2) {
             view_treasure(hunt_id, treasure_id);
         } else {
-            dprintf(STDOUT_FILENO, "Invalid view_treasure command format. Use: view_treasure <hunt_id> <treasure_id>\n");
+            reply("Invalid view_treasure command format. Use: view_treasure <hunt_id> <treasure_id>\n");
+        }
+    } else if (strcmp(cmd, "stats") == 0) {
+        metrics_print(&metrics, "Monitor commands", 1, reply);
+    } else if (strcmp(cmd, "stats --prometheus") == 0) {
+        metrics_prometheus(&metrics, "treasure_monitor", "command", 1, reply);
+    } else if (strncmp(cmd, "stats ", 6) == 0) {
+        hunt_stats(cmd + 6);
+    } else if (strncmp(cmd, "near ", 5) == 0) {
+        char hunt_id[128];
+        double lat, lon, radius_km;
+        if (sscanf(cmd + 5, "%127s %lf %lf %lf", hunt_id, &lat, &lon, &radius_km) == 4) {
+            GeoQuery q;
+            geo_query_near(&q, lat, lon, radius_km);
+            geo_search(hunt_id, &q);
+        } else {
+            reply("Invalid near command format. Use: near <hunt_id> <lat> <lon> <radius_km>\n");
+        }
+    } else if (strncmp(cmd, "bbox ", 5) == 0) {
+        char hunt_id[128];
+        double lat_min, lon_min, lat_max, lon_max;
+        if (sscanf(cmd + 5, "%127s %lf %lf %lf %lf", hunt_id, &lat_min, &lon_min, &lat_max, &lon_max) == 5) {
+            GeoQuery q;
+            geo_query_bbox(&q, lat_min, lon_min, lat_max, lon_max);
+            geo_search(hunt_id, &q);
+        } else {
+            reply("Invalid bbox command format. Use: bbox <hunt_id> <lat_min> <lon_min> <lat_max> <lon_max>\n");
+        }
+    } else if (strncmp(cmd, "calculate_score ", 16) == 0) {
+        calculate_score(cmd + 16);
+    } else if (strncmp(cmd, "find_treasure ", 14) == 0) {
+        CrossQuery q;
+        memset(&q, 0, sizeof(q));
+        if (sscanf(cmd + 14, "%d", &q.treasure_id) == 1) {
+            cross_hunt_query(&q);
+        } else {
+            reply("Invalid find_treasure command format. Use: find_treasure <treasure_id>\n");
+        }
+    } else if (strncmp(cmd, "user_treasures ", 15) == 0) {
+        CrossQuery q;
+        memset(&q, 0, sizeof(q));
+        q.by_user = 1;
+        if (sscanf(cmd + 15, "%31s", q.username) == 1) {
+            cross_hunt_query(&q);
+        } else {
+            reply("Invalid user_treasures command format. Use: user_treasures <username>\n");
         }
     } else {
-        dprintf(STDOUT_FILENO, "Unknown command: %s\n", cmd);
+        reply("Unknown command: %s\n", cmd);
     }
 }
 
-int main() {
-    struct sigaction sa;
-    sa.sa_handler = sigusr1_handler;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = 0;
-    sigaction(SIGUSR1, &sa, NULL);
-
-    dprintf(STDOUT_FILENO, "Monitor started with PID %d\n", getpid());
+// A command queued for the worker pool
+typedef struct {
+    uint32_t request_id;
+    char command[];
+} Job;
+
+void run_job(void *arg, int worker) {
+    Job *job = arg;
+    current_request = job->request_id;
+    StoreCounters before = store_counters;
+    uint64_t start = metrics_now_ns();
+    process_command(job->command);
+    reply_flush();
+
+    // Recorded before the response ends, so a stats sent after it sees it
+    StoreCounters io = {
+        .bytes_read = store_counters.bytes_read - before.bytes_read,
+        .records_scanned = store_counters.records_scanned - before.records_scanned,
+        .cache_hits = store_counters.cache_hits - before.cache_hits,
+        .cache_misses = store_counters.cache_misses - before.cache_misses,
+    };
+    metrics_record(&metrics, metric_kind(job->command), metrics_now_ns() - start, &io);
+    reply_end();
+    current_request = 0;
+    free(job);
+}
 
-    while (1) {
-        pause();
+int main() {
+    reply("Monitor started with PID %d\n", getpid());
+    reply_flush();
 
-        if (command_ready) {
-            command_ready = 0;
+    if (pool_init(&query_pool, pool_default_threads()) < 0) {
+        reply("Monitor: cannot start worker threads\n");
+        reply_flush();
+        return 1;
+    }
+    catalog_init(&catalog, &query_pool);
+    const char *cache_mb = getenv("MONITOR_CACHE_MB");
+    long budget_mb = cache_mb ? atol(cache_mb) : HUNT_CACHE_DEFAULT_MB;
+    hunt_cache_init(&hunt_cache, budget_mb > 0 ? (size_t)budget_mb << 20 : 0);
+
+    ThreadPool pool;
+    if (pool_init(&pool, MONITOR_WORKERS) < 0) {
+        reply("Monitor: cannot start worker threads\n");
+        reply_flush();
+        return 1;
+    }
 
-            int fd = open(CMD_FILE, O_RDONLY);
-            if (fd < 0) {
-                dprintf(STDOUT_FILENO, "Monitor: Cannot open command file: %s\n", strerror(errno));
-                continue;
-            }
+    // Commands arrive as frames on stdin; EOF means the hub went away
+    FrameHeader hdr;
+    char buf[FRAME_MAX_PAYLOAD + 1];
+    int rc;
+    while ((rc = frame_read(STDIN_FILENO, &hdr, buf, sizeof(buf))) > 0) {
+        if (hdr.type != FRAME_COMMAND) {
+            reply("Monitor: unexpected frame type %u\n", hdr.type);
+            reply_flush();
+            continue;
+        }
 
-            char buf[256] = {0};
-            ssize_t n = read(fd, buf, sizeof(buf) - 1);
-            close(fd);
+        if (strcmp(buf, "stop_monitor") == 0) {
+            // Let the commands queued before it finish first
+            pool_wait(&pool);
+            current_request = hdr.request_id;
+            delay_exit();
+            exit(0);
+        }
 
-            if (n > 0) {
-                buf[n] = '\0';
-                process_command(buf);
-            } else {
-                dprintf(STDOUT_FILENO, "Monitor: No command read\n");
-            }
+        Job *job = malloc(sizeof(Job) + hdr.length + 1);
+        if (!job) {
+            current_request = hdr.request_id;
+            reply("Monitor: out of memory\n");
+            reply_end();
+            current_request = 0;
+            continue;
         }
+        job->request_id = hdr.request_id;
+        memcpy(job->command, buf, hdr.length + 1);
+        pool_submit(&pool, run_job, job);
     }
-
+    if (rc < 0)
+        reply("Monitor: command channel error: %s\n", strerror(errno));
+    reply_flush();
+
+    pool_wait(&pool);
+    pool_destroy(&pool);
+    pool_destroy(&query_pool);
+    catalog_free(&catalog);
+    hunt_cache_free(&hunt_cache);
     return 0;
 }
@@ -0,0 +1,66 @@
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "monitor_protocol.h"
+
+static int write_all(int fd, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    return 0;
+}
+
+static int read_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = read(fd, p + done, len - done);
+        if (n == 0)
+            return done == 0 ? 0 : -1;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return 1;
+}
+
+int frame_write(int fd, uint32_t request_id, uint32_t type, const void *payload, uint32_t length) {
+    FrameHeader hdr = { length, request_id, type };
+    struct iovec iov[2] = {
+        { &hdr, sizeof(hdr) },
+        { (void *)payload, length },
+    };
+    return write_all(fd, iov, length ? 2 : 1);
+}
+
+int frame_read(int fd, FrameHeader *hdr, char *buf, size_t cap) {
+    int rc = read_all(fd, hdr, sizeof(*hdr));
+    if (rc <= 0)
+        return rc;
+    if (hdr->length >= cap) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (hdr->length > 0 && read_all(fd, buf, hdr->length) != 1)
+        return -1;
+    buf[hdr->length] = '\0';
+    return 1;
+}
@@ -0,0 +1,35 @@
+#ifndef MONITOR_PROTOCOL_H
+#define MONITOR_PROTOCOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Framing used on both pipes between treasure_hub and the monitor. Each
+// frame is a fixed header followed by <length> payload bytes; request IDs
+// are assigned by the hub so queued commands are never merged or lost.
+// A response is any number of FRAME_DATA frames closed by one FRAME_END
+// carrying the same request ID. Request ID 0 is used for notices the
+// monitor sends on its own (e.g. its startup banner).
+#define FRAME_MAX_PAYLOAD 4096
+// Data frames may be larger: the monitor batches a response's output into
+// frames of up to this size
+#define FRAME_MAX_DATA 65536
+
+#define FRAME_COMMAND 1
+#define FRAME_DATA 2
+#define FRAME_END 3
+
+typedef struct {
+    uint32_t length;
+    uint32_t request_id;
+    uint32_t type;
+} FrameHeader;
+
+// Writes header and payload with a single writev. Returns 0 or -1.
+int frame_write(int fd, uint32_t request_id, uint32_t type, const void *payload, uint32_t length);
+
+// Reads one frame; the payload is NUL-terminated in buf (cap > length).
+// Returns 1 on success, 0 on clean EOF, -1 on error or oversized frame.
+int frame_read(int fd, FrameHeader *hdr, char *buf, size_t cap);
+
+#endif
@@ -0,0 +1,470 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "scoreboard.h"
+
+#define MIN_CAPACITY 64
+
+// FNV-1a over the NUL-terminated name
+static uint32_t hash_name(const char *s) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < USERNAME_MAX && s[i]; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+void scoreboard_init(Scoreboard *sb) {
+    memset(sb, 0, sizeof(*sb));
+}
+
+void scoreboard_free(Scoreboard *sb) {
+    ScoreBlock *b = sb->first;
+    while (b) {
+        ScoreBlock *next = b->next;
+        free(b);
+        b = next;
+    }
+    free(sb->slots);
+    memset(sb, 0, sizeof(*sb));
+}
+
+static UserScore *arena_alloc(Scoreboard *sb) {
+    if (!sb->last || sb->last->used == SCORE_BLOCK_USERS) {
+        ScoreBlock *b = malloc(sizeof(ScoreBlock));
+        if (!b)
+            return NULL;
+        b->next = NULL;
+        b->used = 0;
+        if (sb->last)
+            sb->last->next = b;
+        else
+            sb->first = b;
+        sb->last = b;
+    }
+    return &sb->last->users[sb->last->used++];
+}
+
+static int grow(Scoreboard *sb) {
+    size_t capacity = sb->capacity ? sb->capacity * 2 : MIN_CAPACITY;
+    UserScore **slots = calloc(capacity, sizeof(UserScore *));
+    if (!slots)
+        return -1;
+    for (size_t i = 0; i < sb->capacity; i++) {
+        UserScore *u = sb->slots[i];
+        if (!u)
+            continue;
+        size_t pos = u->hash & (capacity - 1);
+        while (slots[pos])
+            pos = (pos + 1) & (capacity - 1);
+        slots[pos] = u;
+    }
+    free(sb->slots);
+    sb->slots = slots;
+    sb->capacity = capacity;
+    return 0;
+}
+
+// Returns the node for username, creating it with a zero score if needed
+static UserScore *lookup(Scoreboard *sb, const char *username, uint32_t hash) {
+    if ((sb->count + 1) * 2 > sb->capacity && grow(sb) < 0)
+        return NULL;
+
+    size_t mask = sb->capacity - 1;
+    size_t pos = hash & mask;
+    for (UserScore *u; (u = sb->slots[pos]) != NULL; pos = (pos + 1) & mask) {
+        if (u->hash == hash && strncmp(u->username, username, USERNAME_MAX) == 0)
+            return u;
+    }
+
+    UserScore *u = arena_alloc(sb);
+    if (!u)
+        return NULL;
+    memset(u, 0, sizeof(*u));
+    strncpy(u->username, username, USERNAME_MAX - 1);
+    u->hash = hash;
+    sb->slots[pos] = u;
+    sb->count++;
+    return u;
+}
+
+int scoreboard_add(Scoreboard *sb, const char *username, int64_t value) {
+    UserScore *u = lookup(sb, username, hash_name(username));
+    if (!u)
+        return -1;
+    u->score += value;
+    u->treasures++;
+    return 0;
+}
+
+int scoreboard_add_user(Scoreboard *sb, const UserScore *src) {
+    UserScore *u = lookup(sb, src->username, src->hash);
+    if (!u)
+        return -1;
+    u->score += src->score;
+    u->treasures += src->treasures;
+    return 0;
+}
+
+int scoreboard_merge(Scoreboard *dst, const Scoreboard *src) {
+    for (const ScoreBlock *b = src->first; b; b = b->next)
+        for (size_t i = 0; i < b->used; i++)
+            if (scoreboard_add_user(dst, &b->users[i]) < 0)
+                return -1;
+    return 0;
+}
+
+void scoreboard_foreach(const Scoreboard *sb, void (*fn)(const UserScore *u, void *arg), void *arg) {
+    for (const ScoreBlock *b = sb->first; b; b = b->next)
+        for (size_t i = 0; i < b->used; i++)
+            fn(&b->users[i], arg);
+}
+
+// Ties are broken by name so the leaderboard is deterministic
+static int ranks_below(const UserScore *a, const UserScore *b) {
+    if (a->score != b->score)
+        return a->score < b->score;
+    return strncmp(a->username, b->username, USERNAME_MAX) > 0;
+}
+
+static void sift_down(const UserScore **heap, size_t n, size_t i) {
+    for (;;) {
+        size_t low = i, l = 2 * i + 1, r = 2 * i + 2;
+        if (l < n && ranks_below(heap[l], heap[low]))
+            low = l;
+        if (r < n && ranks_below(heap[r], heap[low]))
+            low = r;
+        if (low == i)
+            return;
+        const UserScore *tmp = heap[i];
+        heap[i] = heap[low];
+        heap[low] = tmp;
+        i = low;
+    }
+}
+
+static void heapify(const UserScore **heap, size_t n) {
+    for (size_t i = n / 2; i-- > 0;)
+        sift_down(heap, n, i);
+}
+
+size_t scoreboard_top(const Scoreboard *sb, size_t n, const UserScore **out) {
+    // Min-heap of the n best users seen so far: its root is the weakest
+    size_t size = 0;
+    if (n == 0)
+        return 0;
+    for (const ScoreBlock *b = sb->first; b; b = b->next) {
+        for (size_t i = 0; i < b->used; i++) {
+            const UserScore *u = &b->users[i];
+            if (size < n) {
+                out[size++] = u;
+                if (size == n)
+                    heapify(out, size);
+            } else if (ranks_below(out[0], u)) {
+                out[0] = u;
+                sift_down(out, size, 0);
+            }
+        }
+    }
+    if (size < n)
+        heapify(out, size);
+
+    // Heap sort the survivors into descending order
+    for (size_t end = size; end > 1; end--) {
+        const UserScore *tmp = out[0];
+        out[0] = out[end - 1];
+        out[end - 1] = tmp;
+        sift_down(out, end - 1, 0);
+    }
+    return size;
+}
+
+// Loads the cached totals of a hunt into sb if they were computed from the
+// file described by hdr and st. Returns the number of records they cover,
+// or 0 (with sb untouched) when there is no usable cache.
+static uint64_t cache_load(Scoreboard *sb, const char *hunt_id, const TreasureFileHeader *hdr,
+                           const struct stat *st) {
+    char path[512];
+    hunt_path(path, sizeof(path), hunt_id, SCORE_CACHE_FILE);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        store_counters.cache_misses++;
+        return 0;
+    }
+
+    ScoreCacheHeader ch;
+    ScoreCacheEntry *entries = NULL;
+    uint64_t covered = 0;
+    if (pread(fd, &ch, sizeof(ch), 0) != sizeof(ch) ||
+        memcmp(ch.magic, SCORE_CACHE_MAGIC, sizeof(ch.magic)) != 0 ||
+        ch.version != SCORE_CACHE_VERSION || ch.data_ino != (uint64_t)st->st_ino ||
+        ch.data_epoch != hdr->epoch || ch.data_record_count > hdr->record_count ||
+        ch.user_count > SIZE_MAX / sizeof(ScoreCacheEntry))
+        goto out;
+
+    size_t len = ch.user_count * sizeof(ScoreCacheEntry);
+    entries = malloc(len ? len : 1);
+    if (!entries || pread(fd, entries, len, sizeof(ch)) != (ssize_t)len)
+        goto out;
+    for (uint64_t i = 0; i < ch.user_count; i++) {
+        entries[i].username[USERNAME_MAX - 1] = '\0';
+        UserScore u;
+        memset(&u, 0, sizeof(u));
+        memcpy(u.username, entries[i].username, USERNAME_MAX);
+        u.hash = hash_name(u.username);
+        u.score = entries[i].score;
+        u.treasures = entries[i].treasures;
+        if (scoreboard_add_user(sb, &u) < 0) {
+            scoreboard_free(sb);
+            goto out;
+        }
+    }
+    covered = ch.data_record_count;
+    store_counters.bytes_read += sizeof(ch) + len;
+out:
+    if (covered)
+        store_counters.cache_hits++;
+    else
+        store_counters.cache_misses++;
+    free(entries);
+    close(fd);
+    return covered;
+}
+
+// Rewrites the cache through a temporary file; failures only cost speed
+static void cache_save(const Scoreboard *sb, const char *hunt_id, const TreasureFileHeader *hdr,
+                       const struct stat *st) {
+    ScoreCacheHeader ch;
+    memset(&ch, 0, sizeof(ch));
+    memcpy(ch.magic, SCORE_CACHE_MAGIC, sizeof(ch.magic));
+    ch.version = SCORE_CACHE_VERSION;
+    ch.data_ino = (uint64_t)st->st_ino;
+    ch.data_epoch = hdr->epoch;
+    ch.data_record_count = hdr->record_count;
+    ch.user_count = sb->count;
+
+    size_t len = sizeof(ch) + sb->count * sizeof(ScoreCacheEntry);
+    char *buf = calloc(1, len);
+    if (!buf)
+        return;
+    memcpy(buf, &ch, sizeof(ch));
+    ScoreCacheEntry *e = (ScoreCacheEntry *)(buf + sizeof(ch));
+    for (const ScoreBlock *b = sb->first; b; b = b->next) {
+        for (size_t i = 0; i < b->used; i++, e++) {
+            memcpy(e->username, b->users[i].username, USERNAME_MAX);
+            e->score = b->users[i].score;
+            e->treasures = b->users[i].treasures;
+        }
+    }
+
+    // A unique temporary name: the monitor may score a hunt from several
+    // threads at once
+    char path[512], tmp_path[512];
+    hunt_path(path, sizeof(path), hunt_id, SCORE_CACHE_FILE);
+    hunt_path(tmp_path, sizeof(tmp_path), hunt_id, SCORE_CACHE_FILE ".XXXXXX");
+    int fd = mkstemp(tmp_path);
+    if (fd >= 0) {
+        fchmod(fd, 0644);
+        int ok = write(fd, buf, len) == (ssize_t)len;
+        close(fd);
+        if (!ok || rename(tmp_path, path) < 0)
+            unlink(tmp_path);
+    }
+    free(buf);
+}
+
+// Adds per-user totals summed in arrays indexed by user ID, in ID order
+// (first-seen order, like the scoreboard); users without treasures in the
+// summed records are left out. Each name is hashed once per user rather
+// than once per record.
+static int add_dense(Scoreboard *sb, const char (*names)[USERNAME_MAX], const int64_t *score,
+                     const uint64_t *treasures, uint64_t users) {
+    for (uint64_t i = 0; i < users; i++) {
+        if (treasures[i] == 0)
+            continue;
+        UserScore u;
+        memset(&u, 0, sizeof(u));
+        memcpy(u.username, names[i], USERNAME_MAX - 1);
+        u.hash = hash_name(u.username);
+        u.score = score[i];
+        u.treasures = treasures[i];
+        if (scoreboard_add_user(sb, &u) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+// Totals from the columnar snapshot, reading only its user and value
+// columns. Returns the number of records covered, or 0 (with sb untouched)
+// without a snapshot.
+static uint64_t columns_load(Scoreboard *sb, const char *hunt_id, const TreasureFileHeader *hdr) {
+    ColumnSnapshot cs;
+    if (columns_open(&cs, hunt_id, hdr, COL_MASK(COL_USER) | COL_MASK(COL_VALUE) | COL_MASK(COL_USERS)) != STORE_OK)
+        return 0;
+
+    uint64_t users = cs.elements[COL_USERS];
+    const uint32_t *user = cs.data[COL_USER];
+    const int32_t *value = cs.data[COL_VALUE];
+    int64_t *score = calloc(users ? users : 1, sizeof(int64_t));
+    uint64_t *treasures = calloc(users ? users : 1, sizeof(uint64_t));
+    uint64_t covered = score && treasures ? cs.meta.data_record_count : 0;
+    for (uint64_t i = 0; covered && i < cs.meta.rows; i++) {
+        if (user[i] >= users) {
+            covered = 0;
+            break;
+        }
+        score[user[i]] += value[i];
+        treasures[user[i]]++;
+    }
+    store_counters.records_scanned += cs.meta.rows;
+    store_counters.bytes_read += cs.meta.rows * (sizeof(uint32_t) + sizeof(int32_t));
+    if (covered && add_dense(sb, cs.data[COL_USERS], score, treasures, users) < 0) {
+        scoreboard_free(sb);
+        covered = 0;
+    }
+    free(score);
+    free(treasures);
+    columns_close(&cs);
+    return covered;
+}
+
+// Totals of the live records from slot <first> on, grouped by user ID; the
+// names come from users.dat, loaded after hdr so it covers every record.
+// hdr->record_count is set to the records actually scanned.
+static int scan_load(Scoreboard *sb, const char *hunt_id, int fd, TreasureFileHeader *hdr, uint64_t first) {
+    UserDict users;
+    int rc = user_dict_open(&users, hunt_id, 0);
+    if (rc != STORE_OK)
+        return rc;
+    uint64_t n = users.count;
+    int64_t *score = calloc(n ? n : 1, sizeof(int64_t));
+    uint64_t *treasures = calloc(n ? n : 1, sizeof(uint64_t));
+    if (!score || !treasures) {
+        errno = ENOMEM;
+        rc = STORE_ERR_IO;
+    }
+
+    StoreScan scan;
+    if (rc == STORE_OK && (rc = store_scan_open_at(&scan, fd, hdr, first)) == STORE_OK) {
+        const Treasure *t;
+        while ((t = store_scan_next(&scan, NULL)) != NULL) {
+            if (t->user_id >= n) {
+                rc = STORE_ERR_FORMAT;
+                break;
+            }
+            score[t->user_id] += t->value;
+            treasures[t->user_id]++;
+        }
+        if (rc == STORE_OK)
+            rc = store_scan_error(&scan);
+        hdr->record_count = scan.hdr.record_count;
+        store_scan_close(&scan);
+    }
+    if (rc == STORE_OK && add_dense(sb, (const char (*)[USERNAME_MAX])users.names, score, treasures, n) < 0) {
+        errno = ENOMEM;
+        rc = STORE_ERR_IO;
+    }
+    free(score);
+    free(treasures);
+    user_dict_close(&users);
+    return rc;
+}
+
+int scoreboard_add_records(Scoreboard *sb, const Treasure *records, size_t n, const UserDict *users) {
+    uint64_t count = users->count;
+    int64_t *score = calloc(count ? count : 1, sizeof(int64_t));
+    uint64_t *treasures = calloc(count ? count : 1, sizeof(uint64_t));
+    int rc = score && treasures ? STORE_OK : STORE_ERR_IO;
+    for (size_t i = 0; rc == STORE_OK && i < n; i++) {
+        if (records[i].user_id >= count) {
+            rc = STORE_ERR_FORMAT;
+            break;
+        }
+        score[records[i].user_id] += records[i].value;
+        treasures[records[i].user_id]++;
+    }
+    if (rc == STORE_OK && add_dense(sb, (const char (*)[USERNAME_MAX])users->names, score, treasures, count) < 0)
+        rc = STORE_ERR_IO;
+    if (rc == STORE_ERR_IO)
+        errno = ENOMEM;
+    free(score);
+    free(treasures);
+    return rc;
+}
+
+int scoreboard_add_hunt(Scoreboard *sb, const char *hunt_id) {
+    TreasureFileHeader hdr;
+    int fd = store_open(hunt_id, 0, 0, &hdr);
+    if (fd < 0)
+        return fd;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return STORE_ERR_IO;
+    }
+
+    Scoreboard hunt;
+    scoreboard_init(&hunt);
+    uint64_t covered = cache_load(&hunt, hunt_id, &hdr, &st);
+    if (covered == 0)
+        covered = columns_load(&hunt, hunt_id, &hdr);
+
+    // Only the records appended since the cache was written are read
+    int rc = STORE_OK;
+    if (covered < hdr.record_count) {
+        rc = scan_load(&hunt, hunt_id, fd, &hdr, covered);
+        if (rc == STORE_OK)
+            cache_save(&hunt, hunt_id, &hdr, &st);
+    }
+    close(fd);
+
+    if (rc == STORE_OK) {
+        if (sb->count == 0) {
+            scoreboard_free(sb);
+            *sb = hunt;
+            return STORE_OK;
+        }
+        if (scoreboard_merge(sb, &hunt) < 0) {
+            errno = ENOMEM;
+            rc = STORE_ERR_IO;
+        }
+    }
+    scoreboard_free(&hunt);
+    return rc;
+}
+
+void scoreboard_print_top(const Scoreboard *sb, size_t top, ScorePrintFn out) {
+    const UserScore **best = malloc((top ? top : 1) * sizeof(UserScore *));
+    if (!best) {
+        out("Out of memory\n");
+        return;
+    }
+    size_t n = scoreboard_top(sb, top, best);
+    for (size_t i = 0; i < n; i++)
+        out("%zu. User: %s, Score: %lld\n", i + 1, best[i]->username, (long long)best[i]->score);
+    free(best);
+}
+
+void scoreboard_print_users(const Scoreboard *sb, ScorePrintFn out) {
+    for (const ScoreBlock *b = sb->first; b; b = b->next)
+        for (size_t i = 0; i < b->used; i++)
+            out("User: %s, Score: %lld\n", b->users[i].username, (long long)b->users[i].score);
+}
+
+void scoreboard_print(const Scoreboard *sb, const char *hunt_id, size_t top, ScorePrintFn out) {
+    if (sb->count == 0) {
+        out("No treasures found in hunt '%s'.\n", hunt_id);
+    } else if (top > 0) {
+        out("Top %zu of %zu users for hunt '%s':\n", top < sb->count ? top : sb->count, sb->count, hunt_id);
+        scoreboard_print_top(sb, top, out);
+    } else {
+        out("Scores for hunt '%s':\n", hunt_id);
+        scoreboard_print_users(sb, out);
+    }
+}
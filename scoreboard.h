@@ -0,0 +1,94 @@
+#ifndef SCOREBOARD_H
+#define SCOREBOARD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "treasure.h"
+
+// Per-user score totals. Users live in an open-addressing table keyed on
+// the username; their nodes come from an arena of fixed-size blocks, which
+// also keeps them in first-seen order for output.
+typedef struct {
+    char username[USERNAME_MAX];
+    uint32_t hash;
+    int64_t score;
+    uint64_t treasures;
+} UserScore;
+
+#define SCORE_BLOCK_USERS 1024
+
+typedef struct ScoreBlock {
+    struct ScoreBlock *next;
+    size_t used;
+    UserScore users[SCORE_BLOCK_USERS];
+} ScoreBlock;
+
+typedef struct {
+    UserScore **slots;
+    size_t capacity;        // power of two
+    size_t count;
+    ScoreBlock *first;
+    ScoreBlock *last;
+} Scoreboard;
+
+void scoreboard_init(Scoreboard *sb);
+void scoreboard_free(Scoreboard *sb);
+
+// Adds value to username's total; returns -1 on allocation failure
+int scoreboard_add(Scoreboard *sb, const char *username, int64_t value);
+int scoreboard_add_user(Scoreboard *sb, const UserScore *u);
+// Folds every user of src into dst
+int scoreboard_merge(Scoreboard *dst, const Scoreboard *src);
+
+// Calls fn for each user in first-seen order
+void scoreboard_foreach(const Scoreboard *sb, void (*fn)(const UserScore *u, void *arg), void *arg);
+
+// Fills out with the n best users, highest score first, using a bounded
+// heap rather than sorting every user. Returns how many were written.
+size_t scoreboard_top(const Scoreboard *sb, size_t n, const UserScore **out);
+
+// Scores every live treasure of a hunt. The hunt's totals are persisted in
+// <hunt>/scores.cache together with the number of records they cover, so a
+// later call only folds in the records appended since; a remove or compaction
+// (a new epoch or a new file) makes it start over. Without a cache, a current
+// columnar snapshot (treasure_manager --snapshot) is used for the records it
+// covers.
+int scoreboard_add_hunt(Scoreboard *sb, const char *hunt_id);
+// Scores records already in memory (the monitor's hunt cache); users must
+// name every user ID they use
+int scoreboard_add_records(Scoreboard *sb, const Treasure *records, size_t n, const UserDict *users);
+
+// Output shared by calculate_score and the monitor's calculate_score
+// command: out is printf-like (a printf wrapper, or the monitor's reply)
+typedef void (*ScorePrintFn)(const char *fmt, ...);
+
+// "1. User: <name>, Score: <n>" lines for the best top users
+void scoreboard_print_top(const Scoreboard *sb, size_t top, ScorePrintFn out);
+// "User: <name>, Score: <n>" lines in first-seen order
+void scoreboard_print_users(const Scoreboard *sb, ScorePrintFn out);
+// The report of one hunt: every user in first-seen order, or the best top ones when top > 0
+void scoreboard_print(const Scoreboard *sb, const char *hunt_id, size_t top, ScorePrintFn out);
+
+#define SCORE_CACHE_MAGIC "TRSC"
+#define SCORE_CACHE_VERSION 1
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t data_ino;          // treasures.dat the totals were read from
+    uint64_t data_epoch;
+    uint64_t data_record_count; // records [0, data_record_count) are included
+    uint64_t user_count;
+    uint8_t reserved[24];
+} ScoreCacheHeader;
+
+typedef struct {
+    char username[USERNAME_MAX];
+    int64_t score;
+    uint64_t treasures;
+} ScoreCacheEntry;
+
+_Static_assert(sizeof(ScoreCacheHeader) == 64, "ScoreCacheHeader must stay 64 bytes");
+
+#endif
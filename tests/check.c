@@ -0,0 +1,47 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "check.h"
+
+int check_failures;
+
+static const char *test_name;
+static char test_dir[512];
+
+void check_begin(const char *name) {
+    test_name = name;
+    setenv("TREASURE_SYNC", "none", 1);
+    const char *tmp = getenv("TMPDIR");
+    snprintf(test_dir, sizeof(test_dir), "%s/%s.XXXXXX", tmp && *tmp ? tmp : "/tmp", name);
+    if (!mkdtemp(test_dir) || chdir(test_dir) < 0) {
+        perror(test_dir);
+        exit(2);
+    }
+}
+
+int check_done(void) {
+    if (check_failures > 0) {
+        fprintf(stderr, "%s: %d check(s) failed, files left in %s\n", test_name, check_failures, test_dir);
+        return 1;
+    }
+    char cmd[600];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", test_dir);
+    if (chdir("/") < 0 || system(cmd) != 0)
+        fprintf(stderr, "%s: could not remove %s\n", test_name, test_dir);
+    return 0;
+}
+
+Treasure check_treasure(int32_t id, uint32_t user_id, double lat, double lon, int32_t value) {
+    Treasure t;
+    memset(&t, 0, sizeof(t));
+    t.id = id;
+    t.user_id = user_id;
+    t.latitude = lat;
+    t.longitude = lon;
+    t.value = value;
+    snprintf(t.clue, sizeof(t.clue), "clue %d", id);
+    return t;
+}
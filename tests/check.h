@@ -0,0 +1,46 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "treasure.h"
+
+// Minimal harness for the tests under tests/, run by `make check`. A
+// failed CHECK prints the expression and its line and the test carries on,
+// so one run reports every failure; check_done turns the count into the
+// exit status. Each test works in a fresh directory under $TMPDIR, removed
+// when it passes.
+extern int check_failures;
+
+#define CHECK(cond)                                                                   \
+    do {                                                                              \
+        if (!(cond)) {                                                                \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);  \
+            check_failures++;                                                         \
+        }                                                                             \
+    } while (0)
+
+// Like CHECK(got == want) for STORE_* codes, printing both
+#define CHECK_RC(expr, want)                                                          \
+    do {                                                                              \
+        int got_ = (expr), want_ = (want);                                            \
+        if (got_ != want_) {                                                          \
+            fprintf(stderr, "%s:%d: %s = %d (%s), expected %d (%s)\n", __FILE__,       \
+                    __LINE__, #expr, got_, store_strerror(got_), want_,               \
+                    store_strerror(want_));                                           \
+            check_failures++;                                                         \
+        }                                                                             \
+    } while (0)
+
+// Creates the test's directory and moves into it; the sync mode is set to
+// none first, since the tests never crash the machine
+void check_begin(const char *name);
+// Leaves and removes the directory if nothing failed; returns the exit
+// status for main
+int check_done(void);
+
+// A record with the given fields and a clue naming its ID
+Treasure check_treasure(int32_t id, uint32_t user_id, double lat, double lon, int32_t value);
+
+#endif
@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "check.h"
+#include "hunt_cache.h"
+#include "hunt_catalog.h"
+#include "thread_pool.h"
+
+static void add(const char *hunt_id, int32_t first_id, int32_t n) {
+    TreasureFileHeader hdr;
+    int fd = store_open(hunt_id, 1, 1, &hdr);
+    CHECK(fd >= 0);
+    for (int32_t id = first_id; id < first_id + n; id++) {
+        Treasure t = check_treasure(id, 0, 0, 0, id);
+        CHECK_RC(store_add(fd, hunt_id, &hdr, &t, 1), STORE_OK);
+    }
+    close(fd);
+}
+
+static void remove_ids(const char *hunt_id, int32_t first_id, int32_t n) {
+    TreasureFileHeader hdr;
+    int fd = store_open(hunt_id, 1, 0, &hdr);
+    CHECK(fd >= 0);
+    for (int32_t id = first_id; id < first_id + n; id++)
+        CHECK_RC(store_remove(fd, hunt_id, &hdr, id, NULL), STORE_OK);
+    close(fd);
+}
+
+// Entry count of a cached hunt, -1 if it could not be cached
+static long cached_count(HuntCache *c, const char *hunt_id, int32_t probe, int *found) {
+    CachedHunt *h;
+    int rc = hunt_cache_get(c, hunt_id, &h);
+    if (rc != 1)
+        return -1;
+    long count = (long)h->count;
+    *found = cached_hunt_find(h, probe) != NULL;
+    hunt_cache_put(c, h);
+    return count;
+}
+
+// Every change made through another descriptor is seen on the next get
+static void test_invalidation(void) {
+    HuntCache c;
+    hunt_cache_init(&c, 16 << 20);
+    int found;
+    add("a", 1, 10);
+    CHECK(cached_count(&c, "a", 5, &found) == 10 && found);
+    CHECK(cached_count(&c, "a", 11, &found) == 10 && !found);
+
+    add("a", 11, 1);
+    CHECK(cached_count(&c, "a", 11, &found) == 11 && found);
+
+    // Same size and inode: only the header generation changes
+    remove_ids("a", 5, 1);
+    CHECK(cached_count(&c, "a", 5, &found) == 10 && !found);
+
+    // Compaction replaces the file
+    TreasureFileHeader hdr;
+    int fd = store_open("a", 1, 0, &hdr);
+    CHECK(fd >= 0);
+    CHECK_RC(store_compact(fd, "a", &hdr), STORE_OK);
+    close(fd);
+    CHECK(cached_count(&c, "a", 6, &found) == 10 && found);
+
+    CHECK(cached_count(&c, "missing", 1, &found) == -1);
+    hunt_cache_free(&c);
+}
+
+// Hunts that do not fit are refused, and older entries make room for new ones
+static void test_budget(void) {
+    HuntCache c;
+    hunt_cache_init(&c, 20 * sizeof(Treasure));
+    int found;
+    add("big", 1, 30);
+    CachedHunt *h;
+    CHECK(hunt_cache_get(&c, "big", &h) == 0);
+
+    add("b", 1, 8);
+    add("c", 1, 8);
+    CHECK(cached_count(&c, "b", 1, &found) == 8 && found);
+    CHECK(cached_count(&c, "c", 1, &found) == 8 && found);
+    CHECK(c.bytes <= c.budget);
+    CHECK(cached_count(&c, "b", 8, &found) == 8 && found);
+    CHECK(c.bytes <= c.budget);
+    hunt_cache_free(&c);
+}
+
+typedef struct {
+    char names[8][32];
+    int status[8];
+    uint64_t live[8];
+    int count;
+} Listing;
+
+static void collect(const HuntInfo *h, void *arg) {
+    Listing *l = arg;
+    if (l->count < 8) {
+        snprintf(l->names[l->count], sizeof(l->names[0]), "%s", h->name);
+        l->status[l->count] = h->status;
+        l->live[l->count] = h->live_count;
+    }
+    l->count++;
+}
+
+static Listing list(HuntCatalog *c) {
+    Listing l;
+    memset(&l, 0, sizeof(l));
+    catalog_foreach(c, collect, &l);
+    return l;
+}
+
+// The catalog follows hunts being created, changed, broken and removed
+static void test_catalog(ThreadPool *pool) {
+    CHECK(mkdir("catalog", 0755) == 0 && chdir("catalog") == 0);
+    add("one", 1, 3);
+    CHECK(mkdir("not_a_hunt", 0755) == 0);
+    HuntCatalog c;
+    CHECK(catalog_init(&c, pool) == 0);
+
+    Listing l = list(&c);
+    CHECK(l.count == 1 && strcmp(l.names[0], "one") == 0 && l.live[0] == 3);
+
+    add("two", 1, 2);
+    add("one", 4, 2);
+    remove_ids("one", 1, 1);
+    l = list(&c);
+    CHECK(l.count == 2);
+    CHECK(strcmp(l.names[0], "one") == 0 && l.live[0] == 4);
+    CHECK(strcmp(l.names[1], "two") == 0 && l.live[1] == 2);
+
+    // A treasures.dat that cannot be opened is listed with its error
+    CHECK(mkdir("broken", 0755) == 0);
+    CHECK(symlink(TREASURE_FILE, "broken/" TREASURE_FILE) == 0);
+    l = list(&c);
+    CHECK(l.count == 3 && strcmp(l.names[0], "broken") == 0);
+    CHECK_RC(l.status[0], STORE_ERR_IO);
+
+    CHECK(unlink("two/" TREASURE_FILE) == 0);
+    l = list(&c);
+    CHECK(l.count == 2 && strcmp(l.names[1], "one") == 0);
+
+    CHECK(system("rm -rf broken one") == 0);
+    add("three", 1, 1);
+    l = list(&c);
+    CHECK(l.count == 1 && strcmp(l.names[0], "three") == 0 && l.live[0] == 1);
+    catalog_free(&c);
+    CHECK(chdir("..") == 0);
+}
+
+int main(void) {
+    check_begin("test_cache");
+    test_invalidation();
+    test_budget();
+    test_catalog(NULL);
+    ThreadPool pool;
+    CHECK(pool_init(&pool, 4) == 0);
+    CHECK(system("rm -rf catalog") == 0);
+    test_catalog(&pool);
+    pool_destroy(&pool);
+    return check_done();
+}
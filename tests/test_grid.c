@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "check.h"
+
+#define HUNT "hunt"
+#define GRID_PATH HUNT "/" GRID_FILE
+
+static uint64_t seed = 12345;
+
+static double uniform(double lo, double hi) {
+    seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+    return lo + (hi - lo) * (double)(seed >> 11) / (double)(1ull << 53);
+}
+
+// Points spread over the globe, bunched around the poles and the
+// antimeridian, plus some exactly on them
+static void add_points(int fd, TreasureFileHeader *hdr, int32_t first_id, int32_t n) {
+    static const double edges[][2] = {
+        { 90, 0 }, { -90, 0 }, { 90, 180 }, { -90, -180 }, { 0, 180 }, { 0, -180 },
+        { 45, 179.9 }, { 45, -179.9 }, { 89.99, 90 }, { -89.99, -90 },
+    };
+    Treasure *batch = malloc((size_t)n * sizeof(*batch));
+    CHECK(batch != NULL);
+    if (!batch)
+        return;
+    for (int32_t i = 0; i < n; i++) {
+        double lat, lon;
+        if ((size_t)i < sizeof(edges) / sizeof(edges[0])) {
+            lat = edges[i][0];
+            lon = edges[i][1];
+        } else if (i % 3 == 0) {
+            lat = uniform(80, 90) * (i % 2 ? 1 : -1);
+            lon = uniform(-180, 180);
+        } else if (i % 3 == 1) {
+            lat = uniform(-60, 60);
+            lon = uniform(170, 190);
+            if (lon > 180)
+                lon -= 360;
+        } else {
+            lat = uniform(-90, 90);
+            lon = uniform(-180, 180);
+        }
+        batch[i] = check_treasure(first_id + i, 0, lat, lon, i);
+    }
+    CHECK_RC(store_add(fd, HUNT, hdr, batch, (size_t)n), STORE_OK);
+    free(batch);
+}
+
+static int brute_match(const GeoQuery *q, const Treasure *t) {
+    if (q->near)
+        return geo_distance_km(q->lat, q->lon, t->latitude, t->longitude) <= q->radius_km;
+    if (t->latitude < q->lat_min || t->latitude > q->lat_max)
+        return 0;
+    if (q->lon_min <= q->lon_max)
+        return t->longitude >= q->lon_min && t->longitude <= q->lon_max;
+    return t->longitude >= q->lon_min || t->longitude <= q->lon_max;
+}
+
+static int compare_ids(const void *a, const void *b) {
+    int32_t x = *(const int32_t *)a, y = *(const int32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// store_geo_query against checking every record; returns the match count
+static size_t check_query(int fd, TreasureFileHeader *hdr, const GeoQuery *q, const char *what) {
+    GeoMatch *matches;
+    size_t count;
+    int rc = store_geo_query(fd, HUNT, hdr, q, &matches, &count);
+    CHECK_RC(rc, STORE_OK);
+    if (rc != STORE_OK)
+        return 0;
+
+    int32_t *want = malloc((size_t)hdr->record_count * sizeof(*want) + 1);
+    int32_t *got = malloc(count * sizeof(*got) + 1);
+    size_t nwant = 0;
+    StoreScan scan;
+    CHECK(want && got);
+    CHECK_RC(store_scan_open(&scan, fd, hdr), STORE_OK);
+    const Treasure *t;
+    while (want && (t = store_scan_next(&scan, NULL)) != NULL)
+        if (brute_match(q, t))
+            want[nwant++] = t->id;
+    CHECK_RC(store_scan_error(&scan), STORE_OK);
+    store_scan_close(&scan);
+
+    for (size_t i = 0; got && i < count; i++) {
+        got[i] = matches[i].t.id;
+        if (q->near && i > 0 && matches[i].distance_km < matches[i - 1].distance_km) {
+            fprintf(stderr, "%s: matches not sorted by distance\n", what);
+            check_failures++;
+            break;
+        }
+    }
+    if (want && got) {
+        qsort(want, nwant, sizeof(*want), compare_ids);
+        qsort(got, count, sizeof(*got), compare_ids);
+        if (nwant != count || memcmp(want, got, count * sizeof(*got)) != 0) {
+            fprintf(stderr, "%s: %zu matches, expected %zu\n", what, count, nwant);
+            check_failures++;
+        }
+    }
+    free(want);
+    free(got);
+    free(matches);
+    return count;
+}
+
+static void check_queries(int fd, TreasureFileHeader *hdr) {
+    GeoQuery q;
+    geo_query_near(&q, 89.5, 10, 300);
+    CHECK(check_query(fd, hdr, &q, "near the north pole") > 0);
+    geo_query_near(&q, -90, 0, 50);
+    CHECK(check_query(fd, hdr, &q, "at the south pole") > 0);
+    geo_query_near(&q, 10, 179.5, 800);
+    CHECK(check_query(fd, hdr, &q, "across the antimeridian") > 0);
+    geo_query_near(&q, 10, -179.5, 800);
+    CHECK(check_query(fd, hdr, &q, "across the antimeridian, west side") > 0);
+    geo_query_near(&q, 0, 0, 25000);
+    CHECK(check_query(fd, hdr, &q, "half the globe") > 0);
+    geo_query_bbox(&q, -30, 175, 30, -175);
+    CHECK(check_query(fd, hdr, &q, "box across the antimeridian") > 0);
+    geo_query_bbox(&q, 85, -180, 90, 180);
+    CHECK(check_query(fd, hdr, &q, "polar cap box") > 0);
+    geo_query_bbox(&q, -90, -180, 90, 180);
+    CHECK(check_query(fd, hdr, &q, "whole globe") == store_live_count(hdr));
+    geo_query_bbox(&q, 1, 1, 1.0001, 1.0001);
+    check_query(fd, hdr, &q, "tiny box");
+}
+
+// Below GRID_MIN_RECORDS the hunt is scanned and no grid is written
+static void test_small(void) {
+    TreasureFileHeader hdr;
+    int fd = store_open(HUNT, 1, 1, &hdr);
+    CHECK(fd >= 0);
+    add_points(fd, &hdr, 1, 1000);
+    check_queries(fd, &hdr);
+    CHECK(access(GRID_PATH, F_OK) < 0);
+    close(fd);
+}
+
+// The grid gives the same answers, including for records appended after
+// it was built and after a remove changed the epoch
+static void test_large(void) {
+    TreasureFileHeader hdr;
+    int fd = store_open(HUNT, 1, 0, &hdr);
+    CHECK(fd >= 0);
+    add_points(fd, &hdr, 10000, GRID_MIN_RECORDS * 2);
+    check_queries(fd, &hdr);
+    CHECK(access(GRID_PATH, F_OK) == 0);
+
+    // Within GRID_MAX_TAIL: found by scanning the tail
+    Treasure extra = check_treasure(100000, 0, 89.9, 179.99, 1);
+    CHECK_RC(store_add(fd, HUNT, &hdr, &extra, 1), STORE_OK);
+    add_points(fd, &hdr, 100001, 500);
+    GeoQuery q;
+    geo_query_near(&q, 90, 0, 20);
+    GeoMatch *matches;
+    size_t count;
+    int found = 0;
+    CHECK_RC(store_geo_query(fd, HUNT, &hdr, &q, &matches, &count), STORE_OK);
+    for (size_t i = 0; i < count; i++)
+        found |= matches[i].t.id == 100000;
+    free(matches);
+    CHECK(found);
+    check_queries(fd, &hdr);
+
+    CHECK_RC(store_remove(fd, HUNT, &hdr, 100000, NULL), STORE_OK);
+    CHECK_RC(store_remove(fd, HUNT, &hdr, 10000, NULL), STORE_OK);
+    check_queries(fd, &hdr);
+    close(fd);
+}
+
+int main(void) {
+    check_begin("test_grid");
+    test_small();
+    test_large();
+    return check_done();
+}
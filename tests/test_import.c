@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "check.h"
+
+#define HUNT "hunt"
+
+static int find(const char *hunt_id, int32_t id, Treasure *t) {
+    TreasureFileHeader hdr;
+    int fd = store_open(hunt_id, 0, 0, &hdr);
+    if (fd < 0)
+        return fd;
+    int rc = store_find(fd, hunt_id, &hdr, id, t, NULL);
+    close(fd);
+    return rc;
+}
+
+// Duplicates against the hunt and within the import are skipped, and the
+// rows span more than one batch
+static void test_duplicates(void) {
+    TreasureFileHeader hdr;
+    int fd = store_open(HUNT, 1, 1, &hdr);
+    CHECK(fd >= 0);
+    Treasure existing[3] = {
+        check_treasure(1, 0, 0, 0, 1), check_treasure(2, 0, 0, 0, 2), check_treasure(3, 0, 0, 0, 3),
+    };
+    CHECK_RC(store_add(fd, HUNT, &hdr, existing, 3), STORE_OK);
+
+    StoreImport im;
+    CHECK_RC(store_import_begin(&im, fd, HUNT), STORE_OK);
+    Treasure t = check_treasure(3, 0, 0, 0, 0);
+    CHECK_RC(store_import_add(&im, &t), STORE_ERR_EXISTS);
+    int32_t last = 4 + IMPORT_BATCH + 10;
+    for (int32_t id = 4; id < last; id++) {
+        t = check_treasure(id, 0, id % 90, id % 180, id);
+        CHECK_RC(store_import_add(&im, &t), STORE_OK);
+    }
+    t = check_treasure(4, 0, 0, 0, 0);
+    CHECK_RC(store_import_add(&im, &t), STORE_ERR_EXISTS);
+    CHECK_RC(store_import_end(&im), STORE_OK);
+    CHECK(im.added == (uint64_t)(last - 4));
+    CHECK(im.duplicates == 2);
+
+    CHECK_RC(store_read_header(fd, &hdr), STORE_OK);
+    CHECK(hdr.record_count == (uint64_t)(last - 1));
+    TreasureIndexHeader ih;
+    int idx = index_open(HUNT, &hdr, 0, &ih);
+    CHECK(idx >= 0);
+    if (idx >= 0)
+        close(idx);
+    close(fd);
+    CHECK_RC(find(HUNT, last - 1, &t), STORE_OK);
+    CHECK(t.value == last - 1);
+    CHECK_RC(find(HUNT, 4, &t), STORE_OK);
+    CHECK(t.value == 4);
+}
+
+static int commits_allowed;
+
+static int limited_commit(void *arg) {
+    (void)arg;
+    return commits_allowed-- > 0 ? STORE_OK : STORE_ERR_IO;
+}
+
+// Only committed batches count as imported
+static void test_failed_batch(void) {
+    TreasureFileHeader hdr;
+    int fd = store_open("failing", 1, 1, &hdr);
+    CHECK(fd >= 0);
+    StoreImport im;
+    CHECK_RC(store_import_begin(&im, fd, "failing"), STORE_OK);
+    im.before_commit = limited_commit;
+    commits_allowed = 1;
+    int rc = STORE_OK;
+    int32_t id = 1;
+    while (rc == STORE_OK && id <= 3 * IMPORT_BATCH) {
+        Treasure t = check_treasure(id++, 0, 0, 0, 0);
+        rc = store_import_add(&im, &t);
+    }
+    CHECK_RC(rc, STORE_ERR_IO);
+    CHECK(id == 2 * IMPORT_BATCH + 1);
+    store_import_end(&im);
+    CHECK(im.added == IMPORT_BATCH);
+    CHECK_RC(store_read_header(fd, &hdr), STORE_OK);
+    CHECK(hdr.record_count == IMPORT_BATCH);
+    close(fd);
+}
+
+static char *read_file(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return NULL;
+    static char buf[8192];
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    buf[n] = '\0';
+    fclose(f);
+    return buf;
+}
+
+static const char *rows =
+    "id,username,latitude,longitude,clue,value\n"
+    "1,alice,10.5,20.5,plain,5\n"
+    "2,bob,\"-10\",\"20\",\"quoted, with comma \"\"q\"\"\",7\n"
+    "\n"
+    "# comment\n"
+    "3,carol,nan,0,x,1\n"
+    "4,dave,0,inf,x,1\n"
+    "5,erin,91,0,x,1\n"
+    "6,frank,0,0,x\n"
+    "7,gina,0,0,x,abc\n"
+    "1,alice,0,0,duplicate,1\n"
+    "{\"id\": 8, \"username\": \"hank\", \"latitude\": 1.5, \"longitude\": -2.5, "
+    "\"clue\": \"json \\\"clue\\\"\", \"value\": 9}\n"
+    "{\"id\":9,\"username\":\"ivy\",\"latitude\":-nan,\"longitude\":0,\"clue\":\"x\",\"value\":1}\n"
+    "{\"id\":10,\"username\":\"jo\n"
+    "11,kim,-90,180,edge,0\r\n";
+
+// The command-line importer: CSV with quoting and a header row, JSON
+// lines, and rows it must reject
+static void test_parser(void) {
+    const char *manager = getenv("TREASURE_MANAGER");
+    if (!manager) {
+        fprintf(stderr, "test_import: TREASURE_MANAGER not set, parser not tested\n");
+        check_failures++;
+        return;
+    }
+    FILE *f = fopen("rows.csv", "w");
+    CHECK(f && fputs(rows, f) >= 0);
+    if (f)
+        fclose(f);
+
+    char cmd[1024];
+    snprintf(cmd, sizeof(cmd), "'%s' --import parsed rows.csv > out.txt 2> err.txt", manager);
+    CHECK(system(cmd) == 0);
+    const char *out = read_file("out.txt");
+    CHECK(out && strstr(out, "Imported 4 treasures into parsed (1 duplicates, 7 invalid rows)"));
+    const char *err = read_file("err.txt");
+    CHECK(err && strstr(err, "line 6: invalid latitude"));
+    CHECK(err && strstr(err, "line 7: invalid longitude"));
+    CHECK(err && strstr(err, "line 8: invalid latitude"));
+    CHECK(err && strstr(err, "line 9: expected 6 CSV fields"));
+    CHECK(err && strstr(err, "line 10: invalid value"));
+    CHECK(err && strstr(err, "line 11: treasure ID 1 already exists"));
+    CHECK(err && strstr(err, "line 13: invalid latitude"));
+    CHECK(err && strstr(err, "line 14: malformed JSON"));
+
+    Treasure t;
+    CHECK_RC(find("parsed", 1, &t), STORE_OK);
+    CHECK(strcmp(t.clue, "plain") == 0 && t.latitude == 10.5);
+    CHECK_RC(find("parsed", 2, &t), STORE_OK);
+    CHECK(strcmp(t.clue, "quoted, with comma \"q\"") == 0 && t.latitude == -10.0 && t.value == 7);
+    CHECK_RC(find("parsed", 8, &t), STORE_OK);
+    CHECK(strcmp(t.clue, "json \"clue\"") == 0 && t.longitude == -2.5 && t.value == 9);
+    CHECK_RC(find("parsed", 11, &t), STORE_OK);
+    CHECK(t.latitude == -90.0 && t.longitude == 180.0);
+    for (int32_t id = 3; id <= 7; id++)
+        CHECK_RC(find("parsed", id, &t), STORE_ERR_NOT_FOUND);
+
+    UserDict users;
+    CHECK_RC(user_dict_open(&users, "parsed", 0), STORE_OK);
+    CHECK_RC(find("parsed", 8, &t), STORE_OK);
+    CHECK(strcmp(user_dict_name(&users, t.user_id), "hank") == 0);
+    CHECK(users.count == 4);
+    user_dict_close(&users);
+}
+
+int main(void) {
+    check_begin("test_import");
+    test_duplicates();
+    test_failed_batch();
+    test_parser();
+    return check_done();
+}
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "check.h"
+#include "hunt_gen.h"
+
+#define HUNT "hunt"
+#define INDEX_PATH HUNT "/" INDEX_FILE
+
+static ino_t index_inode(void) {
+    struct stat st;
+    return stat(INDEX_PATH, &st) == 0 ? st.st_ino : 0;
+}
+
+static int index_current(const TreasureFileHeader *hdr) {
+    TreasureIndexHeader ih;
+    int fd = index_open(HUNT, hdr, 0, &ih);
+    if (fd < 0)
+        return 0;
+    close(fd);
+    return 1;
+}
+
+static void generate(uint64_t n, int32_t first_id) {
+    HuntGenOptions o;
+    hunt_gen_defaults(&o);
+    o.treasures = n;
+    o.first_id = first_id;
+    uint64_t added;
+    CHECK_RC(hunt_generate(HUNT, &o, &added), STORE_OK);
+    CHECK(added == n);
+}
+
+static int find_all(int fd, TreasureFileHeader *hdr, int32_t first, int32_t count) {
+    int found = 0;
+    for (int32_t id = first; id < first + count; id++) {
+        Treasure t;
+        if (store_find(fd, HUNT, hdr, id, &t, NULL) == STORE_OK && t.id == id)
+            found++;
+    }
+    return found;
+}
+
+// Imports patch the index when they are small next to the hunt and
+// rebuild it otherwise; either way it ends up current
+static void test_import_patch_or_rebuild(void) {
+    generate(1000, 1);
+    TreasureFileHeader hdr;
+    int fd = store_open(HUNT, 1, 0, &hdr);
+    CHECK(fd >= 0);
+    CHECK(index_current(&hdr));
+
+    ino_t before = index_inode();
+    generate(50, 5000);
+    CHECK_RC(store_read_header(fd, &hdr), STORE_OK);
+    CHECK(index_current(&hdr));
+    CHECK(index_inode() == before);
+    CHECK(find_all(fd, &hdr, 5000, 50) == 50);
+
+    before = index_inode();
+    generate(500, 9000);
+    CHECK_RC(store_read_header(fd, &hdr), STORE_OK);
+    CHECK(index_current(&hdr));
+    CHECK(index_inode() != before);
+    CHECK(find_all(fd, &hdr, 1, 1000) == 1000);
+    CHECK(find_all(fd, &hdr, 9000, 500) == 500);
+    close(fd);
+}
+
+// A missing index, or one stamped for another generation, is rebuilt by
+// the next lookup
+static void test_stale_stamp(void) {
+    TreasureFileHeader hdr;
+    int fd = store_open(HUNT, 1, 0, &hdr);
+    CHECK(fd >= 0);
+
+    CHECK(unlink(INDEX_PATH) == 0);
+    CHECK(find_all(fd, &hdr, 1, 10) == 10);
+    CHECK(index_current(&hdr));
+
+    TreasureIndexHeader ih;
+    int idx = open(INDEX_PATH, O_RDWR);
+    CHECK(idx >= 0 && pread(idx, &ih, sizeof(ih), 0) == sizeof(ih));
+    ih.data_generation--;
+    CHECK(pwrite(idx, &ih, sizeof(ih), 0) == sizeof(ih));
+    close(idx);
+    CHECK(!index_current(&hdr));
+    CHECK(find_all(fd, &hdr, 5000, 50) == 50);
+    CHECK(index_current(&hdr));
+    close(fd);
+}
+
+// An index whose stamp claims to be current but which still points at a
+// removed record: lookups report it, and a remove rebuilds it
+static void test_stale_entries(void) {
+    TreasureFileHeader hdr;
+    int fd = store_open(HUNT, 1, 0, &hdr);
+    CHECK(fd >= 0);
+    CHECK(find_all(fd, &hdr, 1, 1) == 1);
+
+    struct stat st;
+    CHECK(stat(INDEX_PATH, &st) == 0);
+    char *copy = malloc((size_t)st.st_size);
+    int idx = open(INDEX_PATH, O_RDONLY);
+    CHECK(copy && idx >= 0 && read(idx, copy, (size_t)st.st_size) == st.st_size);
+    close(idx);
+
+    CHECK_RC(store_remove(fd, HUNT, &hdr, 7, NULL), STORE_OK);
+    TreasureIndexHeader *ih = (TreasureIndexHeader *)copy;
+    ih->data_generation = hdr.generation;
+    ih->data_record_count = hdr.record_count;
+    idx = open(INDEX_PATH, O_WRONLY | O_TRUNC);
+    CHECK(idx >= 0 && write(idx, copy, (size_t)st.st_size) == st.st_size);
+    close(idx);
+    free(copy);
+
+    Treasure t;
+    CHECK_RC(store_find(fd, HUNT, &hdr, 7, &t, NULL), STORE_ERR_INDEX);
+    CHECK_RC(store_remove(fd, HUNT, &hdr, 7, NULL), STORE_ERR_NOT_FOUND);
+    CHECK_RC(store_find(fd, HUNT, &hdr, 7, &t, NULL), STORE_ERR_NOT_FOUND);
+    CHECK_RC(store_remove(fd, HUNT, &hdr, 8, NULL), STORE_OK);
+    close(fd);
+}
+
+// Single adds past the table's load limit rebuild it at a larger size
+static void test_growth(void) {
+    TreasureFileHeader hdr;
+    int fd = store_open("small", 1, 1, &hdr);
+    CHECK(fd >= 0);
+    for (int32_t id = 1; id <= 200; id++) {
+        Treasure t = check_treasure(id, 0, 0, 0, id);
+        CHECK_RC(store_add(fd, "small", &hdr, &t, 1), STORE_OK);
+    }
+    TreasureIndexHeader ih;
+    int idx = index_open("small", &hdr, 0, &ih);
+    CHECK(idx >= 0);
+    CHECK(ih.entry_count == 200 && ih.entry_count * 10 <= ih.capacity * 7);
+    if (idx >= 0)
+        close(idx);
+    int found = 0;
+    for (int32_t id = 1; id <= 200; id++) {
+        Treasure t;
+        found += store_find(fd, "small", &hdr, id, &t, NULL) == STORE_OK && t.value == id;
+    }
+    CHECK(found == 200);
+    close(fd);
+}
+
+int main(void) {
+    check_begin("test_index");
+    test_import_patch_or_rebuild();
+    test_stale_stamp();
+    test_stale_entries();
+    test_growth();
+    return check_done();
+}
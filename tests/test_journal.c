@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "check.h"
+
+#define HUNT "hunt"
+#define DATA_PATH HUNT "/" TREASURE_FILE
+#define JOURNAL_PATH HUNT "/" JOURNAL_FILE
+
+// Same FNV-1a as the store: a crash leaves entries written by it
+static uint32_t checksum(const StoreJournalEntry *e) {
+    StoreJournalEntry copy = *e;
+    copy.checksum = 0;
+    const unsigned char *p = (const unsigned char *)&copy;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < sizeof(copy); i++)
+        h = (h ^ p[i]) * 16777619u;
+    return h;
+}
+
+// The entry store_remove would have logged for tombstoning <slot>
+static StoreJournalEntry tombstone_entry(const TreasureFileHeader *hdr, uint64_t slot) {
+    struct stat st;
+    StoreJournalEntry e;
+    memset(&e, 0, sizeof(e));
+    CHECK(stat(DATA_PATH, &st) == 0);
+    memcpy(e.magic, JOURNAL_MAGIC, sizeof(e.magic));
+    e.version = JOURNAL_VERSION;
+    e.data_ino = (uint64_t)st.st_ino;
+    e.base_generation = hdr->generation;
+    e.slot = slot;
+    e.flags = TREASURE_FLAG_DELETED;
+    e.hdr = *hdr;
+    e.hdr.dead_count++;
+    e.hdr.generation++;
+    e.hdr.epoch++;
+    e.checksum = checksum(&e);
+    return e;
+}
+
+static void leave_entry(const StoreJournalEntry *e) {
+    int fd = open(JOURNAL_PATH, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    CHECK(fd >= 0 && write(fd, e, sizeof(*e)) == sizeof(*e));
+    close(fd);
+}
+
+static off_t file_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? st.st_size : -1;
+}
+
+// What the next writer finds: the header after recovery
+static TreasureFileHeader recover(int fd) {
+    TreasureFileHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    CHECK_RC(store_lock_current(fd, HUNT, 1), STORE_OK);
+    CHECK_RC(store_read_header(fd, &hdr), STORE_OK);
+    store_unlock(fd);
+    return hdr;
+}
+
+static void test_replay(int fd, TreasureFileHeader *hdr) {
+    StoreJournalEntry e = tombstone_entry(hdr, 2);
+    leave_entry(&e);
+    TreasureFileHeader after = recover(fd);
+    CHECK(memcmp(&after, &e.hdr, sizeof(after)) == 0);
+    CHECK(file_size(JOURNAL_PATH) == 0);
+
+    Treasure t;
+    CHECK_RC(store_read_record(fd, &after, 2, &t), STORE_OK);
+    CHECK(treasure_deleted(&t) && t.id == 3);
+    CHECK_RC(store_find(fd, HUNT, &after, 3, &t, NULL), STORE_ERR_NOT_FOUND);
+    CHECK_RC(store_find(fd, HUNT, &after, 4, &t, NULL), STORE_OK);
+    *hdr = after;
+}
+
+// Entries that do not apply to the file as it is are dropped unapplied
+static void test_discard(int fd, TreasureFileHeader *hdr) {
+    StoreJournalEntry stale = tombstone_entry(hdr, 0);
+    stale.base_generation--;
+    stale.checksum = checksum(&stale);
+    StoreJournalEntry torn = tombstone_entry(hdr, 0);
+    torn.checksum ^= 1;
+    StoreJournalEntry other_file = tombstone_entry(hdr, 0);
+    other_file.data_ino++;
+    other_file.checksum = checksum(&other_file);
+    StoreJournalEntry past_end = tombstone_entry(hdr, hdr->record_count);
+    const StoreJournalEntry *entries[] = { &stale, &torn, &other_file, &past_end };
+
+    for (size_t i = 0; i < sizeof(entries) / sizeof(entries[0]); i++) {
+        leave_entry(entries[i]);
+        TreasureFileHeader after = recover(fd);
+        CHECK(memcmp(&after, hdr, sizeof(after)) == 0);
+        CHECK(file_size(JOURNAL_PATH) == 0);
+        Treasure t;
+        CHECK_RC(store_read_record(fd, &after, 0, &t), STORE_OK);
+        CHECK(!treasure_deleted(&t));
+    }
+
+    // A partial entry is as good as none
+    int jfd = open(JOURNAL_PATH, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    CHECK(jfd >= 0 && write(jfd, &stale, sizeof(stale) / 2) == sizeof(stale) / 2);
+    close(jfd);
+    TreasureFileHeader after = recover(fd);
+    CHECK(memcmp(&after, hdr, sizeof(after)) == 0);
+}
+
+// Records written by an append whose header never made it are cut off
+static void test_torn_append(int fd, TreasureFileHeader *hdr) {
+    off_t committed = store_record_offset(hdr, hdr->record_count);
+    CHECK(file_size(DATA_PATH) == committed);
+    Treasure junk[2] = { check_treasure(100, 0, 0, 0, 0), check_treasure(101, 0, 0, 0, 0) };
+    CHECK(pwrite(fd, junk, sizeof(junk) - 10, committed) == (ssize_t)sizeof(junk) - 10);
+
+    TreasureFileHeader after = recover(fd);
+    CHECK(memcmp(&after, hdr, sizeof(after)) == 0);
+    CHECK(file_size(DATA_PATH) == committed);
+    Treasure t;
+    CHECK_RC(store_find(fd, HUNT, &after, 100, &t, NULL), STORE_ERR_NOT_FOUND);
+
+    // The IDs are free again
+    CHECK_RC(store_add(fd, HUNT, &after, junk, 2), STORE_OK);
+    CHECK_RC(store_find(fd, HUNT, &after, 101, &t, NULL), STORE_OK);
+    *hdr = after;
+}
+
+int main(void) {
+    check_begin("test_journal");
+    TreasureFileHeader hdr;
+    int fd = store_open(HUNT, 1, 1, &hdr);
+    CHECK(fd >= 0);
+    Treasure batch[5];
+    for (int i = 0; i < 5; i++)
+        batch[i] = check_treasure(i + 1, 0, i, i, i);
+    CHECK_RC(store_add(fd, HUNT, &hdr, batch, 5), STORE_OK);
+
+    test_replay(fd, &hdr);
+    test_discard(fd, &hdr);
+    test_torn_append(fd, &hdr);
+    close(fd);
+    return check_done();
+}
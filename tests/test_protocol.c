@@ -0,0 +1,113 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "monitor_protocol.h"
+
+static char big[FRAME_MAX_DATA];
+
+// Data frames up to FRAME_MAX_DATA - 1 bytes fill more than a pipe
+// buffer, so they are written from another thread
+static void *write_big(void *arg) {
+    int fd = *(int *)arg;
+    memset(big, 'x', sizeof(big));
+    CHECK(frame_write(fd, 7, FRAME_DATA, big, FRAME_MAX_DATA - 1) == 0);
+    // Refused by the reader, which then closes the pipe
+    frame_write(fd, 7, FRAME_DATA, big, FRAME_MAX_DATA);
+    close(fd);
+    return NULL;
+}
+
+static void test_round_trip(void) {
+    int p[2];
+    CHECK(pipe(p) == 0);
+    FrameHeader hdr;
+    char buf[FRAME_MAX_PAYLOAD];
+
+    CHECK(frame_write(p[1], 1, FRAME_COMMAND, "list_hunts", 10) == 0);
+    CHECK(frame_write(p[1], 1, FRAME_END, NULL, 0) == 0);
+    CHECK(frame_read(p[0], &hdr, buf, sizeof(buf)) == 1);
+    CHECK(hdr.request_id == 1 && hdr.type == FRAME_COMMAND && hdr.length == 10);
+    CHECK(strcmp(buf, "list_hunts") == 0);
+    CHECK(frame_read(p[0], &hdr, buf, sizeof(buf)) == 1);
+    CHECK(hdr.type == FRAME_END && hdr.length == 0 && buf[0] == '\0');
+
+    // The largest payload that still leaves room for the NUL
+    memset(buf, 'a', sizeof(buf));
+    CHECK(frame_write(p[1], 2, FRAME_COMMAND, buf, FRAME_MAX_PAYLOAD - 1) == 0);
+    memset(buf, 0, sizeof(buf));
+    CHECK(frame_read(p[0], &hdr, buf, sizeof(buf)) == 1);
+    CHECK(hdr.length == FRAME_MAX_PAYLOAD - 1 && buf[0] == 'a' && buf[FRAME_MAX_PAYLOAD - 2] == 'a');
+    CHECK(buf[FRAME_MAX_PAYLOAD - 1] == '\0');
+
+    // Clean EOF between frames
+    close(p[1]);
+    CHECK(frame_read(p[0], &hdr, buf, sizeof(buf)) == 0);
+    close(p[0]);
+}
+
+static void test_limits(void) {
+    int p[2];
+    CHECK(pipe(p) == 0);
+    FrameHeader hdr;
+    char buf[FRAME_MAX_PAYLOAD];
+
+    // A frame that does not fit is refused before its payload is read
+    char payload[FRAME_MAX_PAYLOAD];
+    memset(payload, 'b', sizeof(payload));
+    CHECK(frame_write(p[1], 3, FRAME_COMMAND, payload, FRAME_MAX_PAYLOAD) == 0);
+    errno = 0;
+    CHECK(frame_read(p[0], &hdr, buf, sizeof(buf)) == -1);
+    CHECK(errno == EMSGSIZE && hdr.length == FRAME_MAX_PAYLOAD);
+    close(p[0]);
+    close(p[1]);
+
+    // EOF inside a header or a payload is an error, not a clean end
+    CHECK(pipe(p) == 0);
+    FrameHeader partial = { 5, 4, FRAME_DATA };
+    CHECK(write(p[1], &partial, sizeof(partial) - 1) == (ssize_t)sizeof(partial) - 1);
+    close(p[1]);
+    CHECK(frame_read(p[0], &hdr, buf, sizeof(buf)) == -1);
+    close(p[0]);
+
+    CHECK(pipe(p) == 0);
+    CHECK(write(p[1], &partial, sizeof(partial)) == (ssize_t)sizeof(partial));
+    CHECK(write(p[1], "abc", 3) == 3);
+    close(p[1]);
+    CHECK(frame_read(p[0], &hdr, buf, sizeof(buf)) == -1);
+    close(p[0]);
+}
+
+static void test_data_frames(void) {
+    int p[2];
+    CHECK(pipe(p) == 0);
+    signal(SIGPIPE, SIG_IGN);
+    pthread_t writer;
+    CHECK(pthread_create(&writer, NULL, write_big, &p[1]) == 0);
+
+    char *buf = malloc(FRAME_MAX_DATA);
+    FrameHeader hdr;
+    CHECK(buf != NULL);
+    if (buf) {
+        CHECK(frame_read(p[0], &hdr, buf, FRAME_MAX_DATA) == 1);
+        CHECK(hdr.length == FRAME_MAX_DATA - 1 && strlen(buf) == FRAME_MAX_DATA - 1);
+        errno = 0;
+        CHECK(frame_read(p[0], &hdr, buf, FRAME_MAX_DATA) == -1 && errno == EMSGSIZE);
+    }
+    close(p[0]);
+    pthread_join(writer, NULL);
+    free(buf);
+}
+
+int main(void) {
+    check_begin("test_protocol");
+    test_round_trip();
+    test_limits();
+    test_data_frames();
+    return check_done();
+}
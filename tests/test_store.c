@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "check.h"
+
+#define HUNT "hunt"
+
+static int open_hunt(TreasureFileHeader *hdr) {
+    int fd = store_open(HUNT, 1, 1, hdr);
+    CHECK(fd >= 0);
+    return fd;
+}
+
+static int count_live(int fd, const TreasureFileHeader *hdr) {
+    StoreScan scan;
+    int n = 0;
+    if (store_scan_open(&scan, fd, hdr) != STORE_OK)
+        return -1;
+    while (store_scan_next(&scan, NULL))
+        n++;
+    CHECK_RC(store_scan_error(&scan), STORE_OK);
+    store_scan_close(&scan);
+    return n;
+}
+
+static void test_add_find(void) {
+    TreasureFileHeader hdr;
+    int fd = open_hunt(&hdr);
+    CHECK(hdr.record_count == 0);
+
+    Treasure batch[3] = {
+        check_treasure(1, 0, 10.0, 20.0, 5),
+        check_treasure(2, 1, -10.0, -20.0, 7),
+        check_treasure(3, 0, 0.0, 0.0, 9),
+    };
+    CHECK_RC(store_add(fd, HUNT, &hdr, batch, 3), STORE_OK);
+    CHECK(hdr.record_count == 3);
+
+    Treasure t;
+    uint64_t slot;
+    CHECK_RC(store_find(fd, HUNT, &hdr, 2, &t, &slot), STORE_OK);
+    CHECK(t.id == 2 && t.value == 7 && slot == 1);
+    CHECK_RC(store_find(fd, HUNT, &hdr, 4, &t, NULL), STORE_ERR_NOT_FOUND);
+
+    // A taken ID, or one repeated in the batch, rejects the whole batch
+    Treasure taken[2] = { check_treasure(10, 0, 1, 1, 1), check_treasure(3, 0, 1, 1, 1) };
+    CHECK_RC(store_add(fd, HUNT, &hdr, taken, 2), STORE_ERR_EXISTS);
+    Treasure repeated[2] = { check_treasure(11, 0, 1, 1, 1), check_treasure(11, 0, 1, 1, 1) };
+    CHECK_RC(store_add(fd, HUNT, &hdr, repeated, 2), STORE_ERR_EXISTS);
+    CHECK(hdr.record_count == 3);
+    CHECK_RC(store_find(fd, HUNT, &hdr, 10, &t, NULL), STORE_ERR_NOT_FOUND);
+
+    // A second descriptor sees the committed records
+    TreasureFileHeader other;
+    int fd2 = store_open(HUNT, 0, 0, &other);
+    CHECK(fd2 >= 0 && other.record_count == 3);
+    close(fd2);
+    close(fd);
+}
+
+static void test_remove(void) {
+    TreasureFileHeader hdr;
+    int fd = open_hunt(&hdr);
+    uint64_t generation = hdr.generation, epoch = hdr.epoch;
+    int compact_rc = -100;
+    CHECK_RC(store_remove(fd, HUNT, &hdr, 2, &compact_rc), STORE_OK);
+    CHECK_RC(compact_rc, STORE_OK);
+    CHECK(hdr.dead_count == 1 && hdr.record_count == 3);
+    CHECK(hdr.generation > generation && hdr.epoch > epoch);
+
+    Treasure t;
+    CHECK_RC(store_find(fd, HUNT, &hdr, 2, &t, NULL), STORE_ERR_NOT_FOUND);
+    CHECK_RC(store_remove(fd, HUNT, &hdr, 2, NULL), STORE_ERR_NOT_FOUND);
+    CHECK(count_live(fd, &hdr) == 2);
+
+    // The removed ID can be used again
+    Treasure again = check_treasure(2, 0, 3, 3, 3);
+    CHECK_RC(store_add(fd, HUNT, &hdr, &again, 1), STORE_OK);
+    CHECK_RC(store_find(fd, HUNT, &hdr, 2, &t, NULL), STORE_OK);
+    CHECK(t.value == 3);
+    close(fd);
+}
+
+static void test_compaction(void) {
+    TreasureFileHeader hdr;
+    int fd = open_hunt(&hdr);
+    Treasure batch[100];
+    for (int i = 0; i < 100; i++)
+        batch[i] = check_treasure(1000 + i, 0, i % 90, i, i);
+    CHECK_RC(store_add(fd, HUNT, &hdr, batch, 100), STORE_OK);
+
+    struct stat before;
+    CHECK(fstat(fd, &before) == 0);
+    // The 64th tombstone (of 104 records) passes both thresholds
+    int compacted = 0;
+    for (int i = 0; i < 70; i++) {
+        int compact_rc = -100;
+        CHECK_RC(store_remove(fd, HUNT, &hdr, 1000 + i, &compact_rc), STORE_OK);
+        CHECK_RC(compact_rc, STORE_OK);
+        if (hdr.dead_count == 0)
+            compacted = 1;
+    }
+    CHECK(compacted);
+    CHECK(store_live_count(&hdr) == 33);
+
+    // The descriptor now holds the renamed file, and nothing is left over
+    struct stat held, current;
+    CHECK(fstat(fd, &held) == 0 && stat(HUNT "/" TREASURE_FILE, &current) == 0);
+    CHECK(held.st_ino == current.st_ino && held.st_ino != before.st_ino);
+    CHECK(access(HUNT "/temp.dat", F_OK) < 0);
+    CHECK(count_live(fd, &hdr) == 33);
+
+    Treasure t;
+    CHECK_RC(store_find(fd, HUNT, &hdr, 1099, &t, NULL), STORE_OK);
+    CHECK(t.value == 99);
+    CHECK_RC(store_find(fd, HUNT, &hdr, 1000, &t, NULL), STORE_ERR_NOT_FOUND);
+    CHECK_RC(store_find(fd, HUNT, &hdr, 1, &t, NULL), STORE_OK);
+
+    // Every lock on the new file was released with the call
+    int probe = open(HUNT "/" TREASURE_FILE, O_RDONLY);
+    CHECK(probe >= 0 && flock(probe, LOCK_EX | LOCK_NB) == 0);
+    close(probe);
+
+    // An explicit compaction drops the tombstones left since then
+    uint64_t live = store_live_count(&hdr);
+    CHECK_RC(store_compact(fd, HUNT, &hdr), STORE_OK);
+    CHECK(hdr.record_count == live && hdr.dead_count == 0);
+    close(fd);
+}
+
+static void test_scan_errors(void) {
+    TreasureFileHeader hdr;
+    int fd = open_hunt(&hdr);
+    close(fd);
+
+    // Buffered mode: a descriptor that cannot be mapped or read ends the
+    // scan with an error, not as an empty file
+    int wfd = open(HUNT "/" TREASURE_FILE, O_WRONLY);
+    StoreScan scan;
+    CHECK_RC(store_scan_open(&scan, wfd, &hdr), STORE_OK);
+    CHECK(store_scan_next(&scan, NULL) == NULL);
+    CHECK_RC(store_scan_error(&scan), STORE_ERR_IO);
+    store_scan_close(&scan);
+    close(wfd);
+
+    // Records missing from a file whose header counts them
+    CHECK(truncate(HUNT "/" TREASURE_FILE, store_record_offset(&hdr, hdr.record_count) - 1) == 0);
+    fd = store_open(HUNT, 0, 0, &hdr);
+    CHECK(fd >= 0);
+    CHECK_RC(store_scan_open(&scan, fd, &hdr), STORE_ERR_TRUNCATED);
+    store_scan_close(&scan);
+    close(fd);
+}
+
+static void test_bad_files(void) {
+    TreasureFileHeader hdr;
+    CHECK_RC(store_open("missing", 0, 0, &hdr), STORE_ERR_IO);
+
+    CHECK(mkdir("legacy", 0755) == 0);
+    FILE *f = fopen("legacy/" TREASURE_FILE, "w");
+    CHECK(f != NULL);
+    for (int i = 0; f && i < 100; i++)
+        fputc('x', f);
+    if (f)
+        fclose(f);
+    CHECK_RC(store_open("legacy", 0, 0, &hdr), STORE_ERR_FORMAT);
+}
+
+int main(void) {
+    check_begin("test_store");
+    test_add_find();
+    test_remove();
+    test_compaction();
+    test_scan_errors();
+    test_bad_files();
+    return check_done();
+}
@@ -0,0 +1,153 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "thread_pool.h"
+
+typedef struct {
+    ThreadPool *pool;
+    int index;
+} WorkerArg;
+
+int pool_default_threads(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+static void *worker_main(void *p) {
+    WorkerArg *wa = p;
+    ThreadPool *pool = wa->pool;
+    int index = wa->index;
+    free(wa);
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->head && !pool->stopping)
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        if (!pool->head)
+            break;
+
+        PoolTask *task = pool->head;
+        pool->head = task->next;
+        if (!pool->head)
+            pool->tail = NULL;
+        pthread_mutex_unlock(&pool->lock);
+
+        task->fn(task->arg, index);
+        if (task->group) {
+            pthread_mutex_lock(&task->group->lock);
+            if (--task->group->pending == 0)
+                pthread_cond_broadcast(&task->group->done);
+            pthread_mutex_unlock(&task->group->lock);
+        }
+        free(task);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0)
+            pthread_cond_broadcast(&pool->idle);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+int pool_init(ThreadPool *pool, int nthreads) {
+    if (nthreads < 1)
+        nthreads = 1;
+    pool->threads = calloc((size_t)nthreads, sizeof(pthread_t));
+    if (!pool->threads)
+        return -1;
+    pool->nthreads = 0;
+    pool->head = pool->tail = NULL;
+    pool->pending = 0;
+    pool->stopping = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+
+    for (int i = 0; i < nthreads; i++) {
+        WorkerArg *wa = malloc(sizeof(WorkerArg));
+        if (!wa)
+            break;
+        wa->pool = pool;
+        wa->index = i;
+        if (pthread_create(&pool->threads[i], NULL, worker_main, wa) != 0) {
+            free(wa);
+            break;
+        }
+        pool->nthreads++;
+    }
+    if (pool->nthreads == 0) {
+        pool_destroy(pool);
+        return -1;
+    }
+    return 0;
+}
+
+int pool_submit(ThreadPool *pool, pool_task_fn fn, void *arg) {
+    return pool_submit_group(pool, NULL, fn, arg);
+}
+
+int pool_submit_group(ThreadPool *pool, TaskGroup *group, pool_task_fn fn, void *arg) {
+    PoolTask *task = malloc(sizeof(PoolTask));
+    if (!task)
+        return -1;
+    task->fn = fn;
+    task->arg = arg;
+    task->group = group;
+    task->next = NULL;
+    if (group) {
+        pthread_mutex_lock(&group->lock);
+        group->pending++;
+        pthread_mutex_unlock(&group->lock);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail)
+        pool->tail->next = task;
+    else
+        pool->head = task;
+    pool->tail = task;
+    pool->pending++;
+    pthread_cond_signal(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+void pool_wait(ThreadPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0)
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_destroy(ThreadPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->nthreads; i++)
+        pthread_join(pool->threads[i], NULL);
+    free(pool->threads);
+    pool->threads = NULL;
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->idle);
+}
+
+void task_group_init(TaskGroup *group) {
+    pthread_mutex_init(&group->lock, NULL);
+    pthread_cond_init(&group->done, NULL);
+    group->pending = 0;
+}
+
+void task_group_wait(TaskGroup *group) {
+    pthread_mutex_lock(&group->lock);
+    while (group->pending > 0)
+        pthread_cond_wait(&group->done, &group->lock);
+    pthread_mutex_unlock(&group->lock);
+}
+
+void task_group_destroy(TaskGroup *group) {
+    pthread_mutex_destroy(&group->lock);
+    pthread_cond_destroy(&group->done);
+}
@@ -0,0 +1,55 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <pthread.h>
+
+// Fixed-size pool of worker threads fed from one FIFO queue. Tasks get the
+// index of the worker running them so callers can keep per-thread state.
+typedef void (*pool_task_fn)(void *arg, int worker);
+
+// The tasks of one batch on a shared pool, so that the submitter can wait
+// for just those while other work keeps running
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    int pending;
+} TaskGroup;
+
+typedef struct PoolTask {
+    pool_task_fn fn;
+    void *arg;
+    TaskGroup *group;
+    struct PoolTask *next;
+} PoolTask;
+
+typedef struct {
+    pthread_t *threads;
+    int nthreads;
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t idle;
+    PoolTask *head;
+    PoolTask *tail;
+    int pending;            // queued or running
+    int stopping;
+} ThreadPool;
+
+// Worker count matching the online CPUs
+int pool_default_threads(void);
+
+int pool_init(ThreadPool *pool, int nthreads);
+int pool_submit(ThreadPool *pool, pool_task_fn fn, void *arg);
+// Same, counted in group (from task_group_init)
+int pool_submit_group(ThreadPool *pool, TaskGroup *group, pool_task_fn fn, void *arg);
+// Blocks until every submitted task has finished
+void pool_wait(ThreadPool *pool);
+// Waits for queued tasks, then joins the workers
+void pool_destroy(ThreadPool *pool);
+
+void task_group_init(TaskGroup *group);
+// Blocks until the group's tasks have finished; must not be called from a
+// task of the same pool, which could be waiting for its own worker
+void task_group_wait(TaskGroup *group);
+void task_group_destroy(TaskGroup *group);
+
+#endif
@@ -8,31 +8,8 @@
 #include <time.h>
 #include <errno.h>
 
-#define TREASURE_FILE "treasures.dat"
-#define LOG_FILE "logged_hunt"
-#define MAX_USERNAME 32
-#define MAX_CLUE 128
-#define MAX_ID 16
-
-// Structure fixe pour un trésor
-typedef struct {
-    char id[MAX_ID];
-    char username[MAX_USERNAME];
-    float latitude;
-    float longitude;
-    char clue[MAX_CLUE];
-    int value;
-} Treasure;
-
-// Créer un dossier si nécessaire
-void create_directory(const char *path) {
-    mkdir(path, 0777);
-}
-
-// Chemin complet vers le fichier trésors
-void get_treasure_file_path(char *buffer, const char *hunt_id) {
-    sprintf(buffer, "%s/%s", hunt_id, TREASURE_FILE);
-}
+#include "treasure.h"
+#include "hunt_log.h"
 
 // Chemin complet vers le fichier de log
 void get_log_file_path(char *buffer, const char *hunt_id) {
@@ -48,114 +25,121 @@ void create_symlink_log(const char *hunt_id) {
     symlink(target, linkname); // ignore erreur si existe
 }
 
-// Log action utilisateur
-void log_action(const char *hunt_id, const char *action) {
-    char path[256];
-    get_log_file_path(path, hunt_id);
-    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
-    if (fd >= 0) {
-        dprintf(fd, "%s\n", action);
-        close(fd);
-    }
+// Log action utilisateur (mis en tampon, écrit à la sortie)
+void log_action(const char *hunt_id, const char *action, int64_t id, const char *user) {
+    hunt_log_add(hunt_log_get(hunt_id), action, id, user, NULL);
 }
 
 // Ajouter un trésor
 void add_treasure(const char *hunt_id) {
-    create_directory(hunt_id);
-    char path[256];
-    get_treasure_file_path(path, hunt_id);
-    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
-    if (fd < 0) { perror("open"); return; }
+    TreasureFileHeader hdr;
+    int fd = store_open(hunt_id, 1, 1, &hdr);
+    if (fd < 0) { fprintf(stderr, "open: %s\n", store_strerror(fd)); return; }
 
     Treasure t;
-    printf("ID: "); scanf("%15s", t.id);
-    printf("Username: "); scanf("%31s", t.username);
-    printf("Latitude: "); scanf("%f", &t.latitude);
-    printf("Longitude: "); scanf("%f", &t.longitude);
-    printf("Clue: "); getchar(); fgets(t.clue, MAX_CLUE, stdin);
+    char username[USERNAME_MAX] = {0};
+    memset(&t, 0, sizeof(t));
+    int ok = 1;
+    printf("ID: "); ok = ok && scanf("%d", &t.id) == 1;
+    printf("Username: "); ok = ok && scanf("%31s", username) == 1;
+    printf("Latitude: "); ok = ok && scanf("%lf", &t.latitude) == 1;
+    printf("Longitude: "); ok = ok && scanf("%lf", &t.longitude) == 1;
+    ok = ok && treasure_coords_valid(t.latitude, t.longitude);
+    printf("Clue: "); getchar(); ok = ok && fgets(t.clue, CLUE_MAX, stdin) != NULL;
     t.clue[strcspn(t.clue, "\n")] = 0; // remove newline
-    printf("Value: "); scanf("%d", &t.value);
-
-    write(fd, &t, sizeof(Treasure));
+    printf("Value: "); ok = ok && scanf("%d", &t.value) == 1;
+    if (!ok) { fprintf(stderr, "invalid input\n"); close(fd); return; }
+
+    UserDict users;
+    int rc = user_dict_open(&users, hunt_id, 1);
+    if (rc == STORE_OK) {
+        rc = user_dict_intern(&users, username, &t.user_id);
+        if (rc == STORE_OK)
+            rc = user_dict_sync(&users);
+        user_dict_close(&users);
+    }
+    if (rc == STORE_OK)
+        rc = store_add(fd, hunt_id, &hdr, &t, 1);
     close(fd);
+    if (rc < 0) { fprintf(stderr, "write: %s\n", store_strerror(rc)); return; }
 
-    log_action(hunt_id, "ADD TREASURE" );
+    log_action(hunt_id, "ADD TREASURE", t.id, username);
     create_symlink_log(hunt_id);
 }
 
 // Lister tous les trésors d'une chasse
 void list_treasures(const char *hunt_id) {
-    char path[256];
-    get_treasure_file_path(path, hunt_id);
-    int fd = open(path, O_RDONLY);
-    if (fd < 0) { perror("open"); return; }
+    TreasureFileHeader hdr;
+    int fd = store_open(hunt_id, 0, 0, &hdr);
+    if (fd < 0) { fprintf(stderr, "open: %s\n", store_strerror(fd)); return; }
 
     struct stat st;
-    if (stat(path, &st) == -1) { perror("stat"); return; }
-    printf("Hunt: %s\nFile size: %ld bytes\nLast modified: %s\n",
-           hunt_id, st.st_size, ctime(&st.st_mtime));
-
-    Treasure t;
-    while (read(fd, &t, sizeof(Treasure)) == sizeof(Treasure)) {
-        printf("[%s] %s (%.4f, %.4f), %d pts\n",
-               t.id, t.username, t.latitude, t.longitude, t.value);
+    if (fstat(fd, &st) == -1) { perror("stat"); close(fd); return; }
+    printf("Hunt: %s\nFile size: %ld bytes\nTreasures: %llu\nLast modified: %s\n",
+           hunt_id, st.st_size, (unsigned long long)store_live_count(&hdr), ctime(&st.st_mtime));
+
+    UserDict users;
+    int rc = user_dict_open(&users, hunt_id, 0);
+    if (rc != STORE_OK) { fprintf(stderr, "users: %s\n", store_strerror(rc)); close(fd); return; }
+    StoreScan scan;
+    if ((rc = store_scan_open(&scan, fd, &hdr)) != STORE_OK) {
+        fprintf(stderr, "read: %s\n", store_strerror(rc)); user_dict_close(&users); close(fd); return;
+    }
+    const Treasure *t;
+    while ((t = store_scan_next(&scan, NULL)) != NULL) {
+        printf("[%d] %s (%.4f, %.4f), %d pts\n",
+               t->id, user_dict_name(&users, t->user_id), t->latitude, t->longitude, t->value);
     }
+    if (store_scan_error(&scan) != STORE_OK)
+        perror("read");
+    store_scan_close(&scan);
+    user_dict_close(&users);
     close(fd);
-    log_action(hunt_id, "LIST TREASURES");
+    log_action(hunt_id, "LIST TREASURES", HUNT_LOG_NO_ID, NULL);
 }
 
 // Voir un trésor spécifique
-void view_treasure(const char *hunt_id, const char *id) {
-    char path[256];
-    get_treasure_file_path(path, hunt_id);
-    int fd = open(path, O_RDONLY);
-    if (fd < 0) { perror("open"); return; }
+void view_treasure(const char *hunt_id, int id) {
+    TreasureFileHeader hdr;
+    int fd = store_open(hunt_id, 0, 0, &hdr);
+    if (fd < 0) { fprintf(stderr, "open: %s\n", store_strerror(fd)); return; }
     Treasure t;
-    int found = 0;
-    while (read(fd, &t, sizeof(Treasure)) == sizeof(Treasure)) {
-        if (strcmp(t.id, id) == 0) {
-            printf("ID: %s\nUser: %s\nCoords: %.4f, %.4f\nClue: %s\nValue: %d\n",
-                   t.id, t.username, t.latitude, t.longitude, t.clue, t.value);
-            found = 1;
-            break;
-        }
+    UserDict users;
+    int rc = store_find(fd, hunt_id, &hdr, id, &t, NULL);
+    if (rc == STORE_OK)
+        rc = user_dict_open(&users, hunt_id, 0);
+    if (rc == STORE_OK) {
+        printf("ID: %d\nUser: %s\nCoords: %.4f, %.4f\nClue: %s\nValue: %d\n",
+               t.id, user_dict_name(&users, t.user_id), t.latitude, t.longitude, t.clue, t.value);
+        user_dict_close(&users);
+    } else if (rc == STORE_ERR_NOT_FOUND) {
+        printf("Treasure not found.\n");
+    } else {
+        fprintf(stderr, "read: %s\n", store_strerror(rc));
     }
-    if (!found) printf("Treasure not found.\n");
     close(fd);
-    log_action(hunt_id, "VIEW TREASURE");
+    log_action(hunt_id, "VIEW TREASURE", id, NULL);
 }
 
 // Supprimer un trésor spécifique
-void remove_treasure(const char *hunt_id, const char *id) {
-    char path[256];
-    get_treasure_file_path(path, hunt_id);
-    int fd = open(path, O_RDONLY);
-    if (fd < 0) { perror("open"); return; }
-
-    char tmp_path[256];
-    sprintf(tmp_path, "%s/tmp.dat", hunt_id);
-    int tmp_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    Treasure t;
-    int removed = 0;
-
-    while (read(fd, &t, sizeof(Treasure)) == sizeof(Treasure)) {
-        if (strcmp(t.id, id) != 0) {
-            write(tmp_fd, &t, sizeof(Treasure));
-        } else {
-            removed = 1;
-        }
-    }
+void remove_treasure(const char *hunt_id, int id) {
+    TreasureFileHeader hdr;
+    int fd = store_open(hunt_id, 1, 0, &hdr);
+    if (fd < 0) { fprintf(stderr, "open: %s\n", store_strerror(fd)); return; }
+    int compact_rc;
+    int rc = store_remove(fd, hunt_id, &hdr, id, &compact_rc);
     close(fd);
-    close(tmp_fd);
-    rename(tmp_path, path);
-    if (removed) printf("Treasure removed.\n");
-    else printf("Treasure not found.\n");
-    log_action(hunt_id, "REMOVE TREASURE");
+    if (rc == STORE_OK && compact_rc != STORE_OK) fprintf(stderr, "compact: %s\n", store_strerror(compact_rc));
+    if (rc == STORE_OK) printf("Treasure removed.\n");
+    else if (rc == STORE_ERR_NOT_FOUND) printf("Treasure not found.\n");
+    else fprintf(stderr, "remove: %s\n", store_strerror(rc));
+    log_action(hunt_id, "REMOVE TREASURE", id, NULL);
 }
 
 // Supprimer une chasse entière
 void remove_hunt(const char *hunt_id) {
     char cmd[256];
+    hunt_log_discard(hunt_id);
     sprintf(cmd, "rm -rf %s", hunt_id);
     system(cmd);
     char linkname[256];
@@ -176,9 +160,9 @@ int main(int argc, char *argv[]) {
     } else if (strcmp(argv[1], "--list") == 0) {
         list_treasures(argv[2]);
     } else if (strcmp(argv[1], "--view") == 0 && argc >= 4) {
-        view_treasure(argv[2], argv[3]);
+        view_treasure(argv[2], atoi(argv[3]));
     } else if (strcmp(argv[1], "--remove_treasure") == 0 && argc >= 4) {
-        remove_treasure(argv[2], argv[3]);
+        remove_treasure(argv[2], atoi(argv[3]));
     } else if (strcmp(argv[1], "--remove") == 0) {
         remove_hunt(argv[2]);
     } else {
@@ -0,0 +1,457 @@
+#ifndef TREASURE_H
+#define TREASURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define TREASURE_FILE "treasures.dat"
+#define LOG_FILE "logged_hunt"
+#define SCORE_CACHE_FILE "scores.cache"
+#define USERS_FILE "users.dat"
+
+#define USERNAME_MAX 32
+#define CLUE_MAX 128
+
+// On-disk format of treasures.dat: one TreasureFileHeader followed by
+// record_count fixed-size Treasure records. Every tool reads and writes the
+// file through the helpers below, so the layout is defined only here.
+#define TREASURE_MAGIC "TRHF"
+#define TREASURE_FORMAT_VERSION 2
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t record_size;
+    uint64_t record_count;
+    uint64_t generation;    // bumped by every change, lets sidecars detect staleness
+    uint64_t dead_count;    // tombstoned records still in the file
+    uint64_t epoch;         // bumped when existing records change (remove,
+                            // compact); appends leave it alone
+    uint8_t reserved[16];
+} TreasureFileHeader;
+
+typedef struct {
+    int32_t id;
+    uint32_t flags;
+    uint32_t user_id;       // index into the hunt's users.dat
+    uint32_t reserved0;
+    double latitude;
+    double longitude;
+    char clue[CLUE_MAX];
+    int32_t value;
+    uint32_t reserved;
+} Treasure;
+
+// Treasure.flags
+#define TREASURE_FLAG_DELETED 0x1
+
+static inline int treasure_deleted(const Treasure *t) {
+    return (t->flags & TREASURE_FLAG_DELETED) != 0;
+}
+
+// Latitude in [-90, 90] and longitude in [-180, 180]. Written so that NaN,
+// for which every comparison is false, is rejected too.
+static inline int treasure_coords_valid(double lat, double lon) {
+    return lat >= -90.0 && lat <= 90.0 && lon >= -180.0 && lon <= 180.0;
+}
+
+// Live (non-tombstoned) records in a hunt
+static inline uint64_t store_live_count(const TreasureFileHeader *hdr) {
+    return hdr->record_count - hdr->dead_count;
+}
+
+// remove_treasure compacts automatically once at least COMPACT_MIN_DEAD
+// records and COMPACT_DEAD_PERCENT of the file are tombstones
+#define COMPACT_MIN_DEAD 64
+#define COMPACT_DEAD_PERCENT 25
+
+_Static_assert(sizeof(TreasureFileHeader) == 64, "TreasureFileHeader must stay 64 bytes");
+_Static_assert(sizeof(Treasure) == 168, "Treasure must stay 168 bytes");
+
+// Error codes returned by the store_* functions (STORE_ERR_IO keeps errno)
+#define STORE_OK 0
+#define STORE_ERR_IO -1
+#define STORE_ERR_FORMAT -2
+#define STORE_ERR_VERSION -3
+#define STORE_ERR_NOT_FOUND -4
+#define STORE_ERR_EXISTS -5
+#define STORE_ERR_TRUNCATED -6      // shorter than the header's record_count
+#define STORE_ERR_INDEX -7          // the index points at the wrong record
+
+// Paths inside a hunt directory
+void hunt_path(char *buf, size_t size, const char *hunt_id, const char *name);
+
+// Opens <hunt_id>/treasures.dat and validates its header. With create != 0
+// the hunt directory and an empty file are created when missing. Returns the
+// fd (O_RDWR when writable != 0, else O_RDONLY) or a STORE_ERR_* code.
+int store_open(const char *hunt_id, int writable, int create, TreasureFileHeader *hdr);
+
+// Reads and validates the header of an already open file
+int store_read_header(int fd, TreasureFileHeader *hdr);
+int store_write_header(int fd, const TreasureFileHeader *hdr);
+void store_init_header(TreasureFileHeader *hdr);
+
+// Byte offset of record slot <index>
+off_t store_record_offset(const TreasureFileHeader *hdr, uint64_t index);
+
+// Reads record slot <index>; returns STORE_OK, STORE_ERR_IO, or
+// STORE_ERR_FORMAT when the slot is past record_count.
+int store_read_record(int fd, const TreasureFileHeader *hdr, uint64_t index, Treasure *t);
+
+// Appends <n> records after the last committed one and then bumps
+// record_count in the header; the header write is the commit point, so a
+// partial append is simply ignored by readers. The caller holds the
+// exclusive lock and a current header.
+int store_append(int fd, TreasureFileHeader *hdr, const Treasure *t, size_t n);
+
+// Durability. With TREASURE_SYNC=full (the default) each commit is synced
+// twice: the records before the header that commits them, and the header
+// after. A commit covers a whole batch (the n records of a store_add,
+// IMPORT_BATCH rows of an import), so the cost is two fdatasync()s per
+// batch rather than per record. TREASURE_SYNC=none leaves write-back to
+// the kernel.
+int store_sync(int fd);
+// pwrite()s the whole buffer at <off>, retrying short writes
+int store_write_full(int fd, const void *buf, size_t len, off_t off);
+// Syncs a directory, after creating or renaming a file in it
+int store_sync_dir(const char *dir);
+
+// In-place changes (tombstones) are made atomic with a one-entry redo
+// journal in <hunt>/treasures.journal: the entry is synced, then applied,
+// then cleared. An entry left by a crash is replayed by the next writer if
+// the header still has the generation it was written against.
+#define JOURNAL_FILE "treasures.journal"
+#define JOURNAL_MAGIC "TRJN"
+#define JOURNAL_VERSION 1
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t data_ino;          // treasures.dat the entry belongs to
+    uint64_t base_generation;   // header generation it applies to
+    uint64_t slot;
+    uint32_t flags;             // new flags word of record <slot>
+    uint32_t checksum;          // FNV-1a of the entry with this field zeroed
+    TreasureFileHeader hdr;     // header once the change is applied
+} StoreJournalEntry;
+
+// Replays or discards a leftover journal entry, then cuts off any records
+// past record_count left by an interrupted append. Run by
+// store_lock_current whenever it takes the exclusive lock on a writable fd.
+int store_recover(int fd, const char *hunt_id);
+
+// Appends records to a hunt while keeping its ID index up to date. Fails
+// with STORE_ERR_EXISTS (writing nothing) if an ID is already taken.
+int store_add(int fd, const char *hunt_id, TreasureFileHeader *hdr, const Treasure *t, size_t n);
+
+// Looks a treasure up by ID through the index: a few index probes plus a
+// single pread of the record. slot may be NULL.
+int store_find(int fd, const char *hunt_id, TreasureFileHeader *hdr, int32_t id, Treasure *t, uint64_t *slot);
+
+// Removes a treasure by setting its tombstone flag in place and dropping it
+// from the index; compacts the hunt when the dead-record threshold is
+// passed. Returns STORE_ERR_NOT_FOUND if the ID is unknown. The removal is
+// committed before compaction starts, so a failed compaction does not undo
+// it: compact_rc (may be NULL) gets its result, STORE_OK if none was due.
+int store_remove(int fd, const char *hunt_id, TreasureFileHeader *hdr, int32_t id, int *compact_rc);
+
+// Rewrites the hunt without its tombstoned records and rebuilds the index.
+// fd is switched to the new file.
+int store_compact(int fd, const char *hunt_id, TreasureFileHeader *hdr);
+int store_needs_compaction(const TreasureFileHeader *hdr);
+
+// Bulk import: holds the exclusive lock from begin to end, drops IDs that
+// already exist in the hunt or earlier in the import (STORE_ERR_EXISTS),
+// and appends records IMPORT_BATCH at a time. The index is brought up to
+// date once, in store_import_end.
+#define IMPORT_BATCH 8192
+
+typedef struct {
+    int fd;
+    const char *hunt_id;
+    TreasureFileHeader hdr;
+    uint64_t first_slot;        // record_count and generation before the import
+    uint64_t first_generation;
+    Treasure *buf;
+    size_t buffered;
+    int32_t *id_keys;
+    uint8_t *id_used;
+    size_t id_capacity;
+    size_t id_count;
+    uint64_t added;             // rows in committed batches
+    uint64_t duplicates;
+    // Called before each batch is committed, e.g. to make the usernames it
+    // refers to durable first; may be NULL
+    int (*before_commit)(void *arg);
+    void *before_commit_arg;
+} StoreImport;
+
+int store_import_begin(StoreImport *im, int fd, const char *hunt_id);
+int store_import_add(StoreImport *im, const Treasure *t);
+int store_import_end(StoreImport *im);
+
+// Exclusive/shared advisory lock on the data file
+int store_lock(int fd, int exclusive);
+// Same, but if compaction replaced treasures.dat while we waited, fd is
+// reopened (via dup2) on the new file first
+int store_lock_current(int fd, const char *hunt_id, int exclusive);
+void store_unlock(int fd);
+
+const char *store_strerror(int rc);
+
+// What the calling thread has done in the store layer, for the monitor's
+// per-command metrics: bytes of records, index entries, names and cache
+// or snapshot files read (mapped or not), records visited, and lookups in
+// the score cache and the monitor's hunt cache. Only ever incremented;
+// callers take differences.
+typedef struct {
+    uint64_t bytes_read;
+    uint64_t records_scanned;
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+} StoreCounters;
+
+extern __thread StoreCounters store_counters;
+
+// Usernames of a hunt, interned in <hunt>/users.dat: a 64-byte header and
+// then one NUL-padded char[USERNAME_MAX] per user, so a record only stores
+// the user's index. Names are only ever appended, and a name is in the
+// file before any record that refers to it is committed; a dictionary
+// loaded after store_open therefore resolves every record of that snapshot.
+#define USERS_MAGIC "TRUD"
+#define USERS_VERSION 1
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t count;             // the commit point of an append
+    uint8_t reserved[48];
+} UserDictHeader;
+
+_Static_assert(sizeof(UserDictHeader) == 64, "UserDictHeader must stay 64 bytes");
+
+typedef struct {
+    int fd;                     // -1 for a hunt without users.dat yet
+    int writable;
+    char (*names)[USERNAME_MAX];
+    uint64_t count;
+    uint64_t capacity;
+    uint32_t *slots;            // open-addressing hash, user_id + 1 (0 = empty)
+    size_t slot_capacity;
+    int dirty;                  // names appended since the last user_dict_sync
+} UserDict;
+
+// Loads the dictionary of a hunt. With create != 0 it is opened for
+// writing (the hunt directory must exist) so that names can be interned.
+int user_dict_open(UserDict *d, const char *hunt_id, int create);
+void user_dict_close(UserDict *d);
+// ID of a name, appending it to users.dat under an exclusive lock if it is
+// new. Names are truncated to USERNAME_MAX - 1 bytes.
+int user_dict_intern(UserDict *d, const char *name, uint32_t *id);
+// Makes the interned names durable (see store_sync); call it before
+// committing records that refer to them
+int user_dict_sync(UserDict *d);
+// Name of an ID, or "?" for an ID the dictionary does not hold
+const char *user_dict_name(const UserDict *d, uint32_t id);
+// 1 with the ID of name in *id if the dictionary (as loaded) holds it, else 0
+int user_dict_find(const UserDict *d, const char *name, uint32_t *id);
+
+// Sorted names of the directories under the current one that hold a
+// treasures.dat. Returns the count or STORE_ERR_IO; free with
+// store_free_hunts.
+int store_list_hunts(char ***names);
+void store_free_hunts(char **names, int count);
+
+// Sequential reader over the live records of a hunt. The committed part of
+// the file is mmap()ed and records are returned in place without copying;
+// files that cannot be mapped fall back to chunked preads into a buffer.
+// Returned pointers stay valid until the next call.
+#define SCAN_CHUNK 1024
+
+typedef struct {
+    int fd;
+    TreasureFileHeader hdr;     // snapshot: later appends are not seen
+    uint64_t first;             // first slot scanned
+    const Treasure *records;    // mapped records from <first>, NULL in buffered mode
+    void *map;
+    size_t map_len;
+    Treasure *buf;
+    uint64_t buf_start;
+    uint64_t buf_count;
+    uint64_t next;
+    int error;                  // STORE_OK, or why the scan stopped early
+} StoreScan;
+
+// Fails with STORE_ERR_TRUNCATED if the file lacks records hdr counts
+int store_scan_open(StoreScan *s, int fd, const TreasureFileHeader *hdr);
+// Same, starting at slot <first>; only that part of the file is mapped
+int store_scan_open_at(StoreScan *s, int fd, const TreasureFileHeader *hdr, uint64_t first);
+// Next live record, or NULL at the end or on a read error; slot (may be
+// NULL) gets its index
+const Treasure *store_scan_next(StoreScan *s, uint64_t *slot);
+// STORE_OK if the scan reached the end, else the error that stopped it;
+// check it after the loop before trusting what was read
+int store_scan_error(const StoreScan *s);
+void store_scan_close(StoreScan *s);
+
+// ID -> record slot hash index kept in <hunt>/treasures.idx. It is stamped
+// with the data file's generation and record count, and rebuilt whenever
+// they no longer match. Callers hold the data file lock (exclusive for
+// index_rebuild/index_insert).
+#define INDEX_FILE "treasures.idx"
+#define INDEX_MAGIC "TRIX"
+#define INDEX_VERSION 1
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t capacity;      // power of two
+    uint64_t entry_count;
+    uint64_t data_generation;
+    uint64_t data_record_count;
+    uint8_t reserved[24];
+} TreasureIndexHeader;
+
+typedef struct {
+    int32_t id;
+    uint32_t state;         // INDEX_SLOT_*
+    uint64_t slot;
+} TreasureIndexEntry;
+
+#define INDEX_SLOT_EMPTY 0
+#define INDEX_SLOT_USED 1
+#define INDEX_SLOT_DELETED 2
+
+// Opens the index if it matches hdr, else returns STORE_ERR_NOT_FOUND
+int index_open(const char *hunt_id, const TreasureFileHeader *hdr, int writable, TreasureIndexHeader *ih);
+int index_rebuild(const char *hunt_id, int data_fd, const TreasureFileHeader *hdr);
+// index_open, rebuilding the index first if it is stale (exclusive lock held)
+int index_open_current(const char *hunt_id, int data_fd, const TreasureFileHeader *hdr, TreasureIndexHeader *ih);
+int index_find(int idx_fd, const TreasureIndexHeader *ih, int32_t id, uint64_t *slot);
+// Returns STORE_ERR_FORMAT when the table is too full and must be rebuilt
+int index_insert(int idx_fd, TreasureIndexHeader *ih, int32_t id, uint64_t slot);
+int index_delete(int idx_fd, TreasureIndexHeader *ih, int32_t id);
+int index_stamp(int idx_fd, TreasureIndexHeader *ih, const TreasureFileHeader *hdr);
+
+// Spatial grid over record coordinates kept in <hunt>/treasures.grid. The
+// globe is cut into GRID_ROWS x GRID_COLS cells and the file lists, cell by
+// cell, the coordinates and slot of every record, so a location query reads
+// only the cells it overlaps and then the matching records. Records
+// appended after the grid was built are checked by scanning that tail; the
+// grid is rebuilt once the tail grows past GRID_MAX_TAIL or the file's
+// epoch changes (remove, compact). Hunts with fewer than GRID_MIN_RECORDS
+// records get no grid: the cell table alone is about 500 KB, and scanning
+// them is faster than reading it.
+#define GRID_FILE "treasures.grid"
+#define GRID_MAGIC "TRGD"
+#define GRID_VERSION 1
+#define GRID_ROWS 180           // one degree of latitude per row
+#define GRID_COLS 360           // one degree of longitude per column
+#define GRID_MAX_TAIL 4096
+#define GRID_MIN_RECORDS 4096
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t rows;
+    uint32_t cols;
+    uint64_t entry_count;
+    uint64_t data_epoch;
+    uint64_t data_record_count; // records [0, data_record_count) are in the grid
+    uint8_t reserved[24];
+} TreasureGridHeader;
+
+// The header is followed by rows * cols + 1 uint64_t cell start offsets
+// (into the entry array) and then the entries themselves
+typedef struct {
+    double latitude;
+    double longitude;
+    uint64_t slot;
+} TreasureGridEntry;
+
+_Static_assert(sizeof(TreasureGridHeader) == 64, "TreasureGridHeader must stay 64 bytes");
+
+// A bounding box, or a radius around a point (near != 0). lon_min may be
+// greater than lon_max for boxes crossing the antimeridian.
+typedef struct {
+    double lat_min, lat_max;
+    double lon_min, lon_max;
+    int near;
+    double lat, lon, radius_km;
+} GeoQuery;
+
+typedef struct {
+    Treasure t;
+    double distance_km;         // from the query point, 0 for boxes
+} GeoMatch;
+
+void geo_query_bbox(GeoQuery *q, double lat_min, double lon_min, double lat_max, double lon_max);
+void geo_query_near(GeoQuery *q, double lat, double lon, double radius_km);
+// Great-circle distance between two points
+double geo_distance_km(double lat1, double lon1, double lat2, double lon2);
+
+// Live treasures matching q, nearest first for radius queries and in file
+// order for boxes. *matches is malloc()ed; the grid is rebuilt if stale.
+int store_geo_query(int fd, const char *hunt_id, TreasureFileHeader *hdr, const GeoQuery *q,
+                    GeoMatch **matches, size_t *count);
+
+// Columnar snapshot of a hunt in <hunt>/columns/: one file per field of
+// the live records, so analytics read only the columns they use. Usernames
+// are dictionary-encoded (user.col holds the records' user IDs and
+// users.dict a copy of the hunt's users.dat names) and clues are stored as
+// offsets plus a blob. Every file starts with a ColumnFileHeader carrying
+// the snapshot ID from columns.meta; a file from another snapshot is never
+// mixed in. Like the other sidecars the snapshot covers a prefix of
+// treasures.dat and goes stale when the file's epoch changes.
+#define COLUMNS_DIR "columns"
+#define COLUMNS_MAGIC "TRCL"
+#define COLUMNS_VERSION 1
+
+typedef enum {
+    COL_ID,             // int32_t
+    COL_VALUE,          // int32_t
+    COL_LATITUDE,       // double
+    COL_LONGITUDE,      // double
+    COL_USER,           // uint32_t user ID, an index into COL_USERS
+    COL_USERS,          // char[USERNAME_MAX] per distinct user
+    COL_CLUE_OFFSETS,   // uint64_t, rows + 1 of them
+    COL_CLUES,          // NUL-terminated clues back to back
+    COL_COUNT
+} ColumnKind;
+
+#define COL_MASK(kind) (1u << (kind))
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t snapshot_id;
+    uint64_t rows;              // live records in the snapshot
+    uint64_t data_epoch;
+    uint64_t data_record_count; // records [0, data_record_count) are covered
+    uint64_t elements;          // entries in this column file
+    uint32_t kind;
+    uint8_t reserved[12];
+} ColumnFileHeader;
+
+_Static_assert(sizeof(ColumnFileHeader) == 64, "ColumnFileHeader must stay 64 bytes");
+
+typedef struct {
+    ColumnFileHeader meta;
+    const void *data[COL_COUNT];    // mapped columns, NULL unless requested
+    uint64_t elements[COL_COUNT];
+    void *maps[COL_COUNT];
+    size_t map_lens[COL_COUNT];
+} ColumnSnapshot;
+
+// Writes a fresh snapshot of the hunt's live records
+int store_export_columns(int fd, const char *hunt_id, TreasureFileHeader *hdr);
+// Maps the columns in mask if the snapshot still matches hdr (same epoch,
+// a prefix of the records), else STORE_ERR_NOT_FOUND
+int columns_open(ColumnSnapshot *cs, const char *hunt_id, const TreasureFileHeader *hdr, unsigned mask);
+void columns_close(ColumnSnapshot *cs);
+// Deletes the snapshot directory of a hunt
+void columns_remove(const char *hunt_id);
+
+#endif
@@ -0,0 +1,288 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "treasure.h"
+
+#define META_FILE "columns.meta"
+#define WRITE_BUFFER (64 * 1024)
+
+static const char *column_files[COL_COUNT] = {
+    "id.col", "value.col", "latitude.col", "longitude.col",
+    "user.col", "users.dict", "clue_offsets.col", "clues.col",
+};
+
+static void column_path(char *buf, size_t size, const char *hunt_id, const char *name) {
+    snprintf(buf, size, "%s/%s/%s", hunt_id, COLUMNS_DIR, name);
+}
+
+// One column being written: a temporary file filled through a buffer
+typedef struct {
+    FILE *f;
+    char tmp_path[512];
+    uint64_t elements;
+} ColumnWriter;
+
+static int writer_open(ColumnWriter *w, const char *hunt_id, const char *name) {
+    column_path(w->tmp_path, sizeof(w->tmp_path), hunt_id, name);
+    strncat(w->tmp_path, ".XXXXXX", sizeof(w->tmp_path) - strlen(w->tmp_path) - 1);
+    w->elements = 0;
+    int fd = mkstemp(w->tmp_path);
+    if (fd < 0)
+        return STORE_ERR_IO;
+    fchmod(fd, 0644);
+    w->f = fdopen(fd, "w");
+    if (!w->f) {
+        close(fd);
+        unlink(w->tmp_path);
+        return STORE_ERR_IO;
+    }
+    setvbuf(w->f, NULL, _IOFBF, WRITE_BUFFER);
+    // Room for the header, filled in once the row count is known
+    ColumnFileHeader blank;
+    memset(&blank, 0, sizeof(blank));
+    return fwrite(&blank, sizeof(blank), 1, w->f) == 1 ? STORE_OK : STORE_ERR_IO;
+}
+
+static int writer_put(ColumnWriter *w, const void *p, size_t size) {
+    w->elements++;
+    return fwrite(p, size, 1, w->f) == 1 ? STORE_OK : STORE_ERR_IO;
+}
+
+static int writer_finish(ColumnWriter *w, const ColumnFileHeader *meta, ColumnKind kind) {
+    ColumnFileHeader h = *meta;
+    h.elements = w->elements;
+    h.kind = kind;
+    int ok = fflush(w->f) == 0 && pwrite(fileno(w->f), &h, sizeof(h), 0) == sizeof(h);
+    ok = fclose(w->f) == 0 && ok;
+    w->f = NULL;
+    return ok ? STORE_OK : STORE_ERR_IO;
+}
+
+static void writer_abort(ColumnWriter *w) {
+    if (w->f)
+        fclose(w->f);
+    w->f = NULL;
+    unlink(w->tmp_path);
+}
+
+static uint64_t new_snapshot_id(const TreasureFileHeader *hdr) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec) ^ (hdr->generation << 32) ^ (uint64_t)getpid();
+}
+
+int store_export_columns(int fd, const char *hunt_id, TreasureFileHeader *hdr) {
+    char dir[512];
+    hunt_path(dir, sizeof(dir), hunt_id, COLUMNS_DIR);
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+        return STORE_ERR_IO;
+    if (store_lock_current(fd, hunt_id, 0) < 0)
+        return STORE_ERR_IO;
+
+    ColumnWriter w[COL_COUNT];
+    UserDict users;
+    memset(w, 0, sizeof(w));
+    memset(&users, 0, sizeof(users));
+    users.fd = -1;
+    StoreScan scan;
+    int scan_open = 0;
+    int rc = store_read_header(fd, hdr);
+    // Loaded after the header, so it names every user of the scanned records
+    if (rc == STORE_OK)
+        rc = user_dict_open(&users, hunt_id, 0);
+    for (int k = 0; rc == STORE_OK && k < COL_COUNT; k++)
+        rc = writer_open(&w[k], hunt_id, column_files[k]);
+    if (rc == STORE_OK) {
+        rc = store_scan_open(&scan, fd, hdr);
+        scan_open = rc == STORE_OK;
+    }
+
+    uint64_t clue_offset = 0;
+    const Treasure *t;
+    while (rc == STORE_OK && (t = store_scan_next(&scan, NULL)) != NULL) {
+        if (t->user_id >= users.count) {
+            rc = STORE_ERR_FORMAT;
+            break;
+        }
+        size_t clue_len = strnlen(t->clue, CLUE_MAX - 1);
+        rc = writer_put(&w[COL_ID], &t->id, sizeof(t->id));
+        if (rc == STORE_OK)
+            rc = writer_put(&w[COL_VALUE], &t->value, sizeof(t->value));
+        if (rc == STORE_OK)
+            rc = writer_put(&w[COL_LATITUDE], &t->latitude, sizeof(t->latitude));
+        if (rc == STORE_OK)
+            rc = writer_put(&w[COL_LONGITUDE], &t->longitude, sizeof(t->longitude));
+        if (rc == STORE_OK)
+            rc = writer_put(&w[COL_USER], &t->user_id, sizeof(t->user_id));
+        if (rc == STORE_OK)
+            rc = writer_put(&w[COL_CLUE_OFFSETS], &clue_offset, sizeof(clue_offset));
+        if (rc == STORE_OK && fwrite(t->clue, clue_len, 1, w[COL_CLUES].f) != 1 && clue_len > 0)
+            rc = STORE_ERR_IO;
+        if (rc == STORE_OK && fputc('\0', w[COL_CLUES].f) == EOF)
+            rc = STORE_ERR_IO;
+        clue_offset += clue_len + 1;
+        w[COL_CLUES].elements = clue_offset;
+    }
+    if (rc == STORE_OK)
+        rc = store_scan_error(&scan);
+    if (rc == STORE_OK)
+        rc = writer_put(&w[COL_CLUE_OFFSETS], &clue_offset, sizeof(clue_offset));
+    w[COL_CLUES].elements = clue_offset;
+    for (uint64_t i = 0; rc == STORE_OK && i < users.count; i++)
+        rc = writer_put(&w[COL_USERS], users.names[i], USERNAME_MAX);
+
+    ColumnFileHeader meta;
+    memset(&meta, 0, sizeof(meta));
+    memcpy(meta.magic, COLUMNS_MAGIC, sizeof(meta.magic));
+    meta.version = COLUMNS_VERSION;
+    meta.snapshot_id = new_snapshot_id(hdr);
+    meta.rows = w[COL_ID].elements;
+    meta.data_epoch = hdr->epoch;
+    meta.data_record_count = scan_open ? scan.hdr.record_count : 0;
+    if (scan_open)
+        store_scan_close(&scan);
+    store_unlock(fd);
+    user_dict_close(&users);
+
+    for (int k = 0; rc == STORE_OK && k < COL_COUNT; k++)
+        rc = writer_finish(&w[k], &meta, (ColumnKind)k);
+    if (rc != STORE_OK) {
+        int saved = errno;
+        for (int k = 0; k < COL_COUNT; k++)
+            writer_abort(&w[k]);
+        errno = saved;
+        return rc;
+    }
+
+    // Columns first, the meta file last: readers compare every column's
+    // snapshot ID with the meta file's
+    char path[512];
+    for (int k = 0; k < COL_COUNT; k++) {
+        column_path(path, sizeof(path), hunt_id, column_files[k]);
+        if (rc == STORE_OK && rename(w[k].tmp_path, path) < 0)
+            rc = STORE_ERR_IO;
+        if (rc != STORE_OK)
+            unlink(w[k].tmp_path);
+    }
+    if (rc != STORE_OK)
+        return rc;
+
+    char tmp_path[512];
+    column_path(path, sizeof(path), hunt_id, META_FILE);
+    column_path(tmp_path, sizeof(tmp_path), hunt_id, META_FILE ".XXXXXX");
+    int meta_fd = mkstemp(tmp_path);
+    if (meta_fd < 0)
+        return STORE_ERR_IO;
+    fchmod(meta_fd, 0644);
+    if (write(meta_fd, &meta, sizeof(meta)) != sizeof(meta) || rename(tmp_path, path) < 0)
+        rc = STORE_ERR_IO;
+    close(meta_fd);
+    if (rc != STORE_OK)
+        unlink(tmp_path);
+    return rc;
+}
+
+void columns_remove(const char *hunt_id) {
+    char path[512];
+    column_path(path, sizeof(path), hunt_id, META_FILE);
+    unlink(path);
+    for (int k = 0; k < COL_COUNT; k++) {
+        column_path(path, sizeof(path), hunt_id, column_files[k]);
+        unlink(path);
+    }
+    hunt_path(path, sizeof(path), hunt_id, COLUMNS_DIR);
+    rmdir(path);
+}
+
+// Expected element size of each column, 1 for the clue blob
+static size_t element_size(ColumnKind kind) {
+    switch (kind) {
+    case COL_ID:
+    case COL_VALUE:
+        return sizeof(int32_t);
+    case COL_LATITUDE:
+    case COL_LONGITUDE:
+        return sizeof(double);
+    case COL_USER:
+        return sizeof(uint32_t);
+    case COL_USERS:
+        return USERNAME_MAX;
+    case COL_CLUE_OFFSETS:
+        return sizeof(uint64_t);
+    default:
+        return 1;
+    }
+}
+
+void columns_close(ColumnSnapshot *cs) {
+    for (int k = 0; k < COL_COUNT; k++)
+        if (cs->maps[k])
+            munmap(cs->maps[k], cs->map_lens[k]);
+    memset(cs, 0, sizeof(*cs));
+}
+
+static int map_column(ColumnSnapshot *cs, const char *hunt_id, ColumnKind kind) {
+    char path[512];
+    column_path(path, sizeof(path), hunt_id, column_files[kind]);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return errno == ENOENT ? STORE_ERR_NOT_FOUND : STORE_ERR_IO;
+    struct stat st;
+    ColumnFileHeader h;
+    int rc = STORE_ERR_NOT_FOUND;
+    if (fstat(fd, &st) == 0 && pread(fd, &h, sizeof(h), 0) == sizeof(h) &&
+        h.snapshot_id == cs->meta.snapshot_id && h.kind == (uint32_t)kind &&
+        (uint64_t)st.st_size == sizeof(h) + h.elements * element_size(kind)) {
+        cs->map_lens[kind] = (size_t)st.st_size;
+        void *map = mmap(NULL, cs->map_lens[kind], PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            rc = STORE_ERR_IO;
+        } else {
+            madvise(map, cs->map_lens[kind], MADV_SEQUENTIAL);
+            cs->maps[kind] = map;
+            cs->data[kind] = (const char *)map + sizeof(h);
+            cs->elements[kind] = h.elements;
+            rc = STORE_OK;
+        }
+    }
+    close(fd);
+    return rc;
+}
+
+int columns_open(ColumnSnapshot *cs, const char *hunt_id, const TreasureFileHeader *hdr, unsigned mask) {
+    memset(cs, 0, sizeof(*cs));
+    char path[512];
+    column_path(path, sizeof(path), hunt_id, META_FILE);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return errno == ENOENT ? STORE_ERR_NOT_FOUND : STORE_ERR_IO;
+    ssize_t n = pread(fd, &cs->meta, sizeof(cs->meta), 0);
+    close(fd);
+    if (n != sizeof(cs->meta) || memcmp(cs->meta.magic, COLUMNS_MAGIC, sizeof(cs->meta.magic)) != 0 ||
+        cs->meta.version != COLUMNS_VERSION || cs->meta.data_epoch != hdr->epoch ||
+        cs->meta.data_record_count > hdr->record_count)
+        return STORE_ERR_NOT_FOUND;
+
+    for (int k = 0; k < COL_COUNT; k++) {
+        if (!(mask & COL_MASK(k)))
+            continue;
+        int rc = map_column(cs, hunt_id, (ColumnKind)k);
+        // Row columns must hold exactly one entry per snapshot row
+        if (rc == STORE_OK && k != COL_USERS && k != COL_CLUES &&
+            cs->elements[k] != cs->meta.rows + (k == COL_CLUE_OFFSETS))
+            rc = STORE_ERR_NOT_FOUND;
+        if (rc != STORE_OK) {
+            columns_close(cs);
+            return rc;
+        }
+    }
+    return STORE_OK;
+}
@@ -0,0 +1,397 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "treasure.h"
+
+#define EARTH_RADIUS_KM 6371.0
+#define DEG_TO_RAD (M_PI / 180.0)
+
+// A grid either mapped from treasures.grid or just built in memory; both
+// use the file layout
+typedef struct {
+    const TreasureGridHeader *hdr;
+    const uint64_t *starts;
+    const TreasureGridEntry *entries;
+    void *map;
+    size_t map_len;
+    void *owned;
+} Grid;
+
+static size_t grid_size(uint64_t cells, uint64_t entries) {
+    return sizeof(TreasureGridHeader) + (cells + 1) * sizeof(uint64_t) + entries * sizeof(TreasureGridEntry);
+}
+
+static void grid_attach(Grid *g, const void *base) {
+    g->hdr = base;
+    g->starts = (const uint64_t *)((const char *)base + sizeof(TreasureGridHeader));
+    g->entries = (const TreasureGridEntry *)(g->starts + (uint64_t)g->hdr->rows * g->hdr->cols + 1);
+}
+
+static void grid_close(Grid *g) {
+    if (g->map)
+        munmap(g->map, g->map_len);
+    free(g->owned);
+    memset(g, 0, sizeof(*g));
+}
+
+// NaN (never stored, but cheap to rule out) lands in cell 0 instead of
+// reaching the undefined (uint32_t) conversion
+static uint32_t grid_row(double lat, uint32_t rows) {
+    double r = floor((lat + 90.0) * rows / 180.0);
+    return !(r >= 0) ? 0 : r >= rows ? rows - 1 : (uint32_t)r;
+}
+
+static uint32_t grid_col(double lon, uint32_t cols) {
+    double c = floor((lon + 180.0) * cols / 360.0);
+    return !(c >= 0) ? 0 : c >= cols ? cols - 1 : (uint32_t)c;
+}
+
+static size_t grid_cell(const Treasure *t) {
+    return (size_t)grid_row(t->latitude, GRID_ROWS) * GRID_COLS + grid_col(t->longitude, GRID_COLS);
+}
+
+// Maps the grid if it covers a prefix of this data file, else
+// STORE_ERR_NOT_FOUND
+static int grid_open(const char *hunt_id, const TreasureFileHeader *hdr, Grid *g) {
+    char path[512];
+    hunt_path(path, sizeof(path), hunt_id, GRID_FILE);
+    memset(g, 0, sizeof(*g));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return errno == ENOENT ? STORE_ERR_NOT_FOUND : STORE_ERR_IO;
+
+    struct stat st;
+    int rc = STORE_ERR_NOT_FOUND;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(TreasureGridHeader)) {
+        g->map_len = (size_t)st.st_size;
+        g->map = mmap(NULL, g->map_len, PROT_READ, MAP_SHARED, fd, 0);
+        if (g->map == MAP_FAILED) {
+            g->map = NULL;
+            rc = STORE_ERR_IO;
+        }
+    }
+    close(fd);
+    if (!g->map)
+        return rc;
+
+    const TreasureGridHeader *gh = g->map;
+    if (memcmp(gh->magic, GRID_MAGIC, sizeof(gh->magic)) != 0 || gh->version != GRID_VERSION ||
+        gh->rows != GRID_ROWS || gh->cols != GRID_COLS ||
+        g->map_len != grid_size((uint64_t)gh->rows * gh->cols, gh->entry_count) ||
+        gh->data_epoch != hdr->epoch || gh->data_record_count > hdr->record_count ||
+        hdr->record_count - gh->data_record_count > GRID_MAX_TAIL) {
+        grid_close(g);
+        return STORE_ERR_NOT_FOUND;
+    }
+    grid_attach(g, g->map);
+    return STORE_OK;
+}
+
+// Builds the grid of every live record with a counting sort over the cells
+// (two passes over the mapped file), then saves it through a temporary file.
+// Only a shared lock is needed: concurrent builders each rename a complete
+// file into place.
+static int grid_build(const char *hunt_id, int fd, const TreasureFileHeader *hdr, Grid *g) {
+    const size_t cells = (size_t)GRID_ROWS * GRID_COLS;
+    uint64_t *cursor = calloc(cells + 1, sizeof(uint64_t));
+    if (!cursor) {
+        errno = ENOMEM;
+        return STORE_ERR_IO;
+    }
+
+    StoreScan scan;
+    const Treasure *t;
+    uint64_t entries = 0;
+    int rc = store_scan_open(&scan, fd, hdr);
+    if (rc == STORE_OK) {
+        while ((t = store_scan_next(&scan, NULL)) != NULL) {
+            cursor[grid_cell(t) + 1]++;
+            entries++;
+        }
+        rc = store_scan_error(&scan);
+    }
+    char *block = rc == STORE_OK ? calloc(1, grid_size(cells, entries)) : NULL;
+    if (rc == STORE_OK && !block) {
+        errno = ENOMEM;
+        rc = STORE_ERR_IO;
+    }
+    if (rc != STORE_OK) {
+        store_scan_close(&scan);
+        free(cursor);
+        return rc;
+    }
+
+    TreasureGridHeader *gh = (TreasureGridHeader *)block;
+    memcpy(gh->magic, GRID_MAGIC, sizeof(gh->magic));
+    gh->version = GRID_VERSION;
+    gh->rows = GRID_ROWS;
+    gh->cols = GRID_COLS;
+    gh->entry_count = entries;
+    gh->data_epoch = hdr->epoch;
+    gh->data_record_count = scan.hdr.record_count;
+    for (size_t c = 1; c <= cells; c++)
+        cursor[c] += cursor[c - 1];
+    grid_attach(g, block);
+    memcpy((uint64_t *)g->starts, cursor, (cells + 1) * sizeof(uint64_t));
+
+    TreasureGridEntry *out = (TreasureGridEntry *)g->entries;
+    uint64_t slot;
+    store_scan_close(&scan);
+    rc = store_scan_open(&scan, fd, hdr);
+    while (rc == STORE_OK && (t = store_scan_next(&scan, &slot)) != NULL) {
+        TreasureGridEntry *e = &out[cursor[grid_cell(t)]++];
+        e->latitude = t->latitude;
+        e->longitude = t->longitude;
+        e->slot = slot;
+    }
+    if (rc == STORE_OK)
+        rc = store_scan_error(&scan);
+    store_scan_close(&scan);
+    free(cursor);
+    if (rc != STORE_OK) {
+        free(block);
+        memset(g, 0, sizeof(*g));
+        return rc;
+    }
+    g->owned = block;
+
+    char path[512], tmp_path[512];
+    hunt_path(path, sizeof(path), hunt_id, GRID_FILE);
+    hunt_path(tmp_path, sizeof(tmp_path), hunt_id, GRID_FILE ".XXXXXX");
+    int tmp_fd = mkstemp(tmp_path);
+    if (tmp_fd >= 0) {
+        // Only a complete, synced file may be renamed into place; a grid
+        // that cannot be saved still answers this query
+        int ok = fchmod(tmp_fd, 0644) == 0 &&
+                 store_write_full(tmp_fd, block, grid_size(cells, entries), 0) == STORE_OK &&
+                 store_sync(tmp_fd) == STORE_OK;
+        if (close(tmp_fd) < 0)
+            ok = 0;
+        if (!ok || rename(tmp_path, path) < 0)
+            unlink(tmp_path);
+    }
+    return STORE_OK;
+}
+
+double geo_distance_km(double lat1, double lon1, double lat2, double lon2) {
+    double dlat = (lat2 - lat1) * DEG_TO_RAD;
+    double dlon = (lon2 - lon1) * DEG_TO_RAD;
+    double a = sin(dlat / 2) * sin(dlat / 2) +
+               cos(lat1 * DEG_TO_RAD) * cos(lat2 * DEG_TO_RAD) * sin(dlon / 2) * sin(dlon / 2);
+    return 2 * EARTH_RADIUS_KM * asin(sqrt(a < 1 ? a : 1));
+}
+
+void geo_query_bbox(GeoQuery *q, double lat_min, double lon_min, double lat_max, double lon_max) {
+    memset(q, 0, sizeof(*q));
+    q->lat_min = lat_min;
+    q->lat_max = lat_max;
+    q->lon_min = lon_min;
+    q->lon_max = lon_max;
+}
+
+// The box around the circle: latitudes within the angular radius, and
+// longitudes within the widest point of the circle unless it reaches a pole
+void geo_query_near(GeoQuery *q, double lat, double lon, double radius_km) {
+    double angle = radius_km / EARTH_RADIUS_KM;
+    double dlat = angle / DEG_TO_RAD;
+    geo_query_bbox(q, lat - dlat, -180.0, lat + dlat, 180.0);
+    q->near = 1;
+    q->lat = lat;
+    q->lon = lon;
+    q->radius_km = radius_km;
+
+    if (q->lat_min <= -90.0 || q->lat_max >= 90.0 || angle >= M_PI / 2)
+        return;
+    double s = sin(angle) / cos(lat * DEG_TO_RAD);
+    if (s >= 1.0)
+        return;
+    double dlon = asin(s) / DEG_TO_RAD;
+    q->lon_min = lon - dlon;
+    q->lon_max = lon + dlon;
+    if (q->lon_min < -180.0)
+        q->lon_min += 360.0;
+    if (q->lon_max > 180.0)
+        q->lon_max -= 360.0;
+}
+
+// Checks one point; *distance gets its distance for radius queries
+static int geo_match(const GeoQuery *q, double lat, double lon, double *distance) {
+    *distance = 0;
+    if (lat < q->lat_min || lat > q->lat_max)
+        return 0;
+    if (q->lon_min <= q->lon_max ? lon < q->lon_min || lon > q->lon_max
+                                 : lon < q->lon_min && lon > q->lon_max)
+        return 0;
+    if (q->near) {
+        *distance = geo_distance_km(q->lat, q->lon, lat, lon);
+        return *distance <= q->radius_km;
+    }
+    return 1;
+}
+
+typedef struct {
+    uint64_t slot;
+    double distance_km;
+} Candidate;
+
+static int compare_slots(const void *a, const void *b) {
+    uint64_t x = ((const Candidate *)a)->slot, y = ((const Candidate *)b)->slot;
+    return x < y ? -1 : x > y;
+}
+
+static int compare_distance(const void *a, const void *b) {
+    const GeoMatch *x = a, *y = b;
+    if (x->distance_km != y->distance_km)
+        return x->distance_km < y->distance_km ? -1 : 1;
+    return x->t.id < y->t.id ? -1 : x->t.id > y->t.id;
+}
+
+// Growable arrays for candidates and results
+static int reserve(void **items, size_t *capacity, size_t needed, size_t size) {
+    if (needed <= *capacity)
+        return 0;
+    size_t grown = *capacity ? *capacity * 2 : 64;
+    while (grown < needed)
+        grown *= 2;
+    void *p = realloc(*items, grown * size);
+    if (!p) {
+        errno = ENOMEM;
+        return -1;
+    }
+    *items = p;
+    *capacity = grown;
+    return 0;
+}
+
+// Collects the grid entries of cells [c0, c1] in rows [r0, r1] that match
+static int scan_cells(const Grid *g, const GeoQuery *q, uint32_t r0, uint32_t r1, uint32_t c0, uint32_t c1,
+                      Candidate **cand, size_t *count, size_t *capacity) {
+    for (uint32_t r = r0; r <= r1; r++) {
+        // Cells of a row are contiguous, so each row segment is one range
+        uint64_t begin = g->starts[(uint64_t)r * g->hdr->cols + c0];
+        uint64_t end = g->starts[(uint64_t)r * g->hdr->cols + c1 + 1];
+        if (end > g->hdr->entry_count)
+            end = g->hdr->entry_count;
+        for (uint64_t i = begin; i < end; i++) {
+            const TreasureGridEntry *e = &g->entries[i];
+            double distance;
+            if (!geo_match(q, e->latitude, e->longitude, &distance))
+                continue;
+            if (reserve((void **)cand, capacity, *count + 1, sizeof(Candidate)) < 0)
+                return STORE_ERR_IO;
+            (*cand)[*count].slot = e->slot;
+            (*cand)[*count].distance_km = distance;
+            (*count)++;
+        }
+    }
+    return STORE_OK;
+}
+
+// Adds the matches among the records in the grid: the entries of the cells
+// the query overlaps are filtered, then the records they point to are read
+static int query_grid(int fd, const TreasureFileHeader *hdr, const Grid *g, const GeoQuery *q,
+                      GeoMatch **matches, size_t *count, size_t *capacity) {
+    Candidate *cand = NULL;
+    size_t ncand = 0, cand_capacity = 0;
+    int rc = STORE_OK;
+    uint32_t r0 = grid_row(q->lat_min, g->hdr->rows), r1 = grid_row(q->lat_max, g->hdr->rows);
+    uint32_t c0 = grid_col(q->lon_min, g->hdr->cols), c1 = grid_col(q->lon_max, g->hdr->cols);
+    if (q->lat_min <= q->lat_max) {
+        if (q->lon_min <= q->lon_max) {
+            rc = scan_cells(g, q, r0, r1, c0, c1, &cand, &ncand, &cand_capacity);
+        } else {
+            rc = scan_cells(g, q, r0, r1, c0, g->hdr->cols - 1, &cand, &ncand, &cand_capacity);
+            if (rc == STORE_OK)
+                rc = scan_cells(g, q, r0, r1, 0, c1, &cand, &ncand, &cand_capacity);
+        }
+    }
+
+    // Matching records are read in slot order
+    if (ncand > 1)
+        qsort(cand, ncand, sizeof(Candidate), compare_slots);
+    for (size_t i = 0; rc == STORE_OK && i < ncand; i++) {
+        Treasure t;
+        rc = store_read_record(fd, hdr, cand[i].slot, &t);
+        if (rc != STORE_OK || treasure_deleted(&t))
+            continue;
+        if (reserve((void **)matches, capacity, *count + 1, sizeof(GeoMatch)) < 0) {
+            rc = STORE_ERR_IO;
+            break;
+        }
+        (*matches)[*count].t = t;
+        (*matches)[*count].distance_km = cand[i].distance_km;
+        (*count)++;
+    }
+    free(cand);
+    return rc;
+}
+
+int store_geo_query(int fd, const char *hunt_id, TreasureFileHeader *hdr, const GeoQuery *q,
+                    GeoMatch **matches, size_t *count) {
+    *matches = NULL;
+    *count = 0;
+    if (store_lock_current(fd, hunt_id, 0) < 0)
+        return STORE_ERR_IO;
+
+    // Small hunts are scanned whole: cheaper than the cell table alone
+    Grid g;
+    memset(&g, 0, sizeof(g));
+    int rc = store_read_header(fd, hdr);
+    int use_grid = rc == STORE_OK && hdr->record_count >= GRID_MIN_RECORDS;
+    if (use_grid) {
+        rc = grid_open(hunt_id, hdr, &g);
+        if (rc == STORE_ERR_NOT_FOUND)
+            rc = grid_build(hunt_id, fd, hdr, &g);
+    }
+    if (rc != STORE_OK) {
+        store_unlock(fd);
+        return rc;
+    }
+
+    size_t capacity = 0;
+    uint64_t scan_from = use_grid ? g.hdr->data_record_count : 0;
+    if (use_grid)
+        rc = query_grid(fd, hdr, &g, q, matches, count, &capacity);
+
+    // Records appended after the grid was built, or all of a small hunt
+    StoreScan scan;
+    if (rc == STORE_OK && scan_from < hdr->record_count &&
+        (rc = store_scan_open_at(&scan, fd, hdr, scan_from)) == STORE_OK) {
+        const Treasure *t;
+        double distance;
+        while ((t = store_scan_next(&scan, NULL)) != NULL) {
+            if (!geo_match(q, t->latitude, t->longitude, &distance))
+                continue;
+            if (reserve((void **)matches, &capacity, *count + 1, sizeof(GeoMatch)) < 0) {
+                rc = STORE_ERR_IO;
+                break;
+            }
+            (*matches)[*count].t = *t;
+            (*matches)[*count].distance_km = distance;
+            (*count)++;
+        }
+        if (rc == STORE_OK)
+            rc = store_scan_error(&scan);
+        store_scan_close(&scan);
+    }
+    grid_close(&g);
+    store_unlock(fd);
+
+    if (rc != STORE_OK) {
+        free(*matches);
+        *matches = NULL;
+        *count = 0;
+        return rc;
+    }
+    if (q->near && *count > 1)
+        qsort(*matches, *count, sizeof(GeoMatch), compare_distance);
+    return STORE_OK;
+}
@@ -7,17 +7,22 @@
 #include <sys/wait.h>
 #include <errno.h>
 #include <signal.h>
-#include <sys/select.h>
+#include <poll.h>
+#include <stdarg.h>
 #include <bits/sigaction.h>
 #include <asm-generic/signal-defs.h>
 
-#define CMD_FILE ".monitor_command"
+#include "monitor_protocol.h"
+#include "metrics.h"
+
 #define READ_END 0
 #define WRITE_END 1
 
 pid_t monitor_pid = -1;
 int monitor_running = 0;
-int pipefd[2]; // Pipe between monitor and treasure_hub
+int pipefd[2] = { -1, -1 }; // Pipe between monitor and treasure_hub
+int cmdfd = -1; // Write end of the monitor's framed command channel
+uint32_t next_request_id = 1;
 
 void handle_sigchld(int sig) {
     int status;
@@ -30,89 +35,303 @@ void handle_sigchld(int sig) {
     }
 }
 
-void send_command(const char *cmd) {
+// Sends a command frame and returns its request ID, or 0 on failure
+uint32_t send_command(const char *cmd) {
     if (!monitor_running) {
         printf("Error: Monitor is not running.\n");
+        return 0;
+    }
+
+    size_t len = strlen(cmd);
+    if (len > FRAME_MAX_PAYLOAD) {
+        printf("Error: command too long.\n");
+        return 0;
+    }
+    uint32_t request_id = next_request_id++;
+    if (frame_write(cmdfd, request_id, FRAME_COMMAND, cmd, (uint32_t)len) < 0) {
+        perror("Cannot send command to monitor");
+        return 0;
+    }
+    return request_id;
+}
+
+// Commands sent to the monitor whose response has not fully arrived yet.
+// Several can be in flight; each response is buffered until its FRAME_END
+// and printed as one block, tagged with its request ID when others were
+// outstanding at the same time. Cross-hunt queries are streamed instead:
+// each data frame (one hunt's matches) is printed as it arrives.
+typedef struct {
+    uint32_t request_id;
+    char command[64];
+    int tagged;
+    char *output;
+    size_t length;
+    size_t capacity;
+    uint64_t sent_ns;
+    char *dump_path;            // stats --prometheus: written here, not printed
+    int stream;
+} PendingRequest;
+
+// Time from sending each command to the end of its response
+MetricsTable round_trips;
+
+// Request whose output was printed last, so a streamed response is only
+// tagged again when another one came in between
+uint32_t last_printed = 0;
+
+PendingRequest *pending = NULL;
+int pending_count = 0;
+int pending_capacity = 0;
+
+void add_pending(uint32_t request_id, const char *cmd) {
+    if (request_id == 0)
         return;
+    if (pending_count == pending_capacity) {
+        int capacity = pending_capacity ? pending_capacity * 2 : 8;
+        PendingRequest *grown = realloc(pending, (size_t)capacity * sizeof(PendingRequest));
+        if (!grown) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+        pending = grown;
+        pending_capacity = capacity;
+    }
+    for (int i = 0; i < pending_count; i++)
+        pending[i].tagged = 1;
+
+    PendingRequest *p = &pending[pending_count++];
+    memset(p, 0, sizeof(*p));
+    p->request_id = request_id;
+    p->tagged = pending_count > 1;
+    snprintf(p->command, sizeof(p->command), "%s", cmd);
+    p->sent_ns = metrics_now_ns();
+    p->stream = strncmp(cmd, "find_treasure ", 14) == 0 || strncmp(cmd, "user_treasures ", 15) == 0;
+}
+
+PendingRequest *find_pending(uint32_t request_id) {
+    for (int i = 0; i < pending_count; i++)
+        if (pending[i].request_id == request_id)
+            return &pending[i];
+    return NULL;
+}
+
+void append_output(PendingRequest *p, const char *data, size_t len) {
+    if (p->length + len > p->capacity) {
+        size_t capacity = p->capacity ? p->capacity : 4096;
+        while (capacity < p->length + len)
+            capacity *= 2;
+        char *grown = realloc(p->output, capacity);
+        if (!grown) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+        p->output = grown;
+        p->capacity = capacity;
     }
+    memcpy(p->output + p->length, data, len);
+    p->length += len;
+}
+
+static void print_out(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+}
+
+static FILE *metrics_file = NULL;
 
-    int fd = open(CMD_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd < 0) {
-        perror("Cannot write command file");
+static void file_out(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(metrics_file, fmt, ap);
+    va_end(ap);
+}
+
+// The hub's round trips followed by the monitor's own metrics (if any), in
+// Prometheus text format; replaced through a temporary file so a scraper
+// never reads half of it
+void write_metrics(const char *path, const char *monitor_text, size_t length) {
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    metrics_file = fopen(tmp_path, "w");
+    if (!metrics_file) {
+        perror("Cannot write metrics");
         return;
     }
-    write(fd, cmd, strlen(cmd));
-    close(fd);
+    metrics_prometheus(&round_trips, "treasure_hub", "round_trip", 0, file_out);
+    if (length > 0)
+        fwrite(monitor_text, 1, length, metrics_file);
+    int failed = ferror(metrics_file);
+    if (fclose(metrics_file) != 0 || failed || rename(tmp_path, path) < 0) {
+        perror("Cannot write metrics");
+        unlink(tmp_path);
+    } else {
+        printf("Metrics written to %s\n", path);
+    }
+    metrics_file = NULL;
+}
 
-    kill(monitor_pid, SIGUSR1);
+void finish_pending(PendingRequest *p) {
+    metrics_record(&round_trips, metric_kind(p->command), metrics_now_ns() - p->sent_ns, NULL);
+    if (p->tagged && !p->stream)
+        printf("[#%u] %s\n", p->request_id, p->command);
+    last_printed = p->request_id;
+    if (p->dump_path)
+        write_metrics(p->dump_path, p->output, p->length);
+    else if (p->length > 0)
+        fwrite(p->output, 1, p->length, stdout);
+    fflush(stdout);
+    free(p->output);
+    free(p->dump_path);
+    *p = pending[--pending_count];
 }
 
-#include <fcntl.h>
-#include <sys/select.h>
+void drop_pending() {
+    for (int i = 0; i < pending_count; i++) {
+        free(pending[i].output);
+        free(pending[i].dump_path);
+    }
+    pending_count = 0;
+}
 
-void read_monitor_output() {
-    char buffer[512];
-    ssize_t n;
-    fd_set readfds;
-    struct timeval tv;
+// Reads and dispatches one frame from the monitor. Returns 0 once the
+// monitor has gone away.
+int read_monitor_frame() {
+    FrameHeader hdr;
+    static char buffer[FRAME_MAX_DATA + 1];
 
-    // Set pipe read end to non-blocking mode
-    int flags = fcntl(pipefd[READ_END], F_GETFL, 0);
-    fcntl(pipefd[READ_END], F_SETFL, flags | O_NONBLOCK);
+    int rc = frame_read(pipefd[READ_END], &hdr, buffer, sizeof(buffer));
+    if (rc <= 0) {
+        if (rc < 0)
+            perror("read error");
+        // EOF on pipe - monitor exited
+        monitor_running = 0;
+        drop_pending();
+        return 0;
+    }
 
-    while (1) {
-        FD_ZERO(&readfds);
-        FD_SET(pipefd[READ_END], &readfds);
-        tv.tv_sec = 0;
-        tv.tv_usec = 200000; // 200 ms timeout
-
-        int ret = select(pipefd[READ_END] + 1, &readfds, NULL, NULL, &tv);
-
-        if (ret > 0 && FD_ISSET(pipefd[READ_END], &readfds)) {
-            n = read(pipefd[READ_END], buffer, sizeof(buffer) - 1);
-            if (n > 0) {
-                buffer[n] = '\0';
-                printf("%s", buffer);
-                fflush(stdout);
-            } else if (n == 0) {
-                // EOF on pipe - monitor probably exited
-                monitor_running = 0;
-                break;
-            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                perror("read error");
-                break;
-            }
+    PendingRequest *p = find_pending(hdr.request_id);
+    if (hdr.type == FRAME_DATA) {
+        if (p && p->stream) {
+            if (p->tagged && last_printed != p->request_id)
+                printf("[#%u] %s\n", p->request_id, p->command);
+            fwrite(buffer, 1, hdr.length, stdout);
+            fflush(stdout);
+            last_printed = p->request_id;
+        } else if (p) {
+            append_output(p, buffer, hdr.length);
         } else {
-            // No more data available or timeout
-            break;
+            fwrite(buffer, 1, hdr.length, stdout);
+            fflush(stdout);
         }
+    } else if (hdr.type == FRAME_END && p) {
+        finish_pending(p);
     }
+    return 1;
+}
 
-    // Restore blocking mode if desired
-    fcntl(pipefd[READ_END], F_SETFL, flags);
+// Blocks until every outstanding response has been printed
+void wait_pending() {
+    while (pending_count > 0 && read_monitor_frame())
+        ;
 }
 
-void calculate_score(const char *hunt_id) {
-    if (!monitor_running) {
-        printf("Error: Monitor is not running.\n");
+void start_monitor() {
+    if (monitor_running) {
+        printf("Monitor already running.\n");
         return;
     }
 
-    pid_t pid = fork();
-    if (pid < 0) {
-        perror("fork failed");
-        return;
+    int cmdpipe[2];
+    if (pipefd[READ_END] >= 0)
+        close(pipefd[READ_END]);
+    if (pipe(pipefd) == -1 || pipe(cmdpipe) == -1) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
     }
 
-    if (pid == 0) {
-        // Child process: just exec calculate_score program and print output to stdout directly
-        execl("./calculate_score", "calculate_score", hunt_id, NULL);
-        perror("Failed to exec calculate_score");
+    monitor_pid = fork();
+    if (monitor_pid == 0) {
+        // Child process: duplicate pipe write end to stdout for monitor
+        // and the command pipe read end to its stdin
+        close(pipefd[READ_END]);
+        dup2(pipefd[WRITE_END], STDOUT_FILENO);
+        close(pipefd[WRITE_END]);
+        close(cmdpipe[WRITE_END]);
+        dup2(cmdpipe[READ_END], STDIN_FILENO);
+        close(cmdpipe[READ_END]);
+
+        execl("./monitor", "monitor", NULL);
+        perror("Failed to start monitor");
         exit(1);
+    } else if (monitor_pid > 0) {
+        close(pipefd[WRITE_END]);
+        close(cmdpipe[READ_END]);
+        if (cmdfd >= 0)
+            close(cmdfd);
+        cmdfd = cmdpipe[WRITE_END];
+        monitor_running = 1;
+        printf("Monitor started with PID %d\n", monitor_pid);
     } else {
-        // Parent waits for child
-        waitpid(pid, NULL, 0);
+        perror("fork");
+        exit(1);
+    }
+}
+
+// stats --prometheus <file>: the monitor's part is fetched first; without a
+// monitor only the hub's round trips are written
+void dump_metrics(const char *path) {
+    uint32_t request_id = monitor_running ? send_command("stats --prometheus") : 0;
+    if (request_id == 0) {
+        write_metrics(path, NULL, 0);
+        return;
+    }
+    add_pending(request_id, "stats --prometheus");
+    PendingRequest *p = find_pending(request_id);
+    p->dump_path = strdup(path);
+    if (!p->dump_path) {
+        perror("strdup");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Handles one input line; returns 0 when the hub should exit
+int handle_input(char *input) {
+    if (strcmp(input, "start_monitor") == 0) {
+        start_monitor();
+    } else if (strcmp(input, "stop_monitor") == 0) {
+        add_pending(send_command("stop_monitor"), input);
+    } else if (strcmp(input, "stats") == 0) {
+        // The hub's figures now, the monitor's when its response arrives
+        metrics_print(&round_trips, "Hub round trips", 0, print_out);
+        add_pending(send_command(input), input);
+    } else if (strncmp(input, "stats --prometheus ", 19) == 0) {
+        dump_metrics(input + 19);
+    } else if (strcmp(input, "list_hunts") == 0 ||
+               strncmp(input, "list_treasures ", 15) == 0 ||
+               strncmp(input, "view_treasure ", 14) == 0 ||
+               strncmp(input, "stats ", 6) == 0 ||
+               strncmp(input, "near ", 5) == 0 ||
+               strncmp(input, "bbox ", 5) == 0 ||
+               strncmp(input, "calculate_score ", 16) == 0 ||
+               strncmp(input, "find_treasure ", 14) == 0 ||
+               strncmp(input, "user_treasures ", 15) == 0) {
+        // Sent without waiting: the response is printed when it arrives
+        add_pending(send_command(input), input);
+    } else if (strcmp(input, "wait") == 0) {
+        wait_pending();
+    } else if (strcmp(input, "exit") == 0) {
+        wait_pending();
+        if (monitor_running) {
+            printf("Cannot exit: monitor is still running.\n");
+        } else {
+            return 0;
+        }
+    } else if (input[0] != '\0') {
+        printf("Unknown or invalid command.\n");
     }
+    return 1;
 }
 
 int main() {
@@ -125,68 +344,82 @@ int main() {
         perror("sigaction");
         exit(EXIT_FAILURE);
     }
+    // A dead monitor must not kill the hub through a write on the command pipe
+    signal(SIGPIPE, SIG_IGN);
 
-    if (pipe(pipefd) == -1) {
-        perror("pipe");
-        exit(EXIT_FAILURE);
-    }
-
-    char input[256];
+    // Input is read with read() rather than stdio so poll() sees every
+    // buffered line; commands are sent as soon as they are typed and
+    // responses are printed whenever they complete.
+    char input[4096];
+    size_t input_len = 0;
+    int input_eof = 0;
+    int prompt = 1;
 
     while (1) {
-        printf("hub> ");
-        fflush(stdout);
+        if (prompt && pending_count == 0 && !input_eof) {
+            printf("hub> ");
+            fflush(stdout);
+            prompt = 0;
+        }
 
-        if (!fgets(input, sizeof(input), stdin)) break;
+        // Execute every complete line already buffered
+        char *nl;
+        while ((nl = memchr(input, '\n', input_len)) != NULL) {
+            *nl = '\0';
+            int keep_going = handle_input(input);
+            size_t used = (size_t)(nl - input) + 1;
+            memmove(input, input + used, input_len - used);
+            input_len -= used;
+            prompt = 1;
+            if (!keep_going)
+                return 0;
+        }
+        if (prompt && pending_count == 0 && !input_eof)
+            continue;
 
-        input[strcspn(input, "\n")] = 0;
+        if (input_eof) {
+            if (input_len > 0) {
+                // Last line without a newline
+                input[input_len] = '\0';
+                input_len = 0;
+                if (!handle_input(input))
+                    return 0;
+            }
+            wait_pending();
+            break;
+        }
 
-        if (strcmp(input, "start_monitor") == 0) {
-            if (monitor_running) {
-                printf("Monitor already running.\n");
+        struct pollfd fds[2];
+        int nfds = 0;
+        fds[nfds].fd = STDIN_FILENO;
+        fds[nfds++].events = POLLIN;
+        if (pending_count > 0 || monitor_running) {
+            fds[nfds].fd = pipefd[READ_END];
+            fds[nfds++].events = POLLIN;
+        }
+        if (poll(fds, (nfds_t)nfds, -1) < 0) {
+            if (errno == EINTR)
                 continue;
-            }
+            perror("poll");
+            break;
+        }
 
-            monitor_pid = fork();
-            if (monitor_pid == 0) {
-                // Child process: duplicate pipe write end to stdout for monitor
-                close(pipefd[READ_END]);
-                dup2(pipefd[WRITE_END], STDOUT_FILENO);
-                close(pipefd[WRITE_END]);
-
-                execl("./monitor", "monitor", NULL);
-                perror("Failed to start monitor");
-                exit(1);
-            } else if (monitor_pid > 0) {
-                close(pipefd[WRITE_END]);
-                monitor_running = 1;
-                printf("Monitor started with PID %d\n", monitor_pid);
-            } else {
-                perror("fork");
-                exit(1);
-            }
-        } else if (strcmp(input, "stop_monitor") == 0) {
-            send_command("stop_monitor");
-        } else if (strcmp(input, "list_hunts") == 0) {
-            send_command("list_hunts");
-            read_monitor_output();
-        } else if (strncmp(input, "list_treasures ", 15) == 0) {
-            send_command(input);
-            read_monitor_output();
-        } else if (strncmp(input, "view_treasure ", 14) == 0) {
-            send_command(input);
-            read_monitor_output();
-        } else if (strncmp(input, "calculate_score ", 16) == 0) {
-            char *hunt_id = input + 16;
-            calculate_score(hunt_id);
-        } else if (strcmp(input, "exit") == 0) {
-            if (monitor_running) {
-                printf("Cannot exit: monitor is still running.\n");
+        if (nfds > 1 && (fds[1].revents & (POLLIN | POLLHUP))) {
+            read_monitor_frame();
+            if (pending_count == 0)
+                prompt = 1;
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP)) {
+            ssize_t n = read(STDIN_FILENO, input + input_len, sizeof(input) - 1 - input_len);
+            if (n <= 0) {
+                input_eof = 1;
             } else {
-                break;
+                input_len += (size_t)n;
+                if (input_len == sizeof(input) - 1 && !memchr(input, '\n', input_len)) {
+                    printf("Input line too long, discarded.\n");
+                    input_len = 0;
+                }
             }
-        } else {
-            printf("Unknown or invalid command.\n");
         }
     }
 
@@ -0,0 +1,464 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "treasure.h"
+
+// Entries fetched per pread while probing; a lookup in a table that is at
+// most 70% full almost always ends inside the first chunk.
+#define PROBE_CHUNK 8
+#define MIN_CAPACITY 64
+
+static uint64_t hash_id(int32_t id) {
+    uint64_t h = (uint32_t)id;
+    h ^= h >> 16;
+    h *= 0x45d9f3bULL;
+    h ^= h >> 16;
+    return h * 0x9e3779b97f4a7c15ULL;
+}
+
+static off_t entry_offset(uint64_t pos) {
+    return (off_t)sizeof(TreasureIndexHeader) + (off_t)(pos * sizeof(TreasureIndexEntry));
+}
+
+static int index_full(const TreasureIndexHeader *ih, uint64_t extra) {
+    return (ih->entry_count + extra) * 10 > ih->capacity * 7;
+}
+
+int index_open(const char *hunt_id, const TreasureFileHeader *hdr, int writable, TreasureIndexHeader *ih) {
+    char path[512];
+    hunt_path(path, sizeof(path), hunt_id, INDEX_FILE);
+    int fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if (fd < 0)
+        return errno == ENOENT ? STORE_ERR_NOT_FOUND : STORE_ERR_IO;
+
+    if (pread(fd, ih, sizeof(*ih), 0) != sizeof(*ih) ||
+        memcmp(ih->magic, INDEX_MAGIC, sizeof(ih->magic)) != 0 ||
+        ih->version != INDEX_VERSION ||
+        ih->data_generation != hdr->generation ||
+        ih->data_record_count != hdr->record_count) {
+        close(fd);
+        return STORE_ERR_NOT_FOUND;
+    }
+    return fd;
+}
+
+int index_find(int idx_fd, const TreasureIndexHeader *ih, int32_t id, uint64_t *slot) {
+    uint64_t mask = ih->capacity - 1;
+    uint64_t pos = hash_id(id) & mask;
+    TreasureIndexEntry chunk[PROBE_CHUNK];
+
+    for (uint64_t probed = 0; probed < ih->capacity;) {
+        uint64_t n = ih->capacity - pos;
+        if (n > PROBE_CHUNK)
+            n = PROBE_CHUNK;
+        ssize_t r = pread(idx_fd, chunk, n * sizeof(TreasureIndexEntry), entry_offset(pos));
+        if (r != (ssize_t)(n * sizeof(TreasureIndexEntry)))
+            return STORE_ERR_IO;
+        store_counters.bytes_read += (uint64_t)r;
+        for (uint64_t i = 0; i < n; i++) {
+            if (chunk[i].state == INDEX_SLOT_EMPTY)
+                return STORE_ERR_NOT_FOUND;
+            if (chunk[i].state == INDEX_SLOT_USED && chunk[i].id == id) {
+                *slot = chunk[i].slot;
+                return STORE_OK;
+            }
+        }
+        probed += n;
+        pos = (pos + n) & mask;
+    }
+    return STORE_ERR_NOT_FOUND;
+}
+
+// Finds the table position holding <id>, or where it would be inserted
+// (the first deleted entry on its probe path, else the terminating empty one)
+static int probe_position(int idx_fd, const TreasureIndexHeader *ih, int32_t id,
+                          uint64_t *pos_out, TreasureIndexEntry *e) {
+    uint64_t mask = ih->capacity - 1;
+    uint64_t reuse = UINT64_MAX;
+    for (uint64_t pos = hash_id(id) & mask, probed = 0; probed < ih->capacity;
+         pos = (pos + 1) & mask, probed++) {
+        if (pread(idx_fd, e, sizeof(*e), entry_offset(pos)) != sizeof(*e))
+            return STORE_ERR_IO;
+        if (e->state == INDEX_SLOT_USED && e->id == id) {
+            *pos_out = pos;
+            return STORE_OK;
+        }
+        if (e->state == INDEX_SLOT_DELETED && reuse == UINT64_MAX)
+            reuse = pos;
+        if (e->state == INDEX_SLOT_EMPTY) {
+            *pos_out = reuse != UINT64_MAX ? reuse : pos;
+            return STORE_ERR_NOT_FOUND;
+        }
+    }
+    if (reuse == UINT64_MAX)
+        return STORE_ERR_FORMAT;
+    *pos_out = reuse;
+    return STORE_ERR_NOT_FOUND;
+}
+
+int index_insert(int idx_fd, TreasureIndexHeader *ih, int32_t id, uint64_t slot) {
+    TreasureIndexEntry e;
+    uint64_t pos;
+    int rc = probe_position(idx_fd, ih, id, &pos, &e);
+    if (rc == STORE_OK)
+        return STORE_ERR_EXISTS;
+    if (rc != STORE_ERR_NOT_FOUND)
+        return rc;
+
+    // Deleted entries keep counting towards the load until the next rebuild
+    if (pread(idx_fd, &e, sizeof(e), entry_offset(pos)) != sizeof(e))
+        return STORE_ERR_IO;
+    if (e.state == INDEX_SLOT_EMPTY) {
+        if (index_full(ih, 1))
+            return STORE_ERR_FORMAT;
+        ih->entry_count++;
+    }
+    e.id = id;
+    e.state = INDEX_SLOT_USED;
+    e.slot = slot;
+    return store_write_full(idx_fd, &e, sizeof(e), entry_offset(pos));
+}
+
+int index_delete(int idx_fd, TreasureIndexHeader *ih, int32_t id) {
+    TreasureIndexEntry e;
+    uint64_t pos;
+    int rc = probe_position(idx_fd, ih, id, &pos, &e);
+    if (rc != STORE_OK)
+        return rc;
+    e.state = INDEX_SLOT_DELETED;
+    return store_write_full(idx_fd, &e, sizeof(e), entry_offset(pos));
+}
+
+int index_stamp(int idx_fd, TreasureIndexHeader *ih, const TreasureFileHeader *hdr) {
+    // The entries must be on disk before a stamp that vouches for them;
+    // losing the stamp itself only costs a rebuild
+    int rc = store_sync(idx_fd);
+    if (rc != STORE_OK)
+        return rc;
+    ih->data_generation = hdr->generation;
+    ih->data_record_count = hdr->record_count;
+    return store_write_full(idx_fd, ih, sizeof(*ih), 0);
+}
+
+int index_rebuild(const char *hunt_id, int data_fd, const TreasureFileHeader *hdr) {
+    uint64_t capacity = MIN_CAPACITY;
+    while (capacity < store_live_count(hdr) * 2)
+        capacity <<= 1;
+
+    TreasureIndexEntry *table = calloc(capacity, sizeof(TreasureIndexEntry));
+    if (!table) {
+        errno = ENOMEM;
+        return STORE_ERR_IO;
+    }
+    StoreScan scan;
+    if (store_scan_open(&scan, data_fd, hdr) != STORE_OK) {
+        free(table);
+        return STORE_ERR_IO;
+    }
+
+    TreasureIndexHeader ih;
+    memset(&ih, 0, sizeof(ih));
+    memcpy(ih.magic, INDEX_MAGIC, sizeof(ih.magic));
+    ih.version = INDEX_VERSION;
+    ih.capacity = capacity;
+
+    uint64_t mask = capacity - 1;
+    const Treasure *t;
+    uint64_t i;
+    while ((t = store_scan_next(&scan, &i)) != NULL) {
+        uint64_t pos = hash_id(t->id) & mask;
+        while (table[pos].state != INDEX_SLOT_EMPTY && table[pos].id != t->id)
+            pos = (pos + 1) & mask;
+        // Legacy files may hold duplicate IDs: the first one wins, as in
+        // the old linear scan.
+        if (table[pos].state == INDEX_SLOT_EMPTY) {
+            table[pos].id = t->id;
+            table[pos].state = INDEX_SLOT_USED;
+            table[pos].slot = i;
+            ih.entry_count++;
+        }
+    }
+    int rc = store_scan_error(&scan);
+    store_scan_close(&scan);
+    if (rc != STORE_OK) {
+        free(table);
+        return rc;
+    }
+    ih.data_generation = hdr->generation;
+    ih.data_record_count = hdr->record_count;
+
+    char path[512], tmp_path[512];
+    hunt_path(path, sizeof(path), hunt_id, INDEX_FILE);
+    hunt_path(tmp_path, sizeof(tmp_path), hunt_id, INDEX_FILE ".tmp");
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    rc = fd < 0 ? STORE_ERR_IO : STORE_OK;
+    if (rc == STORE_OK)
+        rc = store_write_full(fd, &ih, sizeof(ih), 0);
+    if (rc == STORE_OK)
+        rc = store_write_full(fd, table, capacity * sizeof(TreasureIndexEntry), entry_offset(0));
+    // Synced before the rename, so the name never points at a partial table
+    if (rc == STORE_OK)
+        rc = store_sync(fd);
+    if (fd >= 0)
+        close(fd);
+    if (rc == STORE_OK && rename(tmp_path, path) < 0)
+        rc = STORE_ERR_IO;
+    if (rc != STORE_OK)
+        unlink(tmp_path);
+    free(table);
+    return rc;
+}
+
+int index_open_current(const char *hunt_id, int data_fd, const TreasureFileHeader *hdr,
+                            TreasureIndexHeader *ih) {
+    int idx_fd = index_open(hunt_id, hdr, 1, ih);
+    if (idx_fd != STORE_ERR_NOT_FOUND)
+        return idx_fd;
+    int rc = index_rebuild(hunt_id, data_fd, hdr);
+    if (rc < 0)
+        return rc;
+    return index_open(hunt_id, hdr, 1, ih);
+}
+
+static int compare_ids(const void *a, const void *b) {
+    int32_t x = *(const int32_t *)a, y = *(const int32_t *)b;
+    return (x > y) - (x < y);
+}
+
+int store_add(int fd, const char *hunt_id, TreasureFileHeader *hdr, const Treasure *t, size_t n) {
+    if (store_lock_current(fd, hunt_id, 1) < 0)
+        return STORE_ERR_IO;
+
+    TreasureIndexHeader ih;
+    int idx_fd = -1;
+    int rc = store_read_header(fd, hdr);
+    if (rc == STORE_OK) {
+        idx_fd = index_open_current(hunt_id, fd, hdr, &ih);
+        if (idx_fd < 0)
+            rc = idx_fd;
+    }
+
+    // Reject the batch if an ID is already indexed or repeated within it
+    int32_t *ids = rc == STORE_OK ? malloc((n ? n : 1) * sizeof(int32_t)) : NULL;
+    if (rc == STORE_OK && !ids)
+        rc = STORE_ERR_IO;
+    for (size_t i = 0; rc == STORE_OK && i < n; i++) {
+        uint64_t slot;
+        int found = index_find(idx_fd, &ih, t[i].id, &slot);
+        if (found == STORE_OK)
+            rc = STORE_ERR_EXISTS;
+        else if (found != STORE_ERR_NOT_FOUND)
+            rc = found;
+        ids[i] = t[i].id;
+    }
+    if (rc == STORE_OK) {
+        qsort(ids, n, sizeof(int32_t), compare_ids);
+        for (size_t i = 1; i < n; i++)
+            if (ids[i] == ids[i - 1])
+                rc = STORE_ERR_EXISTS;
+    }
+    free(ids);
+
+    uint64_t first = hdr->record_count;
+    if (rc == STORE_OK)
+        rc = store_append(fd, hdr, t, n);
+
+    // A failed insert leaves the index stamped with the old generation, so
+    // the next user rebuilds it.
+    if (rc == STORE_OK) {
+        int irc = STORE_OK;
+        for (size_t i = 0; irc == STORE_OK && i < n; i++)
+            irc = index_insert(idx_fd, &ih, t[i].id, first + i);
+        if (irc == STORE_OK)
+            index_stamp(idx_fd, &ih, hdr);
+        else if (irc == STORE_ERR_FORMAT)
+            index_rebuild(hunt_id, fd, hdr);
+    }
+
+    if (idx_fd >= 0)
+        close(idx_fd);
+    store_unlock(fd);
+    return rc;
+}
+
+int store_find(int fd, const char *hunt_id, TreasureFileHeader *hdr, int32_t id, Treasure *t, uint64_t *slot) {
+    if (store_lock_current(fd, hunt_id, 0) < 0)
+        return STORE_ERR_IO;
+
+    TreasureIndexHeader ih;
+    int rc = store_read_header(fd, hdr);
+    int idx_fd = rc == STORE_OK ? index_open(hunt_id, hdr, 0, &ih) : rc;
+    if (idx_fd == STORE_ERR_NOT_FOUND) {
+        // Stale or missing: rebuild under the exclusive lock
+        store_unlock(fd);
+        if (store_lock_current(fd, hunt_id, 1) < 0)
+            return STORE_ERR_IO;
+        rc = store_read_header(fd, hdr);
+        idx_fd = rc == STORE_OK ? index_open_current(hunt_id, fd, hdr, &ih) : rc;
+    }
+
+    uint64_t found_slot = 0;
+    rc = idx_fd < 0 ? idx_fd : index_find(idx_fd, &ih, id, &found_slot);
+    if (rc == STORE_OK)
+        rc = store_read_record(fd, hdr, found_slot, t);
+    // store_remove rebuilds such an index; a lookup only reports it
+    if (rc == STORE_OK && (t->id != id || treasure_deleted(t)))
+        rc = STORE_ERR_INDEX;
+    if (rc == STORE_OK && slot)
+        *slot = found_slot;
+
+    if (idx_fd >= 0)
+        close(idx_fd);
+    store_unlock(fd);
+    return rc;
+}
+
+// In-memory set of the IDs already present in a hunt, used by imports to
+// reject duplicates without one index probe per row
+static int idset_grow(StoreImport *im) {
+    size_t cap = im->id_capacity ? im->id_capacity * 2 : 1024;
+    int32_t *keys = malloc(cap * sizeof(int32_t));
+    uint8_t *used = calloc(cap, 1);
+    if (!keys || !used) {
+        free(keys);
+        free(used);
+        errno = ENOMEM;
+        return STORE_ERR_IO;
+    }
+    for (size_t i = 0; i < im->id_capacity; i++) {
+        if (!im->id_used[i])
+            continue;
+        size_t pos = hash_id(im->id_keys[i]) & (cap - 1);
+        while (used[pos])
+            pos = (pos + 1) & (cap - 1);
+        keys[pos] = im->id_keys[i];
+        used[pos] = 1;
+    }
+    free(im->id_keys);
+    free(im->id_used);
+    im->id_keys = keys;
+    im->id_used = used;
+    im->id_capacity = cap;
+    return STORE_OK;
+}
+
+// Adds id to the set; STORE_ERR_EXISTS if it was already there
+static int idset_add(StoreImport *im, int32_t id) {
+    if ((im->id_count + 1) * 2 > im->id_capacity && idset_grow(im) < 0)
+        return STORE_ERR_IO;
+    size_t mask = im->id_capacity - 1;
+    size_t pos = hash_id(id) & mask;
+    while (im->id_used[pos]) {
+        if (im->id_keys[pos] == id)
+            return STORE_ERR_EXISTS;
+        pos = (pos + 1) & mask;
+    }
+    im->id_keys[pos] = id;
+    im->id_used[pos] = 1;
+    im->id_count++;
+    return STORE_OK;
+}
+
+int store_import_begin(StoreImport *im, int fd, const char *hunt_id) {
+    memset(im, 0, sizeof(*im));
+    im->fd = fd;
+    im->hunt_id = hunt_id;
+
+    if (store_lock_current(fd, hunt_id, 1) < 0)
+        return STORE_ERR_IO;
+    int rc = store_read_header(fd, &im->hdr);
+    im->first_slot = im->hdr.record_count;
+    im->first_generation = im->hdr.generation;
+
+    StoreScan scan;
+    if (rc == STORE_OK)
+        rc = store_scan_open(&scan, fd, &im->hdr);
+    if (rc == STORE_OK) {
+        const Treasure *t;
+        while (rc == STORE_OK && (t = store_scan_next(&scan, NULL)) != NULL)
+            if (idset_add(im, t->id) == STORE_ERR_IO)
+                rc = STORE_ERR_IO;
+        if (rc == STORE_OK)
+            rc = store_scan_error(&scan);
+        store_scan_close(&scan);
+    }
+
+    im->buf = rc == STORE_OK ? malloc(IMPORT_BATCH * sizeof(Treasure)) : NULL;
+    if (rc == STORE_OK && !im->buf)
+        rc = STORE_ERR_IO;
+    if (rc != STORE_OK) {
+        free(im->id_keys);
+        free(im->id_used);
+        store_unlock(fd);
+    }
+    return rc;
+}
+
+static int import_flush(StoreImport *im) {
+    if (im->buffered == 0)
+        return STORE_OK;
+    int rc = im->before_commit ? im->before_commit(im->before_commit_arg) : STORE_OK;
+    if (rc == STORE_OK)
+        rc = store_append(im->fd, &im->hdr, im->buf, im->buffered);
+    // Only committed rows count as imported
+    if (rc == STORE_OK)
+        im->added += im->buffered;
+    im->buffered = 0;
+    return rc;
+}
+
+int store_import_add(StoreImport *im, const Treasure *t) {
+    int rc = idset_add(im, t->id);
+    if (rc == STORE_ERR_EXISTS)
+        im->duplicates++;
+    if (rc != STORE_OK)
+        return rc;
+    im->buf[im->buffered++] = *t;
+    return im->buffered == IMPORT_BATCH ? import_flush(im) : STORE_OK;
+}
+
+int store_import_end(StoreImport *im) {
+    int rc = import_flush(im);
+
+    // Small imports patch the existing index; large ones rebuild it from a
+    // single scan instead of one probe and pwrite per row.
+    if (rc == STORE_OK && im->added > 0) {
+        TreasureIndexHeader ih;
+        TreasureFileHeader before = im->hdr;
+        before.record_count = im->first_slot;
+        before.generation = im->first_generation;
+        int idx_fd = -1;
+        if (im->added * 8 < store_live_count(&im->hdr))
+            idx_fd = index_open(im->hunt_id, &before, 1, &ih);
+        int irc = idx_fd >= 0 ? STORE_OK : STORE_ERR_NOT_FOUND;
+        StoreScan scan;
+        if (irc == STORE_OK && (irc = store_scan_open_at(&scan, im->fd, &im->hdr, im->first_slot)) == STORE_OK) {
+            const Treasure *t;
+            uint64_t slot;
+            while (irc == STORE_OK && (t = store_scan_next(&scan, &slot)) != NULL)
+                irc = index_insert(idx_fd, &ih, t->id, slot);
+            if (irc == STORE_OK)
+                irc = store_scan_error(&scan);
+            store_scan_close(&scan);
+        }
+        if (irc == STORE_OK)
+            index_stamp(idx_fd, &ih, &im->hdr);
+        else
+            index_rebuild(im->hunt_id, im->fd, &im->hdr);
+        if (idx_fd >= 0)
+            close(idx_fd);
+    }
+
+    free(im->buf);
+    free(im->id_keys);
+    free(im->id_used);
+    im->buf = NULL;
+    im->id_keys = NULL;
+    im->id_used = NULL;
+    store_unlock(im->fd);
+    return rc;
+}
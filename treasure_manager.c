@@ -7,30 +7,14 @@
 #include <dirent.h>
 #include <time.h>
 #include <errno.h>
+#include <ctype.h>
 
-#define USERNAME_MAX 32
-#define CLUE_MAX 128
-#define RECORD_FILE "treasures.dat"
-#define LOG_FILE "logged_hunt"
-
-typedef struct {
-    int treasure_id;
-    char username[USERNAME_MAX];
-    float latitude;
-    float longitude;
-    char clue[CLUE_MAX];
-    int value;
-} Treasure;
-
-// Utility: log operation
-void log_operation(const char *hunt_id, const char *msg) {
-    char path[256];
-    snprintf(path, sizeof(path), "%s/%s", hunt_id, LOG_FILE);
-    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
-    if (fd >= 0) {
-        dprintf(fd, "%s\n", msg);
-        close(fd);
-    }
+#include "treasure.h"
+#include "hunt_log.h"
+
+// Utility: log operation (batched, written once at exit)
+void log_operation(const char *hunt_id, const char *op, int64_t id, const char *user, const char *detail) {
+    hunt_log_add(hunt_log_get(hunt_id), op, id, user, detail);
 }
 
 // Utility: create symlink
@@ -42,134 +26,536 @@ void create_symlink(const char *hunt_id) {
 }
 
 void add_treasure(const char *hunt_id) {
-    mkdir(hunt_id, 0755);
-
-    char filepath[256];
-    snprintf(filepath, sizeof(filepath), "%s/%s", hunt_id, RECORD_FILE);
-
     Treasure t;
+    char username[USERNAME_MAX] = {0};
+    memset(&t, 0, sizeof(t));
     printf("Enter treasure ID: ");
-    scanf("%d", &t.treasure_id);
+    if (scanf("%d", &t.id) != 1)
+        goto invalid;
     printf("Enter username: ");
-    scanf("%s", t.username);
+    if (scanf("%31s", username) != 1)
+        goto invalid;
     printf("Enter latitude: ");
-    scanf("%f", &t.latitude);
+    if (scanf("%lf", &t.latitude) != 1)
+        goto invalid;
     printf("Enter longitude: ");
-    scanf("%f", &t.longitude);
+    if (scanf("%lf", &t.longitude) != 1)
+        goto invalid;
+    if (!treasure_coords_valid(t.latitude, t.longitude)) {
+        fprintf(stderr, "Invalid coordinates: latitude must be in [-90, 90], longitude in [-180, 180].\n");
+        return;
+    }
     printf("Enter clue: ");
     getchar(); // consume newline
-    fgets(t.clue, CLUE_MAX, stdin);
+    if (!fgets(t.clue, CLUE_MAX, stdin))
+        goto invalid;
     t.clue[strcspn(t.clue, "\n")] = '\0'; // remove newline
     printf("Enter value: ");
-    scanf("%d", &t.value);
+    if (scanf("%d", &t.value) != 1)
+        goto invalid;
 
-    int fd = open(filepath, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    TreasureFileHeader hdr;
+    int fd = store_open(hunt_id, 1, 1, &hdr);
     if (fd < 0) {
-        perror("Error opening treasure file");
+        fprintf(stderr, "Error opening treasure file: %s\n", store_strerror(fd));
         return;
     }
 
-    write(fd, &t, sizeof(Treasure));
+    UserDict users;
+    int rc = user_dict_open(&users, hunt_id, 1);
+    if (rc == STORE_OK) {
+        rc = user_dict_intern(&users, username, &t.user_id);
+        if (rc == STORE_OK)
+            rc = user_dict_sync(&users);
+        user_dict_close(&users);
+    }
+    if (rc < 0) {
+        fprintf(stderr, "Error recording username: %s\n", store_strerror(rc));
+        close(fd);
+        return;
+    }
+
+    rc = store_add(fd, hunt_id, &hdr, &t, 1);
     close(fd);
+    if (rc < 0) {
+        fprintf(stderr, "Error writing treasure: %s\n", store_strerror(rc));
+        return;
+    }
 
-    log_operation(hunt_id, "Added a treasure.");
+    log_operation(hunt_id, "add", t.id, username, NULL);
     create_symlink(hunt_id);
+    return;
+
+invalid:
+    fprintf(stderr, "Invalid input, treasure not added.\n");
+}
+
+// Import helpers: one row is either a CSV line
+//   id,username,latitude,longitude,clue,value
+// (fields may be double-quoted, with "" for a quote) or a JSON object
+//   {"id":1,"username":"...","latitude":..,"longitude":..,"clue":"...","value":..}
+#define IMPORT_FIELDS 6
+
+static const char *import_keys[IMPORT_FIELDS] = {
+    "id", "username", "latitude", "longitude", "clue", "value"
+};
+
+// Splits a CSV line in place; returns the number of fields
+static int split_csv(char *line, char **fields, int max) {
+    int n = 0;
+    char *p = line;
+    while (n < max) {
+        char *out = p;
+        fields[n++] = p;
+        if (*p == '"') {
+            char *in = p + 1;
+            while (*in) {
+                if (in[0] == '"' && in[1] == '"') {
+                    *out++ = '"';
+                    in += 2;
+                } else if (*in == '"') {
+                    in++;
+                    break;
+                } else {
+                    *out++ = *in++;
+                }
+            }
+            p = in;
+        } else {
+            while (*p && *p != ',')
+                *out++ = *p++;
+        }
+        char sep = *p;
+        *out = '\0';
+        if (sep != ',')
+            break;
+        p++;
+    }
+    return n;
+}
+
+// Reads a JSON string starting at the opening quote; unescapes in place
+static char *json_string(char **pp) {
+    char *p = *pp + 1, *out = p, *start = p;
+    while (*p && *p != '"') {
+        if (*p == '\\' && p[1]) {
+            p++;
+            switch (*p) {
+            case 'n': *out++ = '\n'; break;
+            case 't': *out++ = '\t'; break;
+            default: *out++ = *p; break;
+            }
+            p++;
+        } else {
+            *out++ = *p++;
+        }
+    }
+    if (*p != '"')
+        return NULL;
+    *out = '\0';
+    *pp = p + 1;
+    return start;
+}
+
+static void set_field(char **fields, const char *key, char *value) {
+    for (int i = 0; i < IMPORT_FIELDS; i++)
+        if (strcmp(key, import_keys[i]) == 0)
+            fields[i] = value;
+}
+
+// Extracts the known keys of a flat JSON object into fields
+static int split_json(char *line, char **fields) {
+    for (int i = 0; i < IMPORT_FIELDS; i++)
+        fields[i] = NULL;
+    char *p = strchr(line, '{');
+    if (!p)
+        return -1;
+    p++;
+    for (;;) {
+        while (isspace((unsigned char)*p) || *p == ',')
+            p++;
+        if (*p == '}')
+            return 0;
+        if (*p != '"')
+            return -1;
+        char *key = json_string(&p);
+        while (key && isspace((unsigned char)*p))
+            p++;
+        if (!key || *p++ != ':')
+            return -1;
+        while (isspace((unsigned char)*p))
+            p++;
+
+        if (*p == '"') {
+            char *value = json_string(&p);
+            if (!value)
+                return -1;
+            set_field(fields, key, value);
+            continue;
+        }
+
+        // Bare number: terminate it in place
+        char *value = p;
+        while (*p && *p != ',' && *p != '}' && !isspace((unsigned char)*p))
+            p++;
+        char end = *p;
+        *p = '\0';
+        set_field(fields, key, value);
+        if (end == '}')
+            return 0;
+        if (end == '\0')
+            return -1;
+        p++;
+    }
+}
+
+// Validates the fields of one row; returns an error message or NULL. The
+// username is left in fields[1] for the caller to intern.
+static const char *parse_fields(char **fields, Treasure *t) {
+    char *end;
+    memset(t, 0, sizeof(*t));
+    for (int i = 0; i < IMPORT_FIELDS; i++)
+        if (!fields[i])
+            return "missing field";
+
+    long id = strtol(fields[0], &end, 10);
+    if (*fields[0] == '\0' || *end != '\0' || id < INT32_MIN || id > INT32_MAX)
+        return "invalid id";
+    t->id = (int32_t)id;
+
+    if (*fields[1] == '\0' || strlen(fields[1]) >= USERNAME_MAX)
+        return "invalid username";
+
+    // strtod accepts "nan" and "inf"; the range checks must reject them
+    t->latitude = strtod(fields[2], &end);
+    if (*fields[2] == '\0' || *end != '\0' || !treasure_coords_valid(t->latitude, 0.0))
+        return "invalid latitude";
+    t->longitude = strtod(fields[3], &end);
+    if (*fields[3] == '\0' || *end != '\0' || !treasure_coords_valid(0.0, t->longitude))
+        return "invalid longitude";
+
+    if (strlen(fields[4]) >= CLUE_MAX)
+        return "clue too long";
+    strcpy(t->clue, fields[4]);
+
+    long value = strtol(fields[5], &end, 10);
+    if (*fields[5] == '\0' || *end != '\0' || value < INT32_MIN || value > INT32_MAX)
+        return "invalid value";
+    t->value = (int32_t)value;
+    return NULL;
+}
+
+static int sync_users(void *users) {
+    return user_dict_sync(users);
+}
+
+void import_treasures(const char *hunt_id, const char *source) {
+    FILE *in = strcmp(source, "-") == 0 ? stdin : fopen(source, "r");
+    if (!in) {
+        perror("Error opening import file");
+        return;
+    }
+
+    TreasureFileHeader hdr;
+    int fd = store_open(hunt_id, 1, 1, &hdr);
+    if (fd < 0) {
+        fprintf(stderr, "Error opening treasure file: %s\n", store_strerror(fd));
+        if (in != stdin)
+            fclose(in);
+        return;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    UserDict users;
+    int rc = user_dict_open(&users, hunt_id, 1);
+    if (rc < 0) {
+        fprintf(stderr, "Error opening %s: %s\n", USERS_FILE, store_strerror(rc));
+        close(fd);
+        if (in != stdin)
+            fclose(in);
+        return;
+    }
+
+    StoreImport im;
+    rc = store_import_begin(&im, fd, hunt_id);
+    if (rc < 0) {
+        fprintf(stderr, "Error starting import: %s\n", store_strerror(rc));
+        user_dict_close(&users);
+        close(fd);
+        if (in != stdin)
+            fclose(in);
+        return;
+    }
+    im.before_commit = sync_users;
+    im.before_commit_arg = &users;
+
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    unsigned long lineno = 0, invalid = 0;
+    while (rc >= 0 || rc == STORE_ERR_EXISTS) {
+        if ((len = getline(&line, &cap, in)) < 0)
+            break;
+        lineno++;
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        char *p = line;
+        while (isspace((unsigned char)*p))
+            p++;
+        if (*p == '\0' || *p == '#')
+            continue;
+
+        char *fields[IMPORT_FIELDS];
+        const char *err = NULL;
+        if (*p == '{') {
+            if (split_json(p, fields) < 0)
+                err = "malformed JSON";
+        } else if (split_csv(p, fields, IMPORT_FIELDS) != IMPORT_FIELDS) {
+            err = "expected 6 CSV fields";
+        } else if (lineno == 1 && strcmp(fields[0], "id") == 0) {
+            continue; // CSV header row
+        }
+
+        Treasure t;
+        if (!err)
+            err = parse_fields(fields, &t);
+        if (err) {
+            fprintf(stderr, "line %lu: %s, skipped\n", lineno, err);
+            invalid++;
+            continue;
+        }
+        if ((rc = user_dict_intern(&users, fields[1], &t.user_id)) < 0)
+            break;
+        rc = store_import_add(&im, &t);
+        if (rc == STORE_ERR_EXISTS)
+            fprintf(stderr, "line %lu: treasure ID %d already exists, skipped\n", lineno, t.id);
+    }
+    free(line);
+    if (in != stdin)
+        fclose(in);
+
+    if (rc < 0 && rc != STORE_ERR_EXISTS)
+        fprintf(stderr, "Import stopped: %s\n", store_strerror(rc));
+    rc = store_import_end(&im);
+    user_dict_close(&users);
+    close(fd);
+    if (rc < 0)
+        fprintf(stderr, "Error finishing import: %s\n", store_strerror(rc));
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    if (secs <= 0)
+        secs = 1e-9;
+
+    if (im.added > 0) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "%llu treasures from %s", (unsigned long long)im.added, source);
+        log_operation(hunt_id, "import", HUNT_LOG_NO_ID, NULL, msg);
+        create_symlink(hunt_id);
+    }
+    printf("Imported %llu treasures into %s (%llu duplicates, %lu invalid rows) in %.3f s: "
+           "%.0f records/s, %.1f MB/s\n",
+           (unsigned long long)im.added, hunt_id, (unsigned long long)im.duplicates, invalid, secs,
+           (double)im.added / secs, (double)im.added * sizeof(Treasure) / secs / 1e6);
 }
 
 void list_treasures(const char *hunt_id) {
-    char filepath[256];
-    snprintf(filepath, sizeof(filepath), "%s/%s", hunt_id, RECORD_FILE);
+    TreasureFileHeader hdr;
+    int fd = store_open(hunt_id, 0, 0, &hdr);
+    if (fd < 0) {
+        fprintf(stderr, "Error opening treasure file: %s\n", store_strerror(fd));
+        return;
+    }
 
     struct stat st;
-    if (stat(filepath, &st) == -1) {
+    if (fstat(fd, &st) == -1) {
         perror("Could not stat treasure file");
+        close(fd);
         return;
     }
 
-    printf("Hunt: %s\nSize: %ld bytes\nLast modified: %s",
-           hunt_id, st.st_size, ctime(&st.st_mtime));
+    printf("Hunt: %s\nSize: %ld bytes\nTreasures: %llu\nLast modified: %s",
+           hunt_id, st.st_size, (unsigned long long)store_live_count(&hdr), ctime(&st.st_mtime));
 
-    int fd = open(filepath, O_RDONLY);
-    if (fd < 0) {
-        perror("Error opening treasure file");
+    UserDict users;
+    int rc = user_dict_open(&users, hunt_id, 0);
+    if (rc != STORE_OK) {
+        fprintf(stderr, "Error reading %s: %s\n", USERS_FILE, store_strerror(rc));
+        close(fd);
         return;
     }
-
-    Treasure t;
-    while (read(fd, &t, sizeof(Treasure)) == sizeof(Treasure)) {
+    StoreScan scan;
+    if ((rc = store_scan_open(&scan, fd, &hdr)) != STORE_OK) {
+        fprintf(stderr, "Error reading treasure file: %s\n", store_strerror(rc));
+        user_dict_close(&users);
+        close(fd);
+        return;
+    }
+    const Treasure *t;
+    while ((t = store_scan_next(&scan, NULL)) != NULL) {
         printf("ID: %d, User: %s, (%.2f, %.2f), Value: %d, Clue: %s\n",
-               t.treasure_id, t.username, t.latitude, t.longitude, t.value, t.clue);
+               t->id, user_dict_name(&users, t->user_id), t->latitude, t->longitude, t->value, t->clue);
     }
+    if (store_scan_error(&scan) != STORE_OK)
+        perror("Error reading treasure file");
+    store_scan_close(&scan);
 
+    user_dict_close(&users);
     close(fd);
 }
 
 void view_treasure(const char *hunt_id, int id) {
-    char filepath[256];
-    snprintf(filepath, sizeof(filepath), "%s/%s", hunt_id, RECORD_FILE);
-
-    int fd = open(filepath, O_RDONLY);
+    TreasureFileHeader hdr;
+    int fd = store_open(hunt_id, 0, 0, &hdr);
     if (fd < 0) {
-        perror("Error opening treasure file");
+        fprintf(stderr, "Error opening treasure file: %s\n", store_strerror(fd));
         return;
     }
 
     Treasure t;
-    while (read(fd, &t, sizeof(Treasure)) == sizeof(Treasure)) {
-        if (t.treasure_id == id) {
-            printf("Treasure ID: %d\nUser: %s\nCoordinates: (%.2f, %.2f)\nValue: %d\nClue: %s\n",
-                   t.treasure_id, t.username, t.latitude, t.longitude, t.value, t.clue);
-            close(fd);
-            return;
-        }
+    UserDict users;
+    int rc = store_find(fd, hunt_id, &hdr, id, &t, NULL);
+    if (rc == STORE_OK)
+        rc = user_dict_open(&users, hunt_id, 0);
+    if (rc == STORE_OK) {
+        printf("Treasure ID: %d\nUser: %s\nCoordinates: (%.2f, %.2f)\nValue: %d\nClue: %s\n",
+               t.id, user_dict_name(&users, t.user_id), t.latitude, t.longitude, t.value, t.clue);
+        user_dict_close(&users);
+    } else if (rc == STORE_ERR_NOT_FOUND) {
+        printf("Treasure with ID %d not found.\n", id);
+    } else {
+        fprintf(stderr, "Error reading treasure: %s\n", store_strerror(rc));
     }
-
-    printf("Treasure with ID %d not found.\n", id);
     close(fd);
 }
 
 void remove_treasure(const char *hunt_id, int id) {
-    char filepath[256], temp_filepath[256];
-    snprintf(filepath, sizeof(filepath), "%s/%s", hunt_id, RECORD_FILE);
-    snprintf(temp_filepath, sizeof(temp_filepath), "%s/temp.dat", hunt_id);
+    TreasureFileHeader hdr;
+    int fd = store_open(hunt_id, 1, 0, &hdr);
+    if (fd < 0) {
+        fprintf(stderr, "Error opening treasure file: %s\n", store_strerror(fd));
+        return;
+    }
 
-    int fd_old = open(filepath, O_RDONLY);
-    int fd_new = open(temp_filepath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int compact_rc;
+    int rc = store_remove(fd, hunt_id, &hdr, id, &compact_rc);
+    close(fd);
 
-    if (fd_old < 0 || fd_new < 0) {
-        perror("Error opening file");
+    if (rc == STORE_OK) {
+        log_operation(hunt_id, "remove", id, NULL, NULL);
+        printf("Treasure removed.\n");
+        if (compact_rc != STORE_OK)
+            fprintf(stderr, "Warning: compacting the hunt failed: %s\n", store_strerror(compact_rc));
+    } else if (rc == STORE_ERR_NOT_FOUND) {
+        printf("Treasure with ID %d not found.\n", id);
+    } else {
+        fprintf(stderr, "Error removing treasure: %s\n", store_strerror(rc));
+    }
+}
+
+void compact_hunt(const char *hunt_id) {
+    TreasureFileHeader hdr;
+    int fd = store_open(hunt_id, 1, 0, &hdr);
+    if (fd < 0) {
+        fprintf(stderr, "Error opening treasure file: %s\n", store_strerror(fd));
         return;
     }
 
-    Treasure t;
-    int found = 0;
-    while (read(fd_old, &t, sizeof(Treasure)) == sizeof(Treasure)) {
-        if (t.treasure_id == id) {
-            found = 1;
-            continue;
-        }
-        write(fd_new, &t, sizeof(Treasure));
+    uint64_t before = hdr.record_count;
+    int rc = store_compact(fd, hunt_id, &hdr);
+    close(fd);
+
+    if (rc == STORE_OK) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "%llu records, %llu removed", (unsigned long long)hdr.record_count,
+                 (unsigned long long)(before - hdr.record_count));
+        log_operation(hunt_id, "compact", HUNT_LOG_NO_ID, NULL, msg);
+        printf("Hunt %s compacted: %llu records, %llu removed.\n", hunt_id,
+               (unsigned long long)hdr.record_count, (unsigned long long)(before - hdr.record_count));
+    } else {
+        fprintf(stderr, "Error compacting hunt: %s\n", store_strerror(rc));
     }
+}
 
-    close(fd_old);
-    close(fd_new);
+// Prints the live treasures matching a location query
+void geo_search(const char *hunt_id, const GeoQuery *q) {
+    TreasureFileHeader hdr;
+    int fd = store_open(hunt_id, 0, 0, &hdr);
+    if (fd < 0) {
+        fprintf(stderr, "Error opening treasure file: %s\n", store_strerror(fd));
+        return;
+    }
 
-    if (found) {
-        rename(temp_filepath, filepath);
-        log_operation(hunt_id, "Removed a treasure.");
-        printf("Treasure removed.\n");
+    GeoMatch *matches;
+    size_t count;
+    int rc = store_geo_query(fd, hunt_id, &hdr, q, &matches, &count);
+    close(fd);
+    if (rc != STORE_OK) {
+        fprintf(stderr, "Error searching treasures: %s\n", store_strerror(rc));
+        return;
+    }
+    UserDict users;
+    if ((rc = user_dict_open(&users, hunt_id, 0)) != STORE_OK) {
+        fprintf(stderr, "Error reading %s: %s\n", USERS_FILE, store_strerror(rc));
+        free(matches);
+        return;
+    }
+
+    printf("%zu treasure(s) found.\n", count);
+    for (size_t i = 0; i < count; i++) {
+        const Treasure *t = &matches[i].t;
+        printf("Treasure ID: %d\nUser: %s\nCoordinates: (%.2f, %.2f)\nValue: %d\nClue: %s\n",
+               t->id, user_dict_name(&users, t->user_id), t->latitude, t->longitude, t->value, t->clue);
+        if (q->near)
+            printf("Distance: %.2f km\n", matches[i].distance_km);
+        printf("\n");
+    }
+    user_dict_close(&users);
+    free(matches);
+}
+
+void export_columns(const char *hunt_id) {
+    TreasureFileHeader hdr;
+    int fd = store_open(hunt_id, 0, 0, &hdr);
+    if (fd < 0) {
+        fprintf(stderr, "Error opening treasure file: %s\n", store_strerror(fd));
+        return;
+    }
+
+    int rc = store_export_columns(fd, hunt_id, &hdr);
+    close(fd);
+    if (rc == STORE_OK) {
+        printf("Hunt %s exported to %s/%s (%llu treasures).\n", hunt_id, hunt_id, COLUMNS_DIR,
+               (unsigned long long)store_live_count(&hdr));
     } else {
-        remove(temp_filepath);
-        printf("Treasure with ID %d not found.\n", id);
+        fprintf(stderr, "Error exporting hunt: %s\n", store_strerror(rc));
     }
 }
 
 void remove_hunt(const char *hunt_id) {
     char filepath[256];
-    snprintf(filepath, sizeof(filepath), "%s/%s", hunt_id, RECORD_FILE);
+    snprintf(filepath, sizeof(filepath), "%s/%s", hunt_id, TREASURE_FILE);
+    unlink(filepath);
+    snprintf(filepath, sizeof(filepath), "%s/%s", hunt_id, INDEX_FILE);
+    unlink(filepath);
+    snprintf(filepath, sizeof(filepath), "%s/%s", hunt_id, SCORE_CACHE_FILE);
+    unlink(filepath);
+    snprintf(filepath, sizeof(filepath), "%s/%s", hunt_id, GRID_FILE);
     unlink(filepath);
+    snprintf(filepath, sizeof(filepath), "%s/%s", hunt_id, USERS_FILE);
+    unlink(filepath);
+    snprintf(filepath, sizeof(filepath), "%s/%s", hunt_id, JOURNAL_FILE);
+    unlink(filepath);
+    hunt_log_discard(hunt_id);
     snprintf(filepath, sizeof(filepath), "%s/%s", hunt_id, LOG_FILE);
     unlink(filepath);
+    for (int i = 1; i <= HUNT_LOG_KEEP; i++) {
+        snprintf(filepath, sizeof(filepath), "%s/%s.%d", hunt_id, LOG_FILE, i);
+        unlink(filepath);
+    }
+    columns_remove(hunt_id);
     rmdir(hunt_id);
 
     char symlink_name[256];
@@ -198,6 +584,20 @@ int main(int argc, char *argv[]) {
     } else if (strcmp(cmd, "--remove_treasure") == 0 && argc == 4) {
         int id = atoi(argv[3]);
         remove_treasure(hunt_id, id);
+    } else if (strcmp(cmd, "--import") == 0 && argc == 4) {
+        import_treasures(hunt_id, argv[3]);
+    } else if (strcmp(cmd, "--near") == 0 && argc == 6) {
+        GeoQuery q;
+        geo_query_near(&q, atof(argv[3]), atof(argv[4]), atof(argv[5]));
+        geo_search(hunt_id, &q);
+    } else if (strcmp(cmd, "--bbox") == 0 && argc == 7) {
+        GeoQuery q;
+        geo_query_bbox(&q, atof(argv[3]), atof(argv[4]), atof(argv[5]), atof(argv[6]));
+        geo_search(hunt_id, &q);
+    } else if (strcmp(cmd, "--snapshot") == 0) {
+        export_columns(hunt_id);
+    } else if (strcmp(cmd, "--compact") == 0) {
+        compact_hunt(hunt_id);
     } else if (strcmp(cmd, "--remove_hunt") == 0) {
         remove_hunt(hunt_id);
     } else {
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "treasure.h"
+
+int store_scan_open(StoreScan *s, int fd, const TreasureFileHeader *hdr) {
+    return store_scan_open_at(s, fd, hdr, 0);
+}
+
+int store_scan_open_at(StoreScan *s, int fd, const TreasureFileHeader *hdr, uint64_t first) {
+    memset(s, 0, sizeof(*s));
+    s->fd = fd;
+    s->hdr = *hdr;
+    s->map = MAP_FAILED;
+    s->first = first;
+    s->next = first;
+    s->buf_start = first;
+
+    // Records are written before the header that counts them, so a file
+    // shorter than that count is damaged. Refuse it rather than map past
+    // EOF (touching such pages raises SIGBUS) or quietly drop the tail.
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+        return STORE_ERR_IO;
+    if (st.st_size < store_record_offset(hdr, hdr->record_count))
+        return STORE_ERR_TRUNCATED;
+    if (s->hdr.record_count <= first)
+        return STORE_OK;
+
+    // The mapping starts at the page holding record <first>
+    off_t start = store_record_offset(&s->hdr, first);
+    off_t map_off = start & ~((off_t)sysconf(_SC_PAGESIZE) - 1);
+    s->map_len = (size_t)(store_record_offset(&s->hdr, s->hdr.record_count) - map_off);
+    s->map = mmap(NULL, s->map_len, PROT_READ, MAP_SHARED, fd, map_off);
+    if (s->map != MAP_FAILED) {
+        madvise(s->map, s->map_len, MADV_SEQUENTIAL);
+        s->records = (const Treasure *)((const char *)s->map + (start - map_off));
+        return STORE_OK;
+    }
+
+    s->buf = malloc(SCAN_CHUNK * sizeof(Treasure));
+    if (!s->buf) {
+        errno = ENOMEM;
+        return STORE_ERR_IO;
+    }
+    return STORE_OK;
+}
+
+// Buffered mode: reads the chunk holding slot s->next
+static int fill_buffer(StoreScan *s) {
+    uint64_t n = s->hdr.record_count - s->next;
+    if (n > SCAN_CHUNK)
+        n = SCAN_CHUNK;
+    ssize_t r = pread(s->fd, s->buf, n * sizeof(Treasure), store_record_offset(&s->hdr, s->next));
+    if (r < (ssize_t)sizeof(Treasure))
+        return STORE_ERR_IO;
+    s->buf_start = s->next;
+    s->buf_count = (uint64_t)r / sizeof(Treasure);
+    return STORE_OK;
+}
+
+const Treasure *store_scan_next(StoreScan *s, uint64_t *slot) {
+    while (s->error == STORE_OK && s->next < s->hdr.record_count) {
+        const Treasure *t;
+        if (s->records) {
+            t = &s->records[s->next - s->first];
+        } else {
+            if (s->next >= s->buf_start + s->buf_count && (s->error = fill_buffer(s)) != STORE_OK)
+                return NULL;
+            t = &s->buf[s->next - s->buf_start];
+        }
+        uint64_t i = s->next++;
+        store_counters.records_scanned++;
+        store_counters.bytes_read += sizeof(Treasure);
+        if (treasure_deleted(t))
+            continue;
+        if (slot)
+            *slot = i;
+        return t;
+    }
+    return NULL;
+}
+
+int store_scan_error(const StoreScan *s) {
+    return s->error;
+}
+
+void store_scan_close(StoreScan *s) {
+    if (s->map != MAP_FAILED)
+        munmap(s->map, s->map_len);
+    free(s->buf);
+    s->map = MAP_FAILED;
+    s->records = NULL;
+    s->buf = NULL;
+}
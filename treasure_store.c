@@ -0,0 +1,516 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "treasure.h"
+
+__thread StoreCounters store_counters;
+
+void hunt_path(char *buf, size_t size, const char *hunt_id, const char *name) {
+    snprintf(buf, size, "%s/%s", hunt_id, name);
+}
+
+void store_init_header(TreasureFileHeader *hdr) {
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, TREASURE_MAGIC, sizeof(hdr->magic));
+    hdr->version = TREASURE_FORMAT_VERSION;
+    hdr->header_size = sizeof(TreasureFileHeader);
+    hdr->record_size = sizeof(Treasure);
+    hdr->record_count = 0;
+}
+
+int store_read_header(int fd, TreasureFileHeader *hdr) {
+    ssize_t n = pread(fd, hdr, sizeof(*hdr), 0);
+    if (n < 0)
+        return STORE_ERR_IO;
+    if (n != sizeof(*hdr) || memcmp(hdr->magic, TREASURE_MAGIC, sizeof(hdr->magic)) != 0)
+        return STORE_ERR_FORMAT;
+    if (hdr->version != TREASURE_FORMAT_VERSION)
+        return STORE_ERR_VERSION;
+    if (hdr->header_size != sizeof(TreasureFileHeader) || hdr->record_size != sizeof(Treasure))
+        return STORE_ERR_FORMAT;
+    return STORE_OK;
+}
+
+int store_write_header(int fd, const TreasureFileHeader *hdr) {
+    if (pwrite(fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr))
+        return STORE_ERR_IO;
+    return STORE_OK;
+}
+
+int store_lock(int fd, int exclusive) {
+    while (flock(fd, exclusive ? LOCK_EX : LOCK_SH) < 0) {
+        if (errno != EINTR)
+            return STORE_ERR_IO;
+    }
+    return STORE_OK;
+}
+
+void store_unlock(int fd) {
+    flock(fd, LOCK_UN);
+}
+
+int store_open(const char *hunt_id, int writable, int create, TreasureFileHeader *hdr) {
+    char path[512];
+    hunt_path(path, sizeof(path), hunt_id, TREASURE_FILE);
+
+    if (create)
+        mkdir(hunt_id, 0755);
+
+    int flags = writable ? O_RDWR : O_RDONLY;
+    if (create)
+        flags |= O_CREAT;
+    int fd = open(path, flags, 0644);
+    if (fd < 0)
+        return STORE_ERR_IO;
+
+    if (create) {
+        // A freshly created file gets its header under the lock so that two
+        // concurrent creators cannot both write one.
+        struct stat st;
+        if (store_lock(fd, 1) < 0 || fstat(fd, &st) < 0) {
+            int saved = errno;
+            close(fd);
+            errno = saved;
+            return STORE_ERR_IO;
+        }
+        if (st.st_size == 0) {
+            store_init_header(hdr);
+            if (store_write_header(fd, hdr) < 0 || store_sync(fd) < 0 || store_sync_dir(hunt_id) < 0 ||
+                store_sync_dir(".") < 0) {
+                int saved = errno;
+                close(fd);
+                errno = saved;
+                return STORE_ERR_IO;
+            }
+        }
+        store_unlock(fd);
+    }
+
+    int rc = store_read_header(fd, hdr);
+    if (rc < 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return rc;
+    }
+    return fd;
+}
+
+off_t store_record_offset(const TreasureFileHeader *hdr, uint64_t index) {
+    return (off_t)hdr->header_size + (off_t)(index * hdr->record_size);
+}
+
+int store_read_record(int fd, const TreasureFileHeader *hdr, uint64_t index, Treasure *t) {
+    if (index >= hdr->record_count)
+        return STORE_ERR_FORMAT;
+    ssize_t n = pread(fd, t, sizeof(*t), store_record_offset(hdr, index));
+    if (n < 0)
+        return STORE_ERR_IO;
+    if (n != sizeof(*t))
+        return STORE_ERR_FORMAT;
+    store_counters.bytes_read += sizeof(*t);
+    return STORE_OK;
+}
+
+int store_write_full(int fd, const void *buf, size_t len, off_t off) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, off);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return STORE_ERR_IO;
+        }
+        p += n;
+        off += n;
+        len -= (size_t)n;
+    }
+    return STORE_OK;
+}
+
+static int sync_mode;
+static pthread_once_t sync_mode_once = PTHREAD_ONCE_INIT;
+
+// Read once: the monitor's worker and query threads all sync
+static void read_sync_mode(void) {
+    const char *mode = getenv("TREASURE_SYNC");
+    sync_mode = !mode || strcmp(mode, "none") != 0;
+}
+
+int store_sync(int fd) {
+    pthread_once(&sync_mode_once, read_sync_mode);
+    if (sync_mode && fdatasync(fd) < 0)
+        return STORE_ERR_IO;
+    return STORE_OK;
+}
+
+int store_sync_dir(const char *dir) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return STORE_ERR_IO;
+    int rc = store_sync(fd);
+    close(fd);
+    return rc;
+}
+
+// Unsynced append, for files that are synced once as a whole (compaction)
+static int append_records(int fd, TreasureFileHeader *hdr, const Treasure *t, size_t n) {
+    int rc = store_write_full(fd, t, n * sizeof(Treasure), store_record_offset(hdr, hdr->record_count));
+    if (rc != STORE_OK)
+        return rc;
+    hdr->record_count += n;
+    hdr->generation++;
+    return store_write_header(fd, hdr);
+}
+
+int store_append(int fd, TreasureFileHeader *hdr, const Treasure *t, size_t n) {
+    int rc = store_write_full(fd, t, n * sizeof(Treasure), store_record_offset(hdr, hdr->record_count));
+    // The records must be on disk before a header that counts them
+    if (rc == STORE_OK)
+        rc = store_sync(fd);
+    if (rc != STORE_OK)
+        return rc;
+    hdr->record_count += n;
+    hdr->generation++;
+    rc = store_write_header(fd, hdr);
+    return rc == STORE_OK ? store_sync(fd) : rc;
+}
+
+static uint32_t journal_checksum(const StoreJournalEntry *e) {
+    StoreJournalEntry copy = *e;
+    copy.checksum = 0;
+    const unsigned char *p = (const unsigned char *)&copy;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < sizeof(copy); i++)
+        h = (h ^ p[i]) * 16777619u;
+    return h;
+}
+
+static int journal_apply(int fd, const StoreJournalEntry *e) {
+    off_t off = store_record_offset(&e->hdr, e->slot) + (off_t)offsetof(Treasure, flags);
+    int rc = store_write_full(fd, &e->flags, sizeof(e->flags), off);
+    if (rc == STORE_OK)
+        rc = store_write_header(fd, &e->hdr);
+    return rc == STORE_OK ? store_sync(fd) : rc;
+}
+
+// Logs, applies and clears one in-place change
+static int journal_commit(int fd, const char *hunt_id, const StoreJournalEntry *e) {
+    char path[512];
+    hunt_path(path, sizeof(path), hunt_id, JOURNAL_FILE);
+    int jfd = open(path, O_RDWR | O_CREAT, 0644);
+    if (jfd < 0)
+        return STORE_ERR_IO;
+    int rc = store_write_full(jfd, e, sizeof(*e), 0);
+    if (rc == STORE_OK)
+        rc = store_sync(jfd);
+    if (rc == STORE_OK)
+        rc = journal_apply(fd, e);
+    // Once applied the entry is stale (its base generation is gone), so
+    // clearing it needs no sync
+    if (rc == STORE_OK && ftruncate(jfd, 0) < 0)
+        rc = STORE_ERR_IO;
+    close(jfd);
+    return rc;
+}
+
+int store_recover(int fd, const char *hunt_id) {
+    struct stat st;
+    TreasureFileHeader hdr;
+    if (fstat(fd, &st) < 0)
+        return STORE_ERR_IO;
+
+    char path[512];
+    hunt_path(path, sizeof(path), hunt_id, JOURNAL_FILE);
+    int jfd = open(path, O_RDWR);
+    if (jfd >= 0) {
+        StoreJournalEntry e;
+        if (pread(jfd, &e, sizeof(e), 0) == sizeof(e) &&
+            memcmp(e.magic, JOURNAL_MAGIC, sizeof(e.magic)) == 0 && e.version == JOURNAL_VERSION &&
+            e.checksum == journal_checksum(&e) && e.data_ino == (uint64_t)st.st_ino &&
+            store_read_header(fd, &hdr) == STORE_OK && hdr.generation == e.base_generation &&
+            e.slot < hdr.record_count) {
+            int rc = journal_apply(fd, &e);
+            if (rc != STORE_OK) {
+                close(jfd);
+                return rc;
+            }
+        }
+        ftruncate(jfd, 0);
+        close(jfd);
+    }
+
+    // Records past the committed count are from an append that never
+    // reached its header write
+    int rc = store_read_header(fd, &hdr);
+    if (rc != STORE_OK)
+        return rc;
+    off_t committed = store_record_offset(&hdr, hdr.record_count);
+    if (fstat(fd, &st) < 0)
+        return STORE_ERR_IO;
+    if (st.st_size > committed && ftruncate(fd, committed) < 0)
+        return STORE_ERR_IO;
+    return STORE_OK;
+}
+
+int store_lock_current(int fd, const char *hunt_id, int exclusive) {
+    char path[512];
+    hunt_path(path, sizeof(path), hunt_id, TREASURE_FILE);
+
+    for (;;) {
+        if (store_lock(fd, exclusive) < 0)
+            return STORE_ERR_IO;
+        struct stat held, current;
+        if (fstat(fd, &held) < 0 || stat(path, &current) < 0) {
+            store_unlock(fd);
+            return STORE_ERR_IO;
+        }
+        if (held.st_ino == current.st_ino && held.st_dev == current.st_dev) {
+            if (exclusive && (fcntl(fd, F_GETFL) & O_ACCMODE) == O_RDWR && store_recover(fd, hunt_id) < 0) {
+                store_unlock(fd);
+                return STORE_ERR_IO;
+            }
+            return STORE_OK;
+        }
+
+        store_unlock(fd);
+        int flags = fcntl(fd, F_GETFL);
+        int nfd = open(path, flags & O_ACCMODE);
+        if (nfd < 0)
+            return STORE_ERR_IO;
+        dup2(nfd, fd);
+        close(nfd);
+    }
+}
+
+int store_needs_compaction(const TreasureFileHeader *hdr) {
+    return hdr->dead_count >= COMPACT_MIN_DEAD &&
+           hdr->dead_count * 100 >= hdr->record_count * COMPACT_DEAD_PERCENT;
+}
+
+// Caller holds the exclusive lock
+static int compact_locked(int fd, const char *hunt_id, TreasureFileHeader *hdr) {
+    char path[512], tmp_path[512];
+    hunt_path(path, sizeof(path), hunt_id, TREASURE_FILE);
+    hunt_path(tmp_path, sizeof(tmp_path), hunt_id, "temp.dat");
+
+    int tmp_fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (tmp_fd < 0)
+        return STORE_ERR_IO;
+
+    // Copy every live record into a new file. Its generation moves past the
+    // old one so sidecars stamped for either file cannot be mistaken.
+    TreasureFileHeader new_hdr;
+    store_init_header(&new_hdr);
+    new_hdr.generation = hdr->generation + 1;
+    new_hdr.epoch = hdr->epoch + 1;
+    StoreScan scan;
+    int rc = store_scan_open(&scan, fd, hdr);
+    Treasure *batch = rc == STORE_OK ? malloc(SCAN_CHUNK * sizeof(Treasure)) : NULL;
+    if (rc == STORE_OK && !batch)
+        rc = STORE_ERR_IO;
+    const Treasure *t;
+    size_t n = 0;
+    while (rc == STORE_OK && (t = store_scan_next(&scan, NULL)) != NULL) {
+        batch[n++] = *t;
+        if (n == SCAN_CHUNK) {
+            rc = append_records(tmp_fd, &new_hdr, batch, n);
+            n = 0;
+        }
+    }
+    // A scan cut short by a read error must not replace the file
+    if (rc == STORE_OK)
+        rc = store_scan_error(&scan);
+    if (rc == STORE_OK && n > 0)
+        rc = append_records(tmp_fd, &new_hdr, batch, n);
+    free(batch);
+    store_scan_close(&scan);
+
+    if (rc == STORE_OK)
+        rc = index_rebuild(hunt_id, tmp_fd, &new_hdr);
+    // One sync for the whole new file, then one for the rename
+    if (rc == STORE_OK)
+        rc = store_sync(tmp_fd);
+    // Lock the new file before it replaces the old one, so that no one who
+    // opens it after the rename can lock it first
+    if (rc == STORE_OK && store_lock(tmp_fd, 1) < 0)
+        rc = STORE_ERR_IO;
+    if (rc == STORE_OK && rename(tmp_path, path) < 0)
+        rc = STORE_ERR_IO;
+    if (rc != STORE_OK) {
+        close(tmp_fd);
+        unlink(tmp_path);
+        return rc;
+    }
+
+    // The new file is in place from here on; a failed directory sync only
+    // means the rename may not survive a crash, which the caller must hear
+    rc = store_sync_dir(hunt_id);
+    dup2(tmp_fd, fd);
+    close(tmp_fd);
+    *hdr = new_hdr;
+    return rc;
+}
+
+int store_compact(int fd, const char *hunt_id, TreasureFileHeader *hdr) {
+    if (store_lock_current(fd, hunt_id, 1) < 0)
+        return STORE_ERR_IO;
+    int rc = store_read_header(fd, hdr);
+    if (rc == STORE_OK)
+        rc = compact_locked(fd, hunt_id, hdr);
+    store_unlock(fd);
+    return rc;
+}
+
+int store_remove(int fd, const char *hunt_id, TreasureFileHeader *hdr, int32_t id, int *compact_rc) {
+    if (store_lock_current(fd, hunt_id, 1) < 0)
+        return STORE_ERR_IO;
+
+    TreasureIndexHeader ih;
+    int idx_fd = -1;
+    uint64_t slot = 0;
+    Treasure t;
+    int rc = store_read_header(fd, hdr);
+    if (rc == STORE_OK) {
+        idx_fd = index_open_current(hunt_id, fd, hdr, &ih);
+        if (idx_fd < 0)
+            rc = idx_fd;
+    }
+    for (int rebuilt = 0; rc == STORE_OK; rebuilt = 1) {
+        rc = index_find(idx_fd, &ih, id, &slot);
+        if (rc == STORE_OK)
+            rc = store_read_record(fd, hdr, slot, &t);
+        if (rc != STORE_OK || (t.id == id && !treasure_deleted(&t)))
+            break;
+        // A hit on another record or a tombstone means the index is stale
+        // despite its stamp: rebuild it once from the data and look again
+        rc = STORE_ERR_INDEX;
+        if (rebuilt)
+            break;
+        close(idx_fd);
+        idx_fd = -1;
+        int irc = index_rebuild(hunt_id, fd, hdr);
+        if (irc == STORE_OK)
+            irc = index_open(hunt_id, hdr, 1, &ih);
+        if (irc < 0)
+            break;
+        idx_fd = irc;
+        rc = STORE_OK;
+    }
+
+    // Tombstone the record in place: only its flags word and the header
+    // are written, through the journal so that both or neither land.
+    struct stat st;
+    if (rc == STORE_OK && fstat(fd, &st) < 0)
+        rc = STORE_ERR_IO;
+    if (rc == STORE_OK) {
+        StoreJournalEntry e;
+        memset(&e, 0, sizeof(e));
+        memcpy(e.magic, JOURNAL_MAGIC, sizeof(e.magic));
+        e.version = JOURNAL_VERSION;
+        e.data_ino = (uint64_t)st.st_ino;
+        e.base_generation = hdr->generation;
+        e.slot = slot;
+        e.flags = t.flags | TREASURE_FLAG_DELETED;
+        e.hdr = *hdr;
+        e.hdr.dead_count++;
+        e.hdr.generation++;
+        e.hdr.epoch++;
+        e.checksum = journal_checksum(&e);
+        rc = journal_commit(fd, hunt_id, &e);
+        if (rc == STORE_OK)
+            *hdr = e.hdr;
+    }
+    if (rc == STORE_OK && index_delete(idx_fd, &ih, id) == STORE_OK)
+        index_stamp(idx_fd, &ih, hdr);
+    if (idx_fd >= 0)
+        close(idx_fd);
+
+    int crc = STORE_OK;
+    if (rc == STORE_OK && store_needs_compaction(hdr))
+        crc = compact_locked(fd, hunt_id, hdr);
+    if (compact_rc)
+        *compact_rc = crc;
+
+    store_unlock(fd);
+    return rc;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int store_list_hunts(char ***names) {
+    *names = NULL;
+    DIR *d = opendir(".");
+    if (!d)
+        return STORE_ERR_IO;
+
+    int count = 0, capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.')
+            continue;
+        if (entry->d_type != DT_DIR && entry->d_type != DT_UNKNOWN)
+            continue;
+        char path[512];
+        struct stat st;
+        hunt_path(path, sizeof(path), entry->d_name, TREASURE_FILE);
+        if (stat(path, &st) < 0 || !S_ISREG(st.st_mode))
+            continue;
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            char **grown = realloc(*names, (size_t)capacity * sizeof(char *));
+            if (!grown)
+                break;
+            *names = grown;
+        }
+        (*names)[count] = strdup(entry->d_name);
+        if ((*names)[count])
+            count++;
+    }
+    closedir(d);
+
+    if (count > 1)
+        qsort(*names, (size_t)count, sizeof(char *), compare_names);
+    return count;
+}
+
+void store_free_hunts(char **names, int count) {
+    for (int i = 0; i < count; i++)
+        free(names[i]);
+    free(names);
+}
+
+const char *store_strerror(int rc) {
+    switch (rc) {
+    case STORE_OK:
+        return "success";
+    case STORE_ERR_IO:
+        return strerror(errno);
+    case STORE_ERR_FORMAT:
+        return "not a valid treasures.dat (legacy file? run ./migrate_hunts)";
+    case STORE_ERR_VERSION:
+        return "unsupported treasures.dat version (older hunt? run ./migrate_hunts)";
+    case STORE_ERR_NOT_FOUND:
+        return "treasure not found";
+    case STORE_ERR_EXISTS:
+        return "treasure ID already exists";
+    case STORE_ERR_TRUNCATED:
+        return "treasures.dat is shorter than its header says (damaged file)";
+    case STORE_ERR_INDEX:
+        return "treasures.idx does not match treasures.dat (stale index)";
+    default:
+        return "unknown error";
+    }
+}
@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/file.h>
+
+#include "treasure.h"
+
+static uint64_t hash_name(const char *name) {
+    uint64_t h = 1469598103934665603ULL;
+    for (; *name; name++)
+        h = (h ^ (unsigned char)*name) * 1099511628211ULL;
+    return h;
+}
+
+static int lock_dict(int fd, int exclusive) {
+    while (flock(fd, exclusive ? LOCK_EX : LOCK_SH) < 0) {
+        if (errno != EINTR)
+            return STORE_ERR_IO;
+    }
+    return STORE_OK;
+}
+
+static int find_name(const UserDict *d, const char *name, uint32_t *id) {
+    if (d->slot_capacity == 0)
+        return 0;
+    size_t mask = d->slot_capacity - 1;
+    for (size_t pos = hash_name(name) & mask; d->slots[pos]; pos = (pos + 1) & mask) {
+        uint32_t candidate = d->slots[pos] - 1;
+        if (strcmp(d->names[candidate], name) == 0) {
+            *id = candidate;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Grows the hash table to stay at most half full
+static int reserve_slots(UserDict *d, uint64_t count) {
+    if (count * 2 <= d->slot_capacity)
+        return STORE_OK;
+    size_t capacity = d->slot_capacity ? d->slot_capacity : 64;
+    while (count * 2 > capacity)
+        capacity *= 2;
+    uint32_t *slots = calloc(capacity, sizeof(uint32_t));
+    if (!slots)
+        return STORE_ERR_IO;
+    for (uint64_t i = 0; i < d->count; i++) {
+        size_t pos = hash_name(d->names[i]) & (capacity - 1);
+        while (slots[pos])
+            pos = (pos + 1) & (capacity - 1);
+        slots[pos] = (uint32_t)i + 1;
+    }
+    free(d->slots);
+    d->slots = slots;
+    d->slot_capacity = capacity;
+    return STORE_OK;
+}
+
+static int reserve_names(UserDict *d, uint64_t count) {
+    if (count <= d->capacity)
+        return STORE_OK;
+    uint64_t capacity = d->capacity ? d->capacity : 64;
+    while (capacity < count)
+        capacity *= 2;
+    char (*names)[USERNAME_MAX] = realloc(d->names, capacity * USERNAME_MAX);
+    if (!names)
+        return STORE_ERR_IO;
+    d->names = names;
+    d->capacity = capacity;
+    return STORE_OK;
+}
+
+static void add_slot(UserDict *d, uint32_t id) {
+    size_t mask = d->slot_capacity - 1;
+    size_t pos = hash_name(d->names[id]) & mask;
+    while (d->slots[pos])
+        pos = (pos + 1) & mask;
+    d->slots[pos] = id + 1;
+}
+
+// Reads the names appended since the dictionary was last loaded
+static int refresh(UserDict *d) {
+    UserDictHeader uh;
+    ssize_t r = pread(d->fd, &uh, sizeof(uh), 0);
+    if (r == 0)
+        return STORE_OK;    // created but not initialized yet
+    if (r != sizeof(uh) || memcmp(uh.magic, USERS_MAGIC, sizeof(uh.magic)) != 0)
+        return STORE_ERR_FORMAT;
+    if (uh.version != USERS_VERSION)
+        return STORE_ERR_VERSION;
+    if (uh.count > UINT32_MAX - 1 || uh.count < d->count)
+        return STORE_ERR_FORMAT;
+    if (uh.count == d->count)
+        return STORE_OK;
+
+    if (reserve_names(d, uh.count) < 0 || reserve_slots(d, uh.count) < 0)
+        return STORE_ERR_IO;
+    size_t len = (size_t)(uh.count - d->count) * USERNAME_MAX;
+    off_t off = (off_t)sizeof(uh) + (off_t)(d->count * USERNAME_MAX);
+    r = pread(d->fd, d->names[d->count], len, off);
+    if (r < 0)
+        return STORE_ERR_IO;
+    if ((size_t)r != len)
+        return STORE_ERR_FORMAT;
+    store_counters.bytes_read += len;
+    for (uint64_t i = d->count; i < uh.count; i++) {
+        d->names[i][USERNAME_MAX - 1] = '\0';
+        add_slot(d, (uint32_t)i);
+    }
+    // Another writer's names may not be synced yet either
+    d->dirty = d->writable;
+    d->count = uh.count;
+    return STORE_OK;
+}
+
+int user_dict_open(UserDict *d, const char *hunt_id, int create) {
+    memset(d, 0, sizeof(*d));
+    d->fd = -1;
+    char path[512];
+    hunt_path(path, sizeof(path), hunt_id, USERS_FILE);
+    if (create) {
+        d->fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+        // A new file must survive a crash along with the records using it
+        if (d->fd >= 0 && store_sync_dir(hunt_id) < 0) {
+            user_dict_close(d);
+            return STORE_ERR_IO;
+        }
+        if (d->fd < 0 && errno == EEXIST)
+            d->fd = open(path, O_RDWR);
+    } else {
+        d->fd = open(path, O_RDONLY);
+    }
+    if (d->fd < 0)
+        return !create && errno == ENOENT ? STORE_OK : STORE_ERR_IO;
+    d->writable = create;
+
+    int rc = lock_dict(d->fd, 0);
+    if (rc == STORE_OK) {
+        rc = refresh(d);
+        flock(d->fd, LOCK_UN);
+    }
+    if (rc != STORE_OK)
+        user_dict_close(d);
+    return rc;
+}
+
+void user_dict_close(UserDict *d) {
+    if (d->fd >= 0)
+        close(d->fd);
+    free(d->names);
+    free(d->slots);
+    memset(d, 0, sizeof(*d));
+    d->fd = -1;
+}
+
+int user_dict_intern(UserDict *d, const char *name, uint32_t *id) {
+    char key[USERNAME_MAX] = {0};
+    memcpy(key, name, strnlen(name, USERNAME_MAX - 1));
+    if (find_name(d, key, id))
+        return STORE_OK;
+    if (!d->writable) {
+        errno = EBADF;
+        return STORE_ERR_IO;
+    }
+
+    // Another process may have added it since we loaded
+    int rc = lock_dict(d->fd, 1);
+    if (rc != STORE_OK)
+        return rc;
+    rc = refresh(d);
+    if (rc == STORE_OK && find_name(d, key, id)) {
+        flock(d->fd, LOCK_UN);
+        return STORE_OK;
+    }
+    if (rc == STORE_OK && (reserve_names(d, d->count + 1) < 0 || reserve_slots(d, d->count + 1) < 0))
+        rc = STORE_ERR_IO;
+
+    // The name is synced before the header count that makes it visible, so
+    // a crash cannot keep the count with an empty slot
+    UserDictHeader uh;
+    memset(&uh, 0, sizeof(uh));
+    memcpy(uh.magic, USERS_MAGIC, sizeof(uh.magic));
+    uh.version = USERS_VERSION;
+    uh.count = d->count + 1;
+    off_t off = (off_t)sizeof(uh) + (off_t)(d->count * USERNAME_MAX);
+    if (rc == STORE_OK)
+        rc = store_write_full(d->fd, key, USERNAME_MAX, off);
+    if (rc == STORE_OK)
+        rc = store_sync(d->fd);
+    if (rc == STORE_OK)
+        rc = store_write_full(d->fd, &uh, sizeof(uh), 0);
+    flock(d->fd, LOCK_UN);
+    if (rc != STORE_OK)
+        return rc;
+
+    d->dirty = 1;
+    memcpy(d->names[d->count], key, USERNAME_MAX);
+    add_slot(d, (uint32_t)d->count);
+    *id = (uint32_t)d->count++;
+    return STORE_OK;
+}
+
+// Syncs the header counts written since the last call. A crash before it
+// can only lose names that no committed record refers to yet.
+int user_dict_sync(UserDict *d) {
+    if (!d->dirty)
+        return STORE_OK;
+    int rc = store_sync(d->fd);
+    if (rc == STORE_OK)
+        d->dirty = 0;
+    return rc;
+}
+
+const char *user_dict_name(const UserDict *d, uint32_t id) {
+    return id < d->count ? d->names[id] : "?";
+}
+
+int user_dict_find(const UserDict *d, const char *name, uint32_t *id) {
+    char key[USERNAME_MAX] = {0};
+    memcpy(key, name, strnlen(name, USERNAME_MAX - 1));
+    return find_name(d, key, id);
+}
@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "value_stats.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+typedef void (*values_fn)(const int32_t *v, size_t n, int32_t threshold, ValueStats *s);
+typedef uint64_t (*bbox_fn)(const double *lat, const double *lon, size_t n, const GeoQuery *box);
+
+void value_stats_init(ValueStats *s) {
+    memset(s, 0, sizeof(*s));
+    s->min = INT32_MAX;
+    s->max = INT32_MIN;
+}
+
+static void values_scalar(const int32_t *v, size_t n, int32_t threshold, ValueStats *s) {
+    int64_t sum = 0;
+    int32_t min = s->min, max = s->max;
+    uint64_t above = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += v[i];
+        min = v[i] < min ? v[i] : min;
+        max = v[i] > max ? v[i] : max;
+        above += v[i] > threshold;
+    }
+    s->count += n;
+    s->sum += sum;
+    s->min = min;
+    s->max = max;
+    s->above += above;
+}
+
+static int in_lon(double lon, const GeoQuery *box) {
+    return box->lon_min <= box->lon_max ? lon >= box->lon_min && lon <= box->lon_max
+                                        : lon >= box->lon_min || lon <= box->lon_max;
+}
+
+static uint64_t bbox_scalar(const double *lat, const double *lon, size_t n, const GeoQuery *box) {
+    uint64_t count = 0;
+    for (size_t i = 0; i < n; i++)
+        count += lat[i] >= box->lat_min && lat[i] <= box->lat_max && in_lon(lon[i], box);
+    return count;
+}
+
+#ifdef HAVE_X86_KERNELS
+// Eight values per step: 32-bit min/max/compare, sums widened to 64 bits
+__attribute__((target("avx2")))
+static void values_avx2(const int32_t *v, size_t n, int32_t threshold, ValueStats *s) {
+    __m256i vmin = _mm256_set1_epi32(s->min), vmax = _mm256_set1_epi32(s->max);
+    __m256i thr = _mm256_set1_epi32(threshold);
+    __m256i sum_lo = _mm256_setzero_si256(), sum_hi = _mm256_setzero_si256();
+    uint64_t above = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(v + i));
+        vmin = _mm256_min_epi32(vmin, x);
+        vmax = _mm256_max_epi32(vmax, x);
+        sum_lo = _mm256_add_epi64(sum_lo, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(x)));
+        sum_hi = _mm256_add_epi64(sum_hi, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(x, 1)));
+        above += (uint64_t)__builtin_popcount(
+            _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(x, thr))));
+    }
+
+    int32_t mins[8], maxs[8];
+    int64_t sums[4];
+    _mm256_storeu_si256((__m256i *)mins, vmin);
+    _mm256_storeu_si256((__m256i *)maxs, vmax);
+    _mm256_storeu_si256((__m256i *)sums, _mm256_add_epi64(sum_lo, sum_hi));
+    for (int k = 0; k < 8; k++) {
+        s->min = mins[k] < s->min ? mins[k] : s->min;
+        s->max = maxs[k] > s->max ? maxs[k] : s->max;
+    }
+    s->sum += sums[0] + sums[1] + sums[2] + sums[3];
+    s->count += i;
+    s->above += above;
+    values_scalar(v + i, n - i, threshold, s);
+}
+
+__attribute__((target("sse4.1")))
+static void values_sse(const int32_t *v, size_t n, int32_t threshold, ValueStats *s) {
+    __m128i vmin = _mm_set1_epi32(s->min), vmax = _mm_set1_epi32(s->max);
+    __m128i thr = _mm_set1_epi32(threshold);
+    __m128i sum = _mm_setzero_si128();
+    uint64_t above = 0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(v + i));
+        vmin = _mm_min_epi32(vmin, x);
+        vmax = _mm_max_epi32(vmax, x);
+        sum = _mm_add_epi64(sum, _mm_cvtepi32_epi64(x));
+        sum = _mm_add_epi64(sum, _mm_cvtepi32_epi64(_mm_unpackhi_epi64(x, x)));
+        above += (uint64_t)__builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(x, thr))));
+    }
+
+    int32_t mins[4], maxs[4];
+    int64_t sums[2];
+    _mm_storeu_si128((__m128i *)mins, vmin);
+    _mm_storeu_si128((__m128i *)maxs, vmax);
+    _mm_storeu_si128((__m128i *)sums, sum);
+    for (int k = 0; k < 4; k++) {
+        s->min = mins[k] < s->min ? mins[k] : s->min;
+        s->max = maxs[k] > s->max ? maxs[k] : s->max;
+    }
+    s->sum += sums[0] + sums[1];
+    s->count += i;
+    s->above += above;
+    values_scalar(v + i, n - i, threshold, s);
+}
+
+// Four points per step; the ordered compares are false for NaN, like the
+// scalar ones
+__attribute__((target("avx2")))
+static uint64_t bbox_avx2(const double *lat, const double *lon, size_t n, const GeoQuery *box) {
+    __m256d lat_min = _mm256_set1_pd(box->lat_min), lat_max = _mm256_set1_pd(box->lat_max);
+    __m256d lon_min = _mm256_set1_pd(box->lon_min), lon_max = _mm256_set1_pd(box->lon_max);
+    int wraps = box->lon_min > box->lon_max;
+    uint64_t count = 0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d la = _mm256_loadu_pd(lat + i), lo = _mm256_loadu_pd(lon + i);
+        __m256d in = _mm256_and_pd(_mm256_cmp_pd(la, lat_min, _CMP_GE_OQ), _mm256_cmp_pd(la, lat_max, _CMP_LE_OQ));
+        __m256d ge = _mm256_cmp_pd(lo, lon_min, _CMP_GE_OQ), le = _mm256_cmp_pd(lo, lon_max, _CMP_LE_OQ);
+        in = _mm256_and_pd(in, wraps ? _mm256_or_pd(ge, le) : _mm256_and_pd(ge, le));
+        count += (uint64_t)__builtin_popcount(_mm256_movemask_pd(in));
+    }
+    return count + bbox_scalar(lat + i, lon + i, n - i, box);
+}
+
+__attribute__((target("sse2")))
+static uint64_t bbox_sse(const double *lat, const double *lon, size_t n, const GeoQuery *box) {
+    __m128d lat_min = _mm_set1_pd(box->lat_min), lat_max = _mm_set1_pd(box->lat_max);
+    __m128d lon_min = _mm_set1_pd(box->lon_min), lon_max = _mm_set1_pd(box->lon_max);
+    int wraps = box->lon_min > box->lon_max;
+    uint64_t count = 0;
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d la = _mm_loadu_pd(lat + i), lo = _mm_loadu_pd(lon + i);
+        __m128d in = _mm_and_pd(_mm_cmpge_pd(la, lat_min), _mm_cmple_pd(la, lat_max));
+        __m128d ge = _mm_cmpge_pd(lo, lon_min), le = _mm_cmple_pd(lo, lon_max);
+        in = _mm_and_pd(in, wraps ? _mm_or_pd(ge, le) : _mm_and_pd(ge, le));
+        count += (uint64_t)__builtin_popcount(_mm_movemask_pd(in));
+    }
+    return count + bbox_scalar(lat + i, lon + i, n - i, box);
+}
+#endif
+
+static values_fn values_kernel;
+static bbox_fn bbox_kernel;
+static const char *kernels;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+// Run once through pthread_once, which also publishes the choice to every
+// thread that later passes select_kernels
+static void pick_kernels(void) {
+    const char *forced = getenv("TREASURE_KERNELS");
+    values_kernel = values_scalar;
+    bbox_kernel = bbox_scalar;
+    const char *name = "scalar";
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && (!forced || strcmp(forced, "avx2") == 0)) {
+        values_kernel = values_avx2;
+        bbox_kernel = bbox_avx2;
+        name = "avx2";
+    } else if (__builtin_cpu_supports("sse4.1") && (!forced || strcmp(forced, "sse") == 0)) {
+        values_kernel = values_sse;
+        bbox_kernel = bbox_sse;
+        name = "sse";
+    }
+#endif
+    kernels = name;
+}
+
+static void select_kernels(void) {
+    pthread_once(&kernels_once, pick_kernels);
+}
+
+void kernel_values(const int32_t *values, size_t n, int32_t threshold, ValueStats *s) {
+    select_kernels();
+    values_kernel(values, n, threshold, s);
+}
+
+uint64_t kernel_bbox_count(const double *lat, const double *lon, size_t n, const GeoQuery *box) {
+    select_kernels();
+    return bbox_kernel(lat, lon, n, box);
+}
+
+const char *kernel_name(void) {
+    select_kernels();
+    return kernels;
+}
+
+// Records not in the snapshot are copied into column-shaped chunks first
+static int stats_from_scan(int fd, const TreasureFileHeader *hdr, uint64_t first, int32_t threshold,
+                           const GeoQuery *box, ValueStats *s, uint64_t *bytes) {
+    StoreScan scan;
+    int rc = store_scan_open_at(&scan, fd, hdr, first);
+    if (rc != STORE_OK)
+        return rc;
+    int32_t values[SCAN_CHUNK];
+    double lat[SCAN_CHUNK], lon[SCAN_CHUNK];
+    size_t n = 0;
+    const Treasure *t;
+    for (;;) {
+        t = store_scan_next(&scan, NULL);
+        if (t) {
+            values[n] = t->value;
+            lat[n] = t->latitude;
+            lon[n] = t->longitude;
+            n++;
+        }
+        if (n == SCAN_CHUNK || (!t && n > 0)) {
+            kernel_values(values, n, threshold, s);
+            if (box)
+                s->in_box += kernel_bbox_count(lat, lon, n, box);
+            *bytes += n * sizeof(Treasure);
+            n = 0;
+        }
+        if (!t)
+            break;
+    }
+    rc = store_scan_error(&scan);
+    store_scan_close(&scan);
+    return rc;
+}
+
+int store_hunt_stats(const char *hunt_id, int32_t threshold, const GeoQuery *box,
+                     ValueStats *s, uint64_t *bytes_scanned, int *columnar) {
+    value_stats_init(s);
+    *bytes_scanned = 0;
+    *columnar = 0;
+
+    TreasureFileHeader hdr;
+    int fd = store_open(hunt_id, 0, 0, &hdr);
+    if (fd < 0)
+        return fd;
+
+    ColumnSnapshot cs;
+    unsigned mask = COL_MASK(COL_VALUE);
+    if (box)
+        mask |= COL_MASK(COL_LATITUDE) | COL_MASK(COL_LONGITUDE);
+    uint64_t covered = 0;
+    if (columns_open(&cs, hunt_id, &hdr, mask) == STORE_OK) {
+        uint64_t rows = cs.meta.rows;
+        kernel_values(cs.data[COL_VALUE], rows, threshold, s);
+        *bytes_scanned += rows * sizeof(int32_t);
+        if (box) {
+            s->in_box += kernel_bbox_count(cs.data[COL_LATITUDE], cs.data[COL_LONGITUDE], rows, box);
+            *bytes_scanned += rows * 2 * sizeof(double);
+        }
+        covered = cs.meta.data_record_count;
+        store_counters.records_scanned += rows;
+        store_counters.bytes_read += *bytes_scanned;
+        columns_close(&cs);
+        *columnar = 1;
+    }
+
+    int rc = STORE_OK;
+    if (covered < hdr.record_count)
+        rc = stats_from_scan(fd, &hdr, covered, threshold, box, s, bytes_scanned);
+    close(fd);
+    return rc;
+}
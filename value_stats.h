@@ -0,0 +1,37 @@
+#ifndef VALUE_STATS_H
+#define VALUE_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "treasure.h"
+
+// Aggregates over the value and coordinate columns of a hunt. The inner
+// loops are AVX2 or SSE kernels picked at run time from what the CPU
+// supports, with a scalar fallback; TREASURE_KERNELS=scalar|sse|avx2 in the
+// environment forces one (e.g. to compare them).
+typedef struct {
+    uint64_t count;
+    int64_t sum;
+    int32_t min;            // INT32_MAX / INT32_MIN while count == 0
+    int32_t max;
+    uint64_t above;         // values > threshold
+    uint64_t in_box;        // coordinates inside the box, if one was given
+} ValueStats;
+
+void value_stats_init(ValueStats *s);
+
+// Folds n values into s
+void kernel_values(const int32_t *values, size_t n, int32_t threshold, ValueStats *s);
+// Number of the n points inside box (box->lon_min > box->lon_max wraps)
+uint64_t kernel_bbox_count(const double *lat, const double *lon, size_t n, const GeoQuery *box);
+// Name of the kernels in use: "avx2", "sse" or "scalar"
+const char *kernel_name(void);
+
+// Stats of every live treasure of a hunt, read from the columnar snapshot
+// when it is current (plus the records appended since) and from
+// treasures.dat otherwise. box may be NULL. *columnar tells which was used.
+int store_hunt_stats(const char *hunt_id, int32_t threshold, const GeoQuery *box,
+                     ValueStats *s, uint64_t *bytes_scanned, int *columnar);
+
+#endif